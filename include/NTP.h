@@ -11,6 +11,12 @@
     Concept, Design and Implementation by: Craig A. Lindley
     Version: 2.0
     Last Update: 06/10/2016
+
+    The blocking TimeLib sync provider has been replaced by a state machine
+    that is stepped by NTPRun() from the scheduler: the server name is
+    looked up by resolver.h, a request is sent in one call and the answer
+    is picked up by udp.parsePacket() in a later one. Failed attempts rotate
+    through the server list with exponential backoff.
 */
 
 #ifndef NTP_H
@@ -20,109 +26,263 @@
 #include <ESP8266WiFi.h>
 #include <TimeLib.h>
 #include <WiFiUdp.h>
+#include "resolver.h"
 
 #define LOCALPORT     2390 // Local port to listen for UDP packets
 #define NTP_PACKET_SIZE 48 // NTP time stamp is in the first 48 bytes of the message
 
+#define NTP_EPOCH_OFFSET      2208988800UL  // Seconds between 1900-01-01 and 1970-01-01
+#define NTP_RESPONSE_TIMEOUT  1500          // ms to wait for an answer
+#define NTP_MIN_BACKOFF       2000          // ms
+#define NTP_MAX_BACKOFF       300000        // ms
+
+enum NTP_STATE {
+  NTP_IDLE,
+  NTP_RESOLVING,        // Waiting for the address of the server
+  NTP_WAITING
+};
+
+enum NTP_RESPONSE {
+  NTP_RESPONSE_OK,
+  NTP_RESPONSE_IGNORE,  // Not an answer to our request, keep waiting
+  NTP_RESPONSE_REJECT   // Kiss-o'-death or unsynchronized server, try another one
+};
+
+struct ntpResult_t{
+  uint64_t time;        // Corrected time at T4, ms since 1900
+  int64_t offset;       // ms, server clock minus local clock
+  int64_t delay;        // ms, round trip without the server's processing time
+};
+
+struct ntpState_t{
+  NTP_STATE state;
+  uint8_t server;               // Index into ntpServerNames
+  IPAddress serverIP;
+
+  unsigned long requestSentAt;  // millis()
+  unsigned long nextAttemptAt;  // millis()
+  unsigned long backoff;        // ms
+
+  uint64_t t1;                  // Local time the request was sent at, ms since 1900
+  byte originate[8];            // Transmit timestamp of our request, echoed by the server
+
+  bool synced;
+  uint64_t baseTime;            // ms since 1900 at the last sync...
+  unsigned long baseMillis;     // ...and the millis() value it was taken at
+
+  int64_t lastOffset;
+  int64_t lastDelay;
+  unsigned long successes;
+  unsigned long failures;
+};
+
 // A UDP instance to let us send and receive packets over UDP
 WiFiUDP udp;
 
 byte packetBuffer[NTP_PACKET_SIZE]; // Buffer to hold incoming and outgoing packets
 
+ntpState_t ntp;
+
 // Don't hardwire the IP address or we won't get the benefits of the time server pool.
-IPAddress timeServerIP;
 #ifdef __debugSettings
-const char *ntpServerName = "192.168.1.3";
+const char *ntpServerNames[] = {"192.168.1.3", "time.nist.gov", "pool.ntp.org"};
 #else
-const char *ntpServerName = "time.nist.gov";
-//const char *ntpServerName = "nl.pool.ntp.org";
+const char *ntpServerNames[] = {"time.nist.gov", "pool.ntp.org", "nl.pool.ntp.org"};
 #endif
+#define NTP_SERVER_COUNT (sizeof(ntpServerNames) / sizeof(ntpServerNames[0]))
+
+uint32_t NTPReadUInt32(const byte *p){
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+void NTPWriteUInt32(byte *p, uint32_t value){
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+// Converts a 64 bit NTP timestamp (seconds + 2^-32 fractions) to ms since 1900
+uint64_t NTPTimestampToMs(const byte *p){
+  return (uint64_t)NTPReadUInt32(p) * 1000 + (((uint64_t)NTPReadUInt32(p + 4) * 1000 + 0x80000000UL) >> 32);
+}
+
+void NTPMsToTimestamp(uint64_t ms, byte *p){
+  NTPWriteUInt32(p, (uint32_t)(ms / 1000));
+  NTPWriteUInt32(p + 4, (uint32_t)(((ms % 1000) << 32) / 1000));
+}
+
+// Local clock in ms since 1900. Runs off millis() once synced, so it has a
+// finer resolution than TimeLib's now().
+uint64_t NTPLocalTime(){
+  if (ntp.synced)
+    return ntp.baseTime + (millis() - ntp.baseMillis);
+
+  return ((uint64_t)now() + NTP_EPOCH_OFFSET) * 1000;
+}
 
-// Send an NTP request to the time server at the given address
-unsigned long sendNTPpacket(IPAddress& address) {
+// Fills the buffer with a client request carrying t1 as transmit timestamp
+void NTPBuildRequest(byte *buffer, uint64_t t1) {
 
   // Set all bytes in the buffer to 0
-  memset(packetBuffer, 0, NTP_PACKET_SIZE);
+  memset(buffer, 0, NTP_PACKET_SIZE);
 
   // Initialize values needed to form NTP request
-  packetBuffer[0] = 0b11100011;   // LI, Version, Mode
-  packetBuffer[1] = 0;     // Stratum, or type of clock
-  packetBuffer[2] = 6;     // Polling Interval
-  packetBuffer[3] = 0xEC;  // Peer Clock Precision
+  buffer[0] = 0b11100011;   // LI, Version, Mode
+  buffer[1] = 0;     // Stratum, or type of clock
+  buffer[2] = 6;     // Polling Interval
+  buffer[3] = 0xEC;  // Peer Clock Precision
   // 8 bytes of zero for Root Delay & Root Dispersion
-  packetBuffer[12]  = 49;
-  packetBuffer[13]  = 0x4E;
-  packetBuffer[14]  = 49;
-  packetBuffer[15]  = 52;
-
-  // All NTP fields have been given values, now
-  // you can send a packet requesting a timestamp:
-  udp.beginPacket(address, 123); // NTP requests are to port 123
-  udp.write(packetBuffer, NTP_PACKET_SIZE);
-  udp.endPacket();
-  return 0;
+  buffer[12]  = 49;
+  buffer[13]  = 0x4E;
+  buffer[14]  = 49;
+  buffer[15]  = 52;
+
+  // The server copies this into the originate timestamp of its answer
+  NTPMsToTimestamp(t1, buffer + 40);
+}
+
+// Validates an answer and calculates clock offset and round trip delay from
+// the four timestamps: T1 (request sent, local clock), T2 (request received,
+// server clock), T3 (answer sent, server clock) and T4 (answer received,
+// local clock).
+NTP_RESPONSE NTPProcessResponse(const byte *buffer, const byte *originate, uint64_t t1, uint64_t t4, ntpResult_t &result){
+
+  byte leapIndicator = buffer[0] >> 6;
+  byte mode = buffer[0] & 0x07;
+  byte stratum = buffer[1];
+
+  if (mode != 4) return NTP_RESPONSE_IGNORE;
+  if (memcmp(buffer + 24, originate, 8) != 0) return NTP_RESPONSE_IGNORE;
+
+  if (leapIndicator == 3 || stratum == 0 || stratum > 15) return NTP_RESPONSE_REJECT;
+  if (NTPReadUInt32(buffer + 40) == 0) return NTP_RESPONSE_REJECT;
+
+  int64_t t2 = NTPTimestampToMs(buffer + 32);
+  int64_t t3 = NTPTimestampToMs(buffer + 40);
+
+  result.offset = ((t2 - (int64_t)t1) + (t3 - (int64_t)t4)) / 2;
+  result.delay = ((int64_t)t4 - (int64_t)t1) - (t3 - t2);
+  if (result.delay < 0) result.delay = 0;
+  result.time = t4 + result.offset;
+
+  return NTP_RESPONSE_OK;
+}
+
+// Gives up on the current server and schedules the next one
+void NTPFail(){
+  ntp.failures++;
+  ntp.state = NTP_IDLE;
+
+  // A pool may answer with another address next time
+  ResolverForget(ntpServerNames[ntp.server]);
+  ntp.server = (ntp.server + 1) % NTP_SERVER_COUNT;
+
+  ntp.nextAttemptAt = millis() + ntp.backoff;
+  ntp.backoff *= 2;
+  if (ntp.backoff > NTP_MAX_BACKOFF) ntp.backoff = NTP_MAX_BACKOFF;
+
+  Serial.println("No time from the NTP server, retrying with the next one...");
 }
 
-// NTP Time Provider Code
-time_t getNTPTime() {
+// Steps the NTP state machine, never blocks on the network. Returns true
+// when the clock was set.
+bool NTPRun(){
 
-  int attempts = 40;
+  switch (ntp.state) {
 
-  // Try multiple attempts to return the NTP time
-  while (attempts--) {
+    case NTP_IDLE:
+      if ((long)(millis() - ntp.nextAttemptAt) < 0) return false;
 
-    // Get a server from the pool
-    WiFi.hostByName(ntpServerName, timeServerIP);
-    Serial.print("Trying time server: ");
-    Serial.println(timeServerIP);
+      ntp.state = NTP_RESOLVING;
+      // fall through
 
-    while (udp.parsePacket() > 0); // Discard any previously received packets
+    case NTP_RESOLVING:
+      switch (ResolverLookup(ntpServerNames[ntp.server], ntp.serverIP)) {
+        case RESOLVER_RESOLVED:
+          break;
 
-    Serial.println("Transmitted NTP Request.");
-    sendNTPpacket(timeServerIP);
+        case RESOLVER_FAILED:
+          NTPFail();
+          return false;
 
-    uint32_t beginWait = millis();
-    while (millis() - beginWait < 1500) {
-      int size = udp.parsePacket();
-      if (size >= NTP_PACKET_SIZE) {
-        Serial.println("Received NTP Response.");
+        default:
+          return false;
+      }
+
+      Serial.print("Trying time server: ");
+      Serial.println(ntp.serverIP);
+
+      while (udp.parsePacket() > 0); // Discard any previously received packets
+
+      ntp.t1 = NTPLocalTime();
+      NTPBuildRequest(packetBuffer, ntp.t1);
+      memcpy(ntp.originate, packetBuffer + 40, 8);
+
+      udp.beginPacket(ntp.serverIP, 123); // NTP requests are to port 123
+      udp.write(packetBuffer, NTP_PACKET_SIZE);
+      udp.endPacket();
+
+      ntp.requestSentAt = millis();
+      ntp.state = NTP_WAITING;
+      return false;
+
+    case NTP_WAITING:
+      if (udp.parsePacket() >= NTP_PACKET_SIZE) {
         udp.read(packetBuffer, NTP_PACKET_SIZE);  // Read packet into the buffer
-        unsigned long secsSince1900;
+        uint64_t t4 = NTPLocalTime();
+
+        ntpResult_t result;
+        switch (NTPProcessResponse(packetBuffer, ntp.originate, ntp.t1, t4, result)) {
+          case NTP_RESPONSE_OK:
+            setTime((time_t)(result.time / 1000 - NTP_EPOCH_OFFSET));
+
+            ntp.synced = true;
+            ntp.baseTime = result.time;
+            ntp.baseMillis = millis();
+            ntp.lastOffset = result.offset;
+            ntp.lastDelay = result.delay;
+            ntp.successes++;
 
-        // Convert four bytes starting at location 40 to a long integer
-        secsSince1900 =  (unsigned long) packetBuffer[40] << 24;
-        secsSince1900 |= (unsigned long) packetBuffer[41] << 16;
-        secsSince1900 |= (unsigned long) packetBuffer[42] << 8;
-        secsSince1900 |= (unsigned long) packetBuffer[43];
+            ntp.state = NTP_IDLE;
+            ntp.backoff = NTP_MIN_BACKOFF;
+            ntp.nextAttemptAt = millis() + NTP_REFRESH_INTERVAL * 1000UL;
 
-        Serial.println("Got the time.");
+            Serial.printf("Got the time, offset: %ld ms, delay: %ld ms\r\n", (long)result.offset, (long)result.delay);
+            return true;
 
-        return secsSince1900 - 2208988800UL;
+          case NTP_RESPONSE_REJECT:
+            NTPFail();
+            return false;
+
+          case NTP_RESPONSE_IGNORE:
+            break;
+        }
       }
-      delay(10);
-    }
-    Serial.println("Retrying NTP request...");
-    delay(4000);
+
+      if (millis() - ntp.requestSentAt >= NTP_RESPONSE_TIMEOUT) NTPFail();
+      return false;
   }
-  Serial.println("No NTP response.");
-  return 0;
+
+  return false;
 }
 
-// Assign NTP as the time sync provider
+// Prepares the NTP client, the first request goes out on the next NTPRun()
 void initNTP() {
 
   // Login suceeded so set UDP local port
   udp.begin(LOCALPORT);
 
-  // Set the time provider to NTP
-  setSyncProvider(getNTPTime);
-  setSyncInterval(NTP_REFRESH_INTERVAL);
+  ntp.state = NTP_IDLE;
+  ntp.backoff = NTP_MIN_BACKOFF;
+  ntp.nextAttemptAt = millis();
 }
 
-// Check for Internet connectivity
-boolean checkInternetConnection() {
-  int result = WiFi.hostByName(ntpServerName, timeServerIP);
-  return (result == 1);
+// Check for Internet connectivity by looking up the first time server,
+// poll it until it returns something else than RESOLVER_PENDING
+RESOLVER_STATUS checkInternetConnection() {
+  IPAddress ip;
+  return ResolverLookup(ntpServerNames[0], ip);
 }
 
 #endif
@@ -0,0 +1,114 @@
+/*
+    benchmark.h - Micro-benchmarks of the firmware hot paths
+
+    Benchmark() runs a function a number of times and measures the average
+    CPU cycles per call and what the call does to the heap. The same cases
+    run on the device (main.cpp, _use_benchmarks, started from the serial
+    console) and on the host (native build, "bench" command), so results
+    of an optimization can be compared with the earlier baseline on both.
+
+    On the host the heap is tracked by the malloc wrappers in
+    native/heap.h, which also count allocations and the peak. On the
+    device only the free heap can be read, so allocations and peak are
+    reported as unknown (-1) there.
+*/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <Arduino.h>
+
+typedef void (*benchFunction_t)();
+
+struct benchResult_t{
+  const char *name;
+  unsigned long iterations;
+  uint32_t cycles;          //  Per call
+  long retained;            //  Heap bytes still allocated after a call
+  long allocations;         //  Per call, -1 if unknown
+  long peakHeap;            //  Heap bytes in use at the worst moment of a call, -1 if unknown
+};
+
+uint32_t BenchCycles(){
+  #ifdef NATIVE
+  return (uint32_t)HalCycles();
+  #else
+  return ESP.getCycleCount();
+  #endif
+}
+
+long BenchHeapInUse(){
+  #ifdef NATIVE
+  return halHeapInUse;
+  #else
+  return -(long)ESP.getFreeHeap();
+  #endif
+}
+
+benchResult_t Benchmark(const char *name, benchFunction_t function, unsigned long iterations){
+  benchResult_t r;
+  r.name = name;
+  r.iterations = iterations;
+
+  //  Warm up caches, parsed templates and the like
+  function();
+
+  long heapBefore = BenchHeapInUse();
+  #ifdef NATIVE
+  unsigned long allocationsBefore = halAllocations;
+  halHeapPeak = halHeapInUse;
+  #endif
+
+  //  The cycle counter of the ESP8266 wraps after ~53 s, keep the runs shorter
+  uint32_t start = BenchCycles();
+  for (unsigned long i = 0; i < iterations; i++) {
+    function();
+  }
+  uint32_t cycles = BenchCycles() - start;
+
+  r.cycles = cycles / iterations;
+  r.retained = (BenchHeapInUse() - heapBefore) / (long)iterations;
+
+  #ifdef NATIVE
+  r.allocations = (halAllocations - allocationsBefore) / iterations;
+  r.peakHeap = halHeapPeak - heapBefore;
+  #else
+  r.allocations = -1;
+  r.peakHeap = -1;
+  #endif
+
+  return r;
+}
+
+void BenchPrintHeader(Print &out){
+  out.println("Benchmark                        Calls     Cycles/call  Allocs/call  Peak heap  Retained");
+}
+
+void BenchPrint(Print &out, const benchResult_t &r){
+  out.printf("%-32s %-9lu %-12lu %-12ld %-10ld %ld\r\n", r.name, r.iterations, (unsigned long)r.cycles, r.allocations, r.peakHeap, r.retained);
+}
+
+void BenchRun(Print &out, const char *name, benchFunction_t function, unsigned long iterations){
+  BenchPrint(out, Benchmark(name, function, iterations));
+}
+
+//  Runs both, prints them and the candidate's cycles as a percentage of the baseline's
+void BenchCompare(Print &out, const char *name, benchFunction_t function, const char *baselineName, benchFunction_t baseline, unsigned long iterations){
+  benchResult_t b = Benchmark(baselineName, baseline, iterations);
+  benchResult_t c = Benchmark(name, function, iterations);
+
+  BenchPrint(out, b);
+  BenchPrint(out, c);
+  out.printf("  %s takes %lu%% of the cycles of %s\r\n", name, b.cycles ? (unsigned long)((uint64_t)c.cycles * 100 / b.cycles) : 0, baselineName);
+}
+
+//  Output sink for rendering benchmarks, counts and drops everything
+class NullPrint : public Print {
+  public:
+    size_t write(uint8_t c) override { bytes++; return 1; }
+    size_t write(const uint8_t *buffer, size_t size) override { bytes += size; return size; }
+
+    size_t bytes = 0;
+};
+
+#endif
@@ -0,0 +1,76 @@
+/*
+    boot.h - Boot phase timing
+
+    setup() marks the end of each of its phases with BootPhase(), the
+    milestones reached later in the background (WiFi, NTP, MQTT) are marked
+    with BootMilestone() the first time they happen. The SDK starts its
+    clock at power on, so the times are measured from there.
+
+    The whole record goes out once, with the first heartbeat.
+*/
+
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define BOOT_MAX_PHASES 8
+
+enum BOOT_MILESTONE {
+  BOOT_IO_READY,          //  Relays and inputs are handled
+  BOOT_LOOP,              //  First pass of loop()
+  BOOT_WIFI,
+  BOOT_NTP,
+  BOOT_MQTT,
+  BOOT_MILESTONE_COUNT
+};
+
+const char * const bootMilestoneNames[BOOT_MILESTONE_COUNT] = {"IO", "Loop", "Wifi", "Ntp", "Mqtt"};
+
+struct bootPhase_t{
+  const char *name;
+  unsigned long end;      //  micros()
+};
+
+bootPhase_t bootPhases[BOOT_MAX_PHASES];
+uint8_t bootPhaseCount = 0;
+
+unsigned long bootMilestones[BOOT_MILESTONE_COUNT];    //  millis()
+uint8_t bootMilestonesReached = 0;                      //  Bit per BOOT_MILESTONE
+bool bootReported = false;
+
+void BootPhase(const char *name){
+  if (bootPhaseCount >= BOOT_MAX_PHASES) return;
+
+  bootPhases[bootPhaseCount].name = name;
+  bootPhases[bootPhaseCount].end = micros();
+  bootPhaseCount++;
+}
+
+void BootMilestone(BOOT_MILESTONE milestone){
+  if (bootMilestonesReached & (1 << milestone)) return;
+
+  bootMilestones[milestone] = millis();
+  bootMilestonesReached |= 1 << milestone;
+}
+
+//  "Phases": {"name": us, ...} with the duration of each phase,
+//  "Ready": {"name": ms, ...} with the milestones reached so far
+void BootToJson(JsonObject out){
+  JsonObject phases = out.createNestedObject("Phases");
+  unsigned long start = 0;
+
+  for (uint8_t i = 0; i < bootPhaseCount; i++) {
+    phases[bootPhases[i].name] = bootPhases[i].end - start;
+    start = bootPhases[i].end;
+  }
+
+  JsonObject ready = out.createNestedObject("Ready");
+
+  for (uint8_t i = 0; i < BOOT_MILESTONE_COUNT; i++) {
+    if (bootMilestonesReached & (1 << i)) ready[bootMilestoneNames[i]] = bootMilestones[i];
+  }
+}
+
+#endif
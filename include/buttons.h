@@ -0,0 +1,132 @@
+/*
+    buttons.h - Debounce and gesture recognition for the PCF8574 inputs
+
+    Every input channel has its own state machine fed with the edges queued
+    by inputs.h. Debouncing is leading edge: a change is accepted at once if
+    the debounced state has been stable for BUTTON_DEBOUNCE_TIME, further
+    bounces inside that window are ignored and the final level is picked up
+    by ButtonsUpdate() once the window has passed. This keeps the press to
+    relay latency at the input task interval.
+
+    Recognized gestures are reported through the handler passed to
+    ButtonsBegin(), see GESTURE in enums.h.
+*/
+
+#ifndef BUTTONS_H
+#define BUTTONS_H
+
+#include <Arduino.h>
+#include "inputs.h"
+
+typedef void (*gestureHandler_t)(uint8_t channel, GESTURE gesture, unsigned long timestamp);
+
+struct button_t{
+  uint8_t mask;               //  INPUT_MASK_x of the channel
+  bool raw;                   //  Last level seen on the pin, true = pressed
+  bool pressed;               //  Debounced level
+  unsigned long changedAt;    //  Time of the last debounced change
+  unsigned long pressedAt;
+  unsigned long releasedAt;
+  uint8_t clicks;             //  Short presses waiting for the double press window
+  bool holdReported;
+};
+
+const uint8_t inputMasks[INPUT_COUNT] = {INPUT_MASK_0, INPUT_MASK_1, INPUT_MASK_2, INPUT_MASK_3};
+
+button_t buttons[INPUT_COUNT];
+gestureHandler_t gestureHandler = NULL;
+
+void ReportGesture(uint8_t channel, GESTURE gesture, unsigned long timestamp){
+  if (gestureHandler != NULL) gestureHandler(channel, gesture, timestamp);
+}
+
+//  Accepts the raw level as the new debounced state if the lockout has passed
+void EvaluateButton(uint8_t channel, unsigned long timestamp){
+  button_t &b = buttons[channel];
+
+  if (b.raw == b.pressed) return;
+  //  Signed, an edge can carry an interrupt time older than the last update
+  if ((long)(timestamp - b.changedAt) < BUTTON_DEBOUNCE_TIME) return;
+
+  b.pressed = b.raw;
+  b.changedAt = timestamp;
+
+  if (b.pressed){
+    b.pressedAt = timestamp;
+    b.holdReported = false;
+
+    ReportGesture(channel, GESTURE_PRESS, timestamp);
+
+    if (b.clicks == 1 && timestamp - b.releasedAt <= BUTTON_DOUBLE_PRESS_WINDOW){
+      b.clicks = 2;
+      ReportGesture(channel, GESTURE_DOUBLE_PRESS, timestamp);
+    }
+    else
+      b.clicks = 0;
+  }
+  else{
+    b.releasedAt = timestamp;
+
+    if (b.holdReported){
+      b.clicks = 0;
+    }
+    else if (timestamp - b.pressedAt >= BUTTON_LONG_PRESS_TIME){
+      b.clicks = 0;
+      ReportGesture(channel, GESTURE_LONG_PRESS, timestamp);
+    }
+    else if (b.clicks == 2){
+      //  Second half of a double press
+      b.clicks = 0;
+    }
+    else
+      b.clicks = 1;
+  }
+}
+
+void ButtonsBegin(gestureHandler_t handler){
+  gestureHandler = handler;
+
+  for (uint8_t i = 0; i < INPUT_COUNT; i++) {
+    buttons[i].mask = inputMasks[i];
+    buttons[i].raw = (inputState & inputMasks[i]) == 0;
+    buttons[i].pressed = buttons[i].raw;
+    buttons[i].changedAt = millis() - BUTTON_DEBOUNCE_TIME;
+    buttons[i].pressedAt = buttons[i].changedAt;
+    buttons[i].releasedAt = buttons[i].changedAt;
+    buttons[i].clicks = 0;
+
+    //  Don't report a button that is already down at boot as a hold
+    buttons[i].holdReported = buttons[i].pressed;
+  }
+}
+
+//  Feeds one edge from the input queue into the channels it touched
+void ButtonsProcessEdge(const inputEdge_t &edge){
+  for (uint8_t i = 0; i < INPUT_COUNT; i++) {
+    if ((edge.changed & buttons[i].mask) == 0) continue;
+
+    buttons[i].raw = (edge.pattern & buttons[i].mask) == 0;
+    EvaluateButton(i, edge.timestamp);
+  }
+}
+
+//  Time based part of the state machines, call it on every input task run
+void ButtonsUpdate(unsigned long timestamp){
+  for (uint8_t i = 0; i < INPUT_COUNT; i++) {
+    button_t &b = buttons[i];
+
+    EvaluateButton(i, timestamp);
+
+    if (b.pressed && !b.holdReported && timestamp - b.pressedAt >= BUTTON_HOLD_TIME){
+      b.holdReported = true;
+      ReportGesture(i, GESTURE_HOLD, timestamp);
+    }
+
+    if (!b.pressed && b.clicks == 1 && timestamp - b.releasedAt > BUTTON_DOUBLE_PRESS_WINDOW){
+      b.clicks = 0;
+      ReportGesture(i, GESTURE_SHORT_PRESS, b.releasedAt);
+    }
+  }
+}
+
+#endif
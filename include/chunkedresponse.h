@@ -0,0 +1,73 @@
+/*
+    chunkedresponse.h - Chunked HTTP response writer
+
+    Collects output in a fixed size buffer and sends it to the client as a
+    chunk whenever the buffer is full, so the memory needed to serve a page
+    does not depend on the size of the page.
+*/
+
+#ifndef CHUNKEDRESPONSE_H
+#define CHUNKEDRESPONSE_H
+
+#include <Arduino.h>
+#include <ESP8266WebServer.h>
+
+class ChunkedResponse : public Print {
+  public:
+    ChunkedResponse(ESP8266WebServer &server) : server(server), length(0), bytesSent(0) {}
+
+    //  Sends the headers, the body follows in chunks
+    void begin(int code, const char *contentType){
+      server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+      server.send(code, contentType, "");
+    }
+
+    size_t write(uint8_t c) override {
+      if (length == HTTP_CHUNK_SIZE) flush();
+      buffer[length++] = c;
+      return 1;
+    }
+
+    size_t write(const uint8_t *data, size_t size) override {
+      size_t remaining = size;
+
+      while (remaining > 0){
+        if (length == HTTP_CHUNK_SIZE) flush();
+
+        size_t n = HTTP_CHUNK_SIZE - length;
+        if (n > remaining) n = remaining;
+
+        memcpy(buffer + length, data, n);
+        length += n;
+        data += n;
+        remaining -= n;
+      }
+      return size;
+    }
+
+    void flush() override {
+      if (length == 0) return;
+
+      server.sendContent(buffer, length);
+      bytesSent += length;
+      length = 0;
+    }
+
+    //  Sends what is left and the terminating empty chunk
+    void end(){
+      flush();
+      server.sendContent("");
+    }
+
+    size_t sent(){
+      return bytesSent;
+    }
+
+  private:
+    ESP8266WebServer &server;
+    char buffer[HTTP_CHUNK_SIZE];
+    size_t length;
+    size_t bytesSent;
+};
+
+#endif
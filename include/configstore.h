@@ -0,0 +1,197 @@
+/*
+    configstore.h - Binary settings record
+
+    The settings are stored as the raw config struct behind a small header
+    with a magic, the schema version, the record size and a CRC-32 of the
+    record. Loading is a read, a CRC and a copy, no parsing.
+
+    A record is written to a temporary file first and renamed over the old
+    one, LittleFS renames atomically, so a reset in the middle of a write
+    leaves the previous settings intact.
+
+    Changes are not written at once: ConfigChanged() marks the settings
+    dirty and ConfigSaveDue() reports when they should be persisted, once
+    no change came for CONFIG_SAVE_QUIET_TIME or at the latest
+    CONFIG_SAVE_MAX_DELAY after the first unsaved change. A burst of
+    requests ends up as a single flash write. ConfigFlush() has to be
+    called before a reset.
+
+    Whenever the config struct changes, CONFIG_VERSION has to be raised
+    and a loader for the previous layout added to configLoaders[], which
+    then maps the old record onto the new struct. JSON (settings.h) is
+    only used to import and export the settings.
+*/
+
+#ifndef CONFIGSTORE_H
+#define CONFIGSTORE_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "settings.h"
+
+#define CONFIG_FILE             "/config.bin"
+#define CONFIG_TEMP_FILE        "/config.tmp"
+#define CONFIG_MAGIC            0x47464E43      //  "CNFG"
+#define CONFIG_VERSION          1
+#define CONFIG_MAX_RECORD_SIZE  512
+
+#define CONFIG_SAVE_QUIET_TIME  2000            //  ms
+#define CONFIG_SAVE_MAX_DELAY   10000           //  ms
+
+//  Turns a record of an older (or the current) schema into the current struct
+typedef bool (*configLoader_t)(const uint8_t *record, size_t size, config &data);
+
+struct configHeader_t{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;
+  uint32_t crc;
+};
+
+struct configStats_t{
+  unsigned long reads;
+  unsigned long writes;         //  Records written to flash
+  unsigned long migrations;
+  unsigned long changes;        //  ConfigChanged() calls
+  unsigned long failures;
+};
+
+configStats_t configStats;
+
+bool configDirty = false;
+unsigned long configDirtySince = 0;     //  First unsaved change
+unsigned long configChangedAt = 0;      //  Last change
+
+uint32_t Crc32(const uint8_t *data, size_t length){
+  uint32_t crc = 0xFFFFFFFF;
+
+  while (length--){
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; i++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+
+  return ~crc;
+}
+
+//  The record is trusted only as far as the CRC goes, terminate the strings
+void TerminateConfigStrings(config &data){
+  data.ssid[sizeof(data.ssid) - 1] = 0;
+  data.password[sizeof(data.password) - 1] = 0;
+  data.friendlyName[sizeof(data.friendlyName) - 1] = 0;
+  data.mqttServer[sizeof(data.mqttServer) - 1] = 0;
+  data.mqttTopic[sizeof(data.mqttTopic) - 1] = 0;
+}
+
+bool LoadConfigV1(const uint8_t *record, size_t size, config &data){
+  if (size != sizeof(config)) return false;
+
+  memcpy(&data, record, size);
+  return true;
+}
+
+//  Index is the schema version - 1
+const configLoader_t configLoaders[CONFIG_VERSION] = {
+  LoadConfigV1
+};
+
+//  Returns SETTINGS_OK, SETTINGS_MIGRATED if the record has to be written
+//  again in the current schema, or the reason it could not be used
+uint8_t ReadConfig(const char *path, config &data){
+  configHeader_t header;
+  uint8_t record[CONFIG_MAX_RECORD_SIZE];
+
+  File f = LittleFS.open(path, "r");
+  if (!f) return SETTINGS_OPEN_FAILED;
+
+  if (f.read((uint8_t*)&header, sizeof(header)) != sizeof(header) || header.magic != CONFIG_MAGIC){
+    f.close();
+    return SETTINGS_PARSE_FAILED;
+  }
+
+  if (header.version == 0 || header.version > CONFIG_VERSION){
+    f.close();
+    return SETTINGS_VERSION_UNKNOWN;
+  }
+
+  if (header.size > sizeof(record)){
+    f.close();
+    return SETTINGS_TOO_LARGE;
+  }
+
+  size_t size = f.read(record, header.size);
+  f.close();
+
+  if (size != header.size || Crc32(record, size) != header.crc) return SETTINGS_CRC_FAILED;
+
+  if (!configLoaders[header.version - 1](record, size, data)) return SETTINGS_PARSE_FAILED;
+
+  TerminateConfigStrings(data);
+  configStats.reads++;
+
+  if (header.version < CONFIG_VERSION){
+    configStats.migrations++;
+    return SETTINGS_MIGRATED;
+  }
+
+  return SETTINGS_OK;
+}
+
+uint8_t WriteConfig(const char *path, const char *tempPath, const config &data){
+  configHeader_t header = {CONFIG_MAGIC, CONFIG_VERSION, sizeof(config), Crc32((const uint8_t*)&data, sizeof(config))};
+
+  File f = LittleFS.open(tempPath, "w");
+  if (!f) return SETTINGS_WRITE_FAILED;
+
+  bool ok = f.write((const uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+            f.write((const uint8_t*)&data, sizeof(config)) == sizeof(config);
+  f.close();
+
+  if (!ok || !LittleFS.rename(tempPath, path)){
+    LittleFS.remove(tempPath);
+    return SETTINGS_WRITE_FAILED;
+  }
+
+  configStats.writes++;
+  return SETTINGS_OK;
+}
+
+void ConfigChanged(){
+  configStats.changes++;
+  configChangedAt = millis();
+
+  if (!configDirty){
+    configDirty = true;
+    configDirtySince = configChangedAt;
+  }
+}
+
+bool ConfigSaveDue(){
+  if (!configDirty) return false;
+
+  return millis() - configChangedAt >= CONFIG_SAVE_QUIET_TIME ||
+         millis() - configDirtySince >= CONFIG_SAVE_MAX_DELAY;
+}
+
+//  Writes the settings and clears the dirty flag. A failed write is retried
+//  after another quiet period, not on every call.
+uint8_t SaveConfig(const config &data){
+  uint8_t error = WriteConfig(CONFIG_FILE, CONFIG_TEMP_FILE, data);
+
+  if (error == SETTINGS_OK)
+    configDirty = false;
+  else{
+    configStats.failures++;
+    configChangedAt = configDirtySince = millis();
+  }
+
+  return error;
+}
+
+//  Writes the settings only if they have unsaved changes
+uint8_t ConfigFlush(const config &data){
+  return configDirty ? SaveConfig(data) : SETTINGS_OK;
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #define MQTT_CUSTOMER "viktak"
 #define MQTT_PROJECT  "spiti"
+#define MQTT_NODE_TOPIC_LENGTH 32         //  With the terminator, see mqtttopics.h
 
 #define HARDWARE_ID "NeoPixel & I2C"
 #define HARDWARE_VERSION "1.0"
@@ -10,16 +11,36 @@
 
 #define DEBUG_SPEED 921600
 
-#define JSON_SETTINGS_SIZE (JSON_OBJECT_SIZE(11) + 270)
+#define JSON_SETTINGS_SIZE (JSON_OBJECT_SIZE(13) + 2 * JSON_ARRAY_SIZE(RELAY_COUNT) + 270)
 #define JSON_MQTT_COMMAND_SIZE 300
 
 #define CONTROL_COMMAND_JSON_SIZE 200
 
+#define MQTT_PAYLOAD_LENGTH 512
+#define HEARTBEAT_PAYLOAD_LENGTH 1024
+#define EVENT_LOG_PAYLOAD_LENGTH 1024
+#define EVENT_MESSAGE_LENGTH 256
+
+//  Event log batches (ms)
+#define EVENT_LOG_BATCH_SIZE 8
+#define EVENT_LOG_BATCH_DELAY 1000
+
+//  Event journal on LittleFS (ms)
+#define JOURNAL_BATCH_SIZE 16
+#define JOURNAL_FLUSH_INTERVAL 60000
+#define JOURNAL_API_DEFAULT_LIMIT 200
+
+//  PubSubClient's default 256 byte buffer is too small for the payloads above
+#define MQTT_BUFFER_SIZE 1280
+
+#define HTTP_CHUNK_SIZE 512
+
 #define CONNECTION_STATUS_LED_GPIO 0
 
 #define SDA_GPIO 13
 #define SCL_GPIO 14
 
+#define RELAY_COUNT 8
 #define ENTRANCELIGHT_RELAY 0
 #define STAIRCASELIGHT_RELAY 1
 
@@ -31,6 +52,46 @@
 #define INPUT_MASK_1  0b01000000
 #define INPUT_MASK_2  0b00100000
 #define INPUT_MASK_3  0b00010000
+#define INPUT_MASK_ALL (INPUT_MASK_0 | INPUT_MASK_1 | INPUT_MASK_2 | INPUT_MASK_3)
+
+#define INPUT_COUNT 4
+
+//  Button timings (ms)
+#define BUTTON_DEBOUNCE_TIME 30
+#define BUTTON_DOUBLE_PRESS_WINDOW 400
+#define BUTTON_LONG_PRESS_TIME 1000
+#define BUTTON_HOLD_TIME 3000
+
+//  PCF8574 interrupt
+#define PCF8574_INT_GPIO 12
+#define INPUT_RESYNC_INTERVAL 1000
+
+//  Scheduler task intervals (ms)
+#define INPUT_TASK_INTERVAL 10
+#define HTTP_TASK_INTERVAL 5
+#define MQTT_TASK_INTERVAL 20
+#define NETWORK_TASK_INTERVAL 500
+#define NTP_TASK_INTERVAL 50
+#define ZONE_TASK_INTERVAL 50
+#define SUN_DATA_TASK_INTERVAL (60 * 60 * 1000)
+#define HEARTBEAT_MIN_INTERVAL 10         //  s, the setting
+#define HEARTBEAT_MAX_INTERVAL 86400      //  s
+#define ENTRANCE_LIGHT_TASK_INTERVAL 1000
+#define EVENTS_TASK_INTERVAL 100
+#define BENCHMARK_TASK_INTERVAL 500
+#define JOURNAL_TASK_INTERVAL 1000
+#define CONFIG_TASK_INTERVAL 250
+#define BOOT_TASK_INTERVAL 100
+
+//  Scheduler task budgets (us)
+#define INPUT_TASK_BUDGET 10000
+#define DEFAULT_TASK_BUDGET 50000
+
+#define MQTT_RECONNECT_INTERVAL 5000
+#define MQTT_CONNECT_TIMEOUT 1000         //  ms, see mqttconnection.h
+#define MQTT_CONNECT_SERVICE_INTERVAL INPUT_TASK_INTERVAL
+#define MQTT_SOCKET_TIMEOUT 1             //  s
+#define MQTT_IO_TIMEOUT 1000              //  ms
 
 //  Default values
 #define DEFAULT_STAIRCASE_LIGHT_DELAY 60
@@ -1,4 +1,107 @@
 #ifndef ENUMS_H
 #define ENUMS_H
 
-#endif
\ No newline at end of file
+enum GESTURE {
+  GESTURE_PRESS,          //  Debounced press edge, reported without waiting
+  GESTURE_SHORT_PRESS,    //  Released quickly, no second press followed
+  GESTURE_DOUBLE_PRESS,   //  Second press within BUTTON_DOUBLE_PRESS_WINDOW
+  GESTURE_LONG_PRESS,     //  Released after BUTTON_LONG_PRESS_TIME
+  GESTURE_HOLD,           //  Still pressed after BUTTON_HOLD_TIME
+  GESTURE_COUNT
+};
+
+enum INPUT_ACTION {
+  ACTION_NONE,
+  ACTION_STAIRCASE_START,     //  Switch on and restart the timer
+  ACTION_STAIRCASE_EXTEND,    //  Add another delay to the running timer
+  ACTION_STAIRCASE_FORCE_ON,  //  Switch on without a timer
+  ACTION_STAIRCASE_OFF,
+  ACTION_ENTRANCE_TOGGLE
+};
+
+enum LIGHT_EVENT {
+  LIGHT_ZONE_OFF,             //  A relay was switched off, by its timer or a command
+  LIGHT_STAIRCASE_STARTED,
+  LIGHT_STAIRCASE_EXTENDED,
+  LIGHT_STAIRCASE_FORCED_ON,
+  LIGHT_ENTRANCE_TOGGLED,
+  LIGHT_ENTRANCE_SCHEDULED    //  Switched by the sunrise / sunset schedule
+};
+
+enum RETRIGGER_POLICY {
+  RETRIGGER_RESTART,      //  Start the full duration again
+  RETRIGGER_EXTEND,       //  Add the duration to the remaining time
+  RETRIGGER_IGNORE        //  Keep the running timer
+};
+
+enum MQTT_TOPIC {
+  TOPIC_STATE,
+  TOPIC_CMND,
+  TOPIC_LOG,
+  TOPIC_HEARTBEAT,
+  TOPIC_TASKS,
+  TOPIC_METRICS,
+  TOPIC_SETTINGS,
+  TOPIC_RESULT_POWER0,
+  TOPIC_RESULT_DURATION0 = TOPIC_RESULT_POWER0 + RELAY_COUNT,
+  TOPIC_COUNT = TOPIC_RESULT_DURATION0 + RELAY_COUNT
+};
+
+enum PAGE {
+  PAGE_LOGIN,
+  PAGE_INDEX,
+  PAGE_STATUS,
+  PAGE_STAIRCASELIGHTTIMER,
+  PAGE_ENTRANCELIGHT,
+  PAGE_GENERALSETTINGS,
+  PAGE_NETWORKSETTINGS,
+  PAGE_TOOLS,
+  PAGE_COUNT
+};
+
+enum TEMPLATE_FIELD {
+  FIELD_PAGEHEADER,
+  FIELD_YEAR,
+  FIELD_ALERT,
+
+  FIELD_ESPID,
+  FIELD_CHIPID,
+  FIELD_HARDWAREID,
+  FIELD_HARDWAREVERSION,
+  FIELD_SOFTWAREID,
+  FIELD_FIRMWAREID,
+  FIELD_FIRMWAREVERSION,
+  FIELD_BUILDNUMBER,
+
+  FIELD_UPTIME,
+  FIELD_CURRENTTIME,
+  FIELD_LASTRESETREASON,
+  FIELD_FLASHCHIPSIZE,
+  FIELD_FLASHCHIPSPEED,
+  FIELD_FREEHEAPSIZE,
+  FIELD_FREESKETCHSPACE,
+
+  FIELD_FRIENDLYNAME,
+  FIELD_HEARTBEATINTERVAL,
+
+  FIELD_MQTT_SERVERNAME,
+  FIELD_MQTT_PORT,
+  FIELD_MQTT_TOPIC,
+
+  FIELD_WIFIMODE,
+  FIELD_MACADDRESS,
+  FIELD_NETWORKADDRESS,
+  FIELD_SSID,
+  FIELD_SUBNETMASK,
+  FIELD_GATEWAY,
+  FIELD_WIFILIST,
+
+  FIELD_DELAYLIST,
+  FIELD_SUNSETOFFSETLIST,
+  FIELD_SUNRISEOFFSETLIST,
+  FIELD_TIMEZONESLIST,
+
+  FIELD_COUNT
+};
+
+#endif
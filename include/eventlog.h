@@ -0,0 +1,98 @@
+/*
+    eventlog.h - Fixed capacity ring buffer of log events
+
+    LogEvent() only copies its arguments into the next slot of a
+    preallocated array, formatting and delivery happen later in the
+    background tasks. Every record gets a sequence number and each consumer
+    (MQTT, the serial console and SSE clients) keeps its own cursor, so a
+    consumer that can't deliver (e.g. the broker is away) just stays behind
+    while the others carry on.
+
+    When the buffer is full the oldest record is overwritten. A consumer
+    whose cursor points to an overwritten record has lost it, see
+    EventLogCatchUp(). The same record can be lost by several consumers,
+    so each counts its own losses.
+*/
+
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <TimeLib.h>
+
+#define EVENT_LOG_CAPACITY      32      //  Must be a power of 2
+#define EVENT_TITLE_LENGTH      24
+#define EVENT_DATA_LENGTH       48
+
+struct eventRecord_t{
+  uint32_t sequence;
+  uint32_t time;                //  now()
+  uint32_t uptime;              //  millis()
+  uint8_t category;
+  uint8_t id;
+  char title[EVENT_TITLE_LENGTH];
+  char data[EVENT_DATA_LENGTH];
+};
+
+struct eventLogStats_t{
+  unsigned long logged;
+  unsigned long truncated;      //  Title or data didn't fit
+};
+
+eventRecord_t eventLog[EVENT_LOG_CAPACITY];
+uint32_t eventLogHead = 0;      //  Sequence number of the next record
+eventLogStats_t eventLogStats;
+
+void EventLogPush(uint8_t category, uint8_t id, const char *title, const char *data){
+  eventRecord_t &r = eventLog[eventLogHead & (EVENT_LOG_CAPACITY - 1)];
+
+  r.sequence = eventLogHead++;
+  r.time = now();
+  r.uptime = millis();
+  r.category = category;
+  r.id = id;
+
+  if (strlcpy(r.title, title, sizeof(r.title)) >= sizeof(r.title)) eventLogStats.truncated++;
+  if (strlcpy(r.data, data, sizeof(r.data)) >= sizeof(r.data)) eventLogStats.truncated++;
+
+  eventLogStats.logged++;
+}
+
+//  Records written after the cursor
+uint32_t EventLogPending(uint32_t cursor){
+  return eventLogHead - cursor;
+}
+
+//  Moves a cursor that fell behind to the oldest record still in the buffer
+//  and adds the records it missed to the consumer's lost count
+uint32_t EventLogCatchUp(uint32_t &cursor, unsigned long &lost){
+  uint32_t pending = EventLogPending(cursor);
+  if (pending <= EVENT_LOG_CAPACITY) return 0;
+
+  uint32_t missed = pending - EVENT_LOG_CAPACITY;
+  cursor += missed;
+  lost += missed;
+  return missed;
+}
+
+//  The record with the given sequence number, NULL if it isn't in the buffer
+const eventRecord_t *EventLogGet(uint32_t sequence){
+  uint32_t age = eventLogHead - sequence;
+  if (age == 0 || age > EVENT_LOG_CAPACITY) return NULL;
+
+  return &eventLog[sequence & (EVENT_LOG_CAPACITY - 1)];
+}
+
+//  The strings are not copied, the record must outlive the document
+void EventRecordToJson(const eventRecord_t &record, JsonObject out){
+  out["Seq"] = record.sequence;
+  out["Time"] = record.time;
+  out["Uptime"] = record.uptime;
+  out["Category"] = record.category;
+  out["ID"] = record.id;
+  out["Title"] = (const char*)record.title;
+  out["Data"] = (const char*)record.data;
+}
+
+#endif
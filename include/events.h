@@ -0,0 +1,102 @@
+/*
+    events.h - Server-Sent Events stream
+
+    A browser subscribing to /events keeps its connection open and gets
+    every event as a "event: <name>\ndata: <json>\n\n" record. The web
+    server itself stays synchronous, the subscribed connections are kept
+    here and written to directly.
+
+    A record is only written if it fits into the client's send buffer, so
+    a slow client loses events instead of stalling the loop.
+*/
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#define EVENT_MAX_CLIENTS       2
+#define EVENT_KEEPALIVE_TIME    15000   //  ms between comments on an idle stream
+
+struct eventStats_t{
+  unsigned long subscriptions;
+  unsigned long sent;           //  Records written
+  unsigned long dropped;        //  Records not written because the client was busy
+};
+
+WiFiClient eventClients[EVENT_MAX_CLIENTS];
+unsigned long lastEventSent = 0;
+eventStats_t eventStats;
+
+bool EventsHaveClients(){
+  for (uint8_t i = 0; i < EVENT_MAX_CLIENTS; i++) {
+    if (eventClients[i].connected()) return true;
+  }
+  return false;
+}
+
+//  Takes over the connection of the current request. If all slots are in
+//  use the oldest subscriber is dropped.
+void EventsSubscribe(WiFiClient client){
+  uint8_t slot = 0;
+
+  for (uint8_t i = 0; i < EVENT_MAX_CLIENTS; i++) {
+    if (!eventClients[i].connected()){
+      slot = i;
+      break;
+    }
+  }
+
+  if (eventClients[slot].connected()) eventClients[slot].stop();
+
+  client.setNoDelay(true);
+  client.print("HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/event-stream\r\n"
+                "Cache-Control: no-cache\r\n"
+                "Connection: keep-alive\r\n"
+                "Access-Control-Allow-Origin: *\r\n\r\n"
+                "retry: 5000\n\n");
+
+  eventClients[slot] = client;
+  eventStats.subscriptions++;
+}
+
+void EventsSend(const char *event, const char *data){
+  size_t length = strlen(event) + strlen(data) + 16;
+
+  for (uint8_t i = 0; i < EVENT_MAX_CLIENTS; i++) {
+    WiFiClient &client = eventClients[i];
+    if (!client.connected()) continue;
+
+    if (client.availableForWrite() < length){
+      eventStats.dropped++;
+      continue;
+    }
+
+    client.print("event: ");
+    client.print(event);
+    client.print("\ndata: ");
+    client.print(data);
+    client.print("\n\n");
+    eventStats.sent++;
+  }
+
+  lastEventSent = millis();
+}
+
+//  Keeps idle streams open through proxies and frees closed connections
+void EventsKeepAlive(){
+  for (uint8_t i = 0; i < EVENT_MAX_CLIENTS; i++) {
+    if (!eventClients[i].connected()) eventClients[i].stop();
+  }
+
+  if (millis() - lastEventSent < EVENT_KEEPALIVE_TIME) return;
+
+  for (uint8_t i = 0; i < EVENT_MAX_CLIENTS; i++) {
+    if (eventClients[i].connected() && eventClients[i].availableForWrite() > 2) eventClients[i].print(":\n\n");
+  }
+  lastEventSent = millis();
+}
+
+#endif
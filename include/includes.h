@@ -3,13 +3,68 @@
 
 #include "version.h"
 
+#ifndef NATIVE
 #include "../../../ActoSenso/Nodes/_common/debug.h"
+#endif
 
+//  The shared headers live outside this repository, the native build has
+//  its own stand-ins in native/common.h
+#ifdef NATIVE
+#include "defines.h"
+#include "enums.h"
+#include <common.h>
+#else
 #include "defines.h"
 #include "../../_common/defines.h"
 
 #include "enums.h"
 #include "../../_common/enums.h"
+#endif
+
+#ifdef NATIVE
+//  Host build on top of the fakes in native/, only the hardware independent modules
+#include <Arduino.h>
+#include <heap.h>
+#include <Wire.h>
+#include <pcf8574_esp.h>
+#include <LittleFS.h>
+#include <PubSubClient.h>
+#include <ESP8266WebServer.h>
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#include <ArduinoJson.h>
+#include <TimeLib.h>
+
+#include "resolver.h"
+#include "NTP.h"
+#include "scheduler.h"
+#include "inputs.h"
+#include "buttons.h"
+#include "relays.h"
+#include "zones.h"
+#include "mqtttopics.h"
+#include "templates.h"
+#include "pages.h"
+#include "chunkedresponse.h"
+#include "boot.h"
+#include "eventlog.h"
+#include "journal.h"
+
+#include "structs.h"
+#include "sun.h"
+#include "sunfixed.h"
+#include "timeformat.h"
+#include "suntable.h"
+#include "settings.h"
+#include "configstore.h"
+#include "reconfig.h"
+#include "metrics.h"
+#include "mqttconnection.h"
+#include "staircase.h"
+#include "node.h"
+#include "benchmark.h"
+
+#else
 
 #include "../../_common/variables.cpp"
 
@@ -34,11 +89,41 @@
 #include <TimeLib.h>
 #include <Time.h>
 #include <Timezone.h>
+#include "resolver.h"
 #include "NTP.h"
+#include "scheduler.h"
+#include "inputs.h"
+#include "buttons.h"
+#include "relays.h"
+#include "zones.h"
+#include "mqtttopics.h"
+#include "templates.h"
+#include "pages.h"
+#include "chunkedresponse.h"
+#include "staticfiles.h"
+#include "events.h"
+#include "boot.h"
+#include "eventlog.h"
+#include "journal.h"
 
 #include "structs.h"
 #include <TimeChangeRules.h>
 
+#include "sun.h"
+#include "sunfixed.h"
+#include "timeformat.h"
+#include "suntable.h"
+#include "settings.h"
+#include "configstore.h"
+#include "reconfig.h"
+#include "metrics.h"
+#include "mqttconnection.h"
+#include "staircase.h"
+#include "node.h"
+#include "benchmark.h"
+
 #include "user_interface.h"
 
+#endif
+
 #endif
\ No newline at end of file
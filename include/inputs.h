@@ -0,0 +1,116 @@
+/*
+    inputs.h - Interrupt driven PCF8574 input handling
+
+    The PCF8574 pulls its INT line low whenever one of its quasi-bidirectional
+    pins changes. The ISR only raises a flag; the expander is read from the
+    input task when that flag is set, and every change is queued as an edge
+    record with the time the interrupt fired.
+
+    Without _use_input_interrupt the expander is read on every call, which
+    is how the inputs were handled before.
+*/
+
+#ifndef INPUTS_H
+#define INPUTS_H
+
+#include <Arduino.h>
+#include <pcf8574_esp.h>
+
+#define INPUT_EDGE_QUEUE_SIZE 16    //  Must be a power of 2
+
+struct inputEdge_t{
+  uint8_t pattern;          //  Input pins after the change, masked with INPUT_MASK_ALL
+  uint8_t changed;          //  Pins that changed
+  unsigned long timestamp;  //  millis() when the change was signalled
+};
+
+struct inputStats_t{
+  unsigned long interrupts;
+  unsigned long reads;
+  unsigned long edges;
+  unsigned long overflows;
+};
+
+volatile bool inputInterruptPending = false;
+volatile unsigned long inputInterruptTime = 0;
+
+inputEdge_t inputEdges[INPUT_EDGE_QUEUE_SIZE];
+uint8_t inputEdgeHead = 0;
+uint8_t inputEdgeTail = 0;
+
+uint8_t inputState = INPUT_MASK_ALL;    //  All inputs are active low
+unsigned long lastInputRead = 0;
+inputStats_t inputStats;
+
+void IRAM_ATTR InputInterruptHandler(){
+  inputInterruptPending = true;
+  inputInterruptTime = millis();
+  inputStats.interrupts++;
+}
+
+void PushInputEdge(uint8_t pattern, uint8_t changed, unsigned long timestamp){
+  uint8_t next = (inputEdgeHead + 1) & (INPUT_EDGE_QUEUE_SIZE - 1);
+
+  if (next == inputEdgeTail){
+    //  Drop the oldest edge, the newest state is the one that matters
+    inputEdgeTail = (inputEdgeTail + 1) & (INPUT_EDGE_QUEUE_SIZE - 1);
+    inputStats.overflows++;
+  }
+
+  inputEdges[inputEdgeHead].pattern = pattern;
+  inputEdges[inputEdgeHead].changed = changed;
+  inputEdges[inputEdgeHead].timestamp = timestamp;
+  inputEdgeHead = next;
+  inputStats.edges++;
+}
+
+bool PopInputEdge(inputEdge_t &edge){
+  if (inputEdgeHead == inputEdgeTail) return false;
+
+  edge = inputEdges[inputEdgeTail];
+  inputEdgeTail = (inputEdgeTail + 1) & (INPUT_EDGE_QUEUE_SIZE - 1);
+  return true;
+}
+
+void InputsBegin(PCF857x &expander){
+  inputState = expander.read8() & INPUT_MASK_ALL;
+  lastInputRead = millis();
+  inputStats.reads++;
+
+  #ifdef _use_input_interrupt
+  pinMode(PCF8574_INT_GPIO, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(PCF8574_INT_GPIO), InputInterruptHandler, FALLING);
+  #endif
+}
+
+//  Reads the expander if it signalled a change (or the resync interval has
+//  passed) and queues the resulting edges
+void InputsPoll(PCF857x &expander){
+  unsigned long timestamp = millis();
+
+  #ifdef _use_input_interrupt
+  //  INT stays low until the port is read, so a low line also means a pending change
+  bool pending = inputInterruptPending || digitalRead(PCF8574_INT_GPIO) == LOW;
+
+  if (!pending && millis() - lastInputRead < INPUT_RESYNC_INTERVAL) return;
+
+  if (inputInterruptPending){
+    noInterrupts();
+    timestamp = inputInterruptTime;
+    inputInterruptPending = false;
+    interrupts();
+  }
+  #endif
+
+  uint8_t pattern = expander.read8() & INPUT_MASK_ALL;
+  lastInputRead = millis();
+  inputStats.reads++;
+
+  uint8_t changed = pattern ^ inputState;
+  if (changed){
+    PushInputEdge(pattern, changed, timestamp);
+    inputState = pattern;
+  }
+}
+
+#endif
@@ -0,0 +1,249 @@
+/*
+    journal.h - Event log journal on LittleFS
+
+    The records of the event log ring are appended to a set of fixed size
+    segment files (/journal0.log ... /journal<n>.log) in batches, so the
+    flash is written once per JOURNAL_BATCH_SIZE events or
+    JOURNAL_FLUSH_INTERVAL instead of on every event. When the current
+    segment is full the writer moves on to the next slot and truncates it,
+    so the journal never grows beyond JOURNAL_SEGMENT_COUNT segments.
+
+    Every segment starts with a header holding a generation number, the
+    segments are read back in generation order. Segments written by a
+    firmware with a different record layout are skipped and reused.
+*/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "eventlog.h"
+
+#define JOURNAL_SEGMENT_COUNT   16
+#define JOURNAL_SEGMENT_SIZE    16384   //  ~185 records per segment
+#define JOURNAL_PATH_LENGTH     20
+#define JOURNAL_MAGIC           0x4C4E524A      //  "JRNL"
+#define JOURNAL_NO_SEGMENT      0xFF
+
+typedef void (*journalRecordWriter_t)(Print &out, const eventRecord_t &record, uint32_t index);
+
+struct journalHeader_t{
+  uint32_t magic;
+  uint16_t recordSize;
+  uint16_t reserved;
+  uint32_t generation;
+};
+
+struct journalStats_t{
+  unsigned long flushes;
+  unsigned long records;        //  Records written
+  unsigned long rotations;
+  unsigned long errors;
+  unsigned long lost;           //  Overwritten in the event log before a flush
+};
+
+uint8_t journalSegment = JOURNAL_NO_SEGMENT;    //  Slot being written
+uint32_t journalGeneration = 0;
+size_t journalSize = 0;                         //  Bytes in the current segment
+uint32_t journalCursor = 0;                     //  Event log cursor
+unsigned long lastJournalFlush = 0;
+journalStats_t journalStats;
+
+void JournalSegmentPath(uint8_t slot, char *path){
+  snprintf(path, JOURNAL_PATH_LENGTH, "/journal%u.log", slot);
+}
+
+//  Returns the size of the segment, 0 if it is missing or not ours
+size_t JournalReadHeader(uint8_t slot, journalHeader_t &header){
+  char path[JOURNAL_PATH_LENGTH];
+  JournalSegmentPath(slot, path);
+
+  File f = LittleFS.open(path, "r");
+  if (!f) return 0;
+
+  size_t size = f.size();
+  bool valid = f.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+               header.magic == JOURNAL_MAGIC && header.recordSize == sizeof(eventRecord_t);
+  f.close();
+
+  return valid ? size : 0;
+}
+
+//  Picks up the newest segment. Records logged before this call are journaled too.
+void JournalBegin(){
+  journalHeader_t header;
+
+  journalSegment = JOURNAL_NO_SEGMENT;
+  journalGeneration = 0;
+  journalCursor = eventLogHead > EVENT_LOG_CAPACITY ? eventLogHead - EVENT_LOG_CAPACITY : 0;
+  lastJournalFlush = millis();
+
+  for (uint8_t i = 0; i < JOURNAL_SEGMENT_COUNT; i++) {
+    size_t size = JournalReadHeader(i, header);
+
+    if (size > 0 && header.generation > journalGeneration){
+      journalSegment = i;
+      journalGeneration = header.generation;
+      journalSize = size;
+    }
+  }
+
+  //  A record cut short by a reset would misalign everything after it
+  if (journalSegment != JOURNAL_NO_SEGMENT && (journalSize - sizeof(journalHeader_t)) % sizeof(eventRecord_t) != 0)
+    journalSize = JOURNAL_SEGMENT_SIZE;
+}
+
+//  Truncates the next slot and writes its header
+bool JournalRotate(){
+  char path[JOURNAL_PATH_LENGTH];
+  journalHeader_t header = {JOURNAL_MAGIC, sizeof(eventRecord_t), 0, journalGeneration + 1};
+  uint8_t slot = journalSegment == JOURNAL_NO_SEGMENT ? 0 : (journalSegment + 1) % JOURNAL_SEGMENT_COUNT;
+
+  JournalSegmentPath(slot, path);
+
+  File f = LittleFS.open(path, "w");
+  if (!f) return false;
+
+  bool ok = f.write((const uint8_t*)&header, sizeof(header)) == sizeof(header);
+  f.close();
+  if (!ok) return false;
+
+  journalSegment = slot;
+  journalGeneration = header.generation;
+  journalSize = sizeof(header);
+  journalStats.rotations++;
+  return true;
+}
+
+//  Appends every queued record, rotating as many times as needed
+bool JournalFlush(){
+  char path[JOURNAL_PATH_LENGTH];
+  const eventRecord_t *record;
+
+  lastJournalFlush = millis();
+  EventLogCatchUp(journalCursor, journalStats.lost);
+
+  while (EventLogPending(journalCursor) > 0){
+    if (journalSegment == JOURNAL_NO_SEGMENT || journalSize + sizeof(eventRecord_t) > JOURNAL_SEGMENT_SIZE){
+      if (!JournalRotate()){
+        journalStats.errors++;
+        return false;
+      }
+    }
+
+    JournalSegmentPath(journalSegment, path);
+
+    File f = LittleFS.open(path, "a");
+    if (!f){
+      journalStats.errors++;
+      return false;
+    }
+
+    while (journalSize + sizeof(eventRecord_t) <= JOURNAL_SEGMENT_SIZE && (record = EventLogGet(journalCursor)) != NULL){
+      if (f.write((const uint8_t*)record, sizeof(eventRecord_t)) != sizeof(eventRecord_t)){
+        f.close();
+        journalStats.errors++;
+        return false;
+      }
+
+      journalSize += sizeof(eventRecord_t);
+      journalCursor++;
+      journalStats.records++;
+    }
+
+    f.close();
+  }
+
+  journalStats.flushes++;
+  return true;
+}
+
+//  Call it periodically, writes once a batch is full or the interval has passed
+void JournalRun(){
+  uint32_t pending = EventLogPending(journalCursor);
+
+  if (pending >= JOURNAL_BATCH_SIZE || (pending > 0 && millis() - lastJournalFlush >= JOURNAL_FLUSH_INTERVAL))
+    JournalFlush();
+}
+
+//  Fills slots[] with the valid segments, oldest first, returns their count.
+//  records gets the number of records in them.
+uint8_t JournalSegments(uint8_t *slots, uint32_t &records){
+  journalHeader_t header;
+  uint32_t generations[JOURNAL_SEGMENT_COUNT];
+  uint8_t count = 0;
+
+  records = 0;
+
+  for (uint8_t i = 0; i < JOURNAL_SEGMENT_COUNT; i++) {
+    size_t size = JournalReadHeader(i, header);
+    if (size == 0) continue;
+
+    records += (size - sizeof(header)) / sizeof(eventRecord_t);
+
+    //  Insertion sort by generation
+    uint8_t j = count++;
+    while (j > 0 && generations[j - 1] > header.generation){
+      generations[j] = generations[j - 1];
+      slots[j] = slots[j - 1];
+      j--;
+    }
+    generations[j] = header.generation;
+    slots[j] = i;
+  }
+
+  return count;
+}
+
+uint32_t JournalCount(){
+  uint8_t slots[JOURNAL_SEGMENT_COUNT];
+  uint32_t records;
+
+  JournalSegments(slots, records);
+  return records;
+}
+
+//  Streams the journal record by record, oldest first, after skipping the
+//  first skip records. Returns the number of records written.
+uint32_t JournalRead(Print &out, journalRecordWriter_t writer, uint32_t skip = 0){
+  char path[JOURNAL_PATH_LENGTH];
+  uint8_t slots[JOURNAL_SEGMENT_COUNT];
+  uint32_t records;
+  uint32_t index = 0;
+  eventRecord_t record;
+
+  uint8_t count = JournalSegments(slots, records);
+
+  for (uint8_t i = 0; i < count; i++) {
+    JournalSegmentPath(slots[i], path);
+
+    File f = LittleFS.open(path, "r");
+    if (!f) continue;
+
+    uint32_t inSegment = (f.size() - sizeof(journalHeader_t)) / sizeof(eventRecord_t);
+
+    if (skip >= inSegment){
+      skip -= inSegment;
+      f.close();
+      continue;
+    }
+
+    f.seek(sizeof(journalHeader_t) + skip * sizeof(eventRecord_t), SeekSet);
+    skip = 0;
+
+    while (f.read((uint8_t*)&record, sizeof(record)) == sizeof(record)) {
+      //  Don't trust the flash with the terminators
+      record.title[sizeof(record.title) - 1] = 0;
+      record.data[sizeof(record.data) - 1] = 0;
+
+      writer(out, record, index++);
+    }
+
+    f.close();
+  }
+
+  return index;
+}
+
+#endif
@@ -0,0 +1,149 @@
+/*
+    metrics.h - Loop and HTTP handler instrumentation
+
+    loop() is bracketed with MetricsLoopBegin() / MetricsLoopEnd(): every
+    pass lands in a duration histogram, and the time between the starts of
+    two passes (the pass itself plus whatever the SDK did in between) is
+    tracked as the stall time. HTTP handlers registered through a timed
+    route report their service time here as well.
+
+    Counters run since boot, the maximums are per report window and are
+    cleared by MetricsResetWindow() after each publish. MetricsToJson()
+    builds the report, together with the counters of the other modules.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define METRICS_LOOP_BUCKETS    8
+#define METRICS_MAX_ROUTES      16
+
+//  The route URIs are referenced, not copied
+#define METRICS_JSON_SIZE (JSON_OBJECT_SIZE(7) + JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(5) + JSON_ARRAY_SIZE(METRICS_LOOP_BUCKETS) + \
+                           JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(4) + JSON_OBJECT_SIZE(3) + \
+                           JSON_OBJECT_SIZE(METRICS_MAX_ROUTES) + METRICS_MAX_ROUTES * JSON_ARRAY_SIZE(3))
+
+//  Upper bounds (us) of the histogram buckets, the last bucket takes the rest
+const unsigned long metricsLoopBounds[METRICS_LOOP_BUCKETS - 1] = {100, 500, 1000, 5000, 10000, 50000, 100000};
+
+struct loopMetrics_t{
+  unsigned long passes;
+  unsigned long histogram[METRICS_LOOP_BUCKETS];
+  uint64_t totalTime;           //  us
+  unsigned long passStart;      //  micros()
+  unsigned long maxPass;        //  us, this window
+  unsigned long maxStall;       //  us between two pass starts, this window
+};
+
+struct routeMetrics_t{
+  const char *uri;
+  unsigned long requests;
+  unsigned long totalTime;      //  us
+  unsigned long maxTime;        //  us, this window
+};
+
+loopMetrics_t loopMetrics;
+routeMetrics_t routeMetrics[METRICS_MAX_ROUTES];
+uint8_t routeCount = 0;
+
+void MetricsLoopBegin(){
+  unsigned long now = micros();
+
+  if (loopMetrics.passes > 0){
+    unsigned long stall = now - loopMetrics.passStart;
+    if (stall > loopMetrics.maxStall) loopMetrics.maxStall = stall;
+  }
+
+  loopMetrics.passStart = now;
+}
+
+void MetricsLoopEnd(){
+  unsigned long duration = micros() - loopMetrics.passStart;
+  uint8_t bucket = 0;
+
+  while (bucket < METRICS_LOOP_BUCKETS - 1 && duration >= metricsLoopBounds[bucket]) bucket++;
+
+  loopMetrics.histogram[bucket]++;
+  loopMetrics.passes++;
+  loopMetrics.totalTime += duration;
+  if (duration > loopMetrics.maxPass) loopMetrics.maxPass = duration;
+}
+
+//  Returns the route's ID, or -1 if the table is full
+int8_t MetricsAddRoute(const char *uri){
+  if (routeCount >= METRICS_MAX_ROUTES) return -1;
+
+  routeMetrics[routeCount].uri = uri;
+  routeMetrics[routeCount].requests = 0;
+  routeMetrics[routeCount].totalTime = 0;
+  routeMetrics[routeCount].maxTime = 0;
+  return routeCount++;
+}
+
+void MetricsRouteServed(int8_t route, unsigned long duration){
+  if (route < 0 || route >= routeCount) return;
+
+  routeMetrics_t &r = routeMetrics[route];
+  r.requests++;
+  r.totalTime += duration;
+  if (duration > r.maxTime) r.maxTime = duration;
+}
+
+void MetricsResetWindow(){
+  loopMetrics.maxPass = 0;
+  loopMetrics.maxStall = 0;
+
+  for (uint8_t i = 0; i < routeCount; i++) {
+    routeMetrics[i].maxTime = 0;
+  }
+}
+
+void MetricsToJson(JsonDocument &doc){
+  doc["Uptime"] = millis() / 1000;
+
+  JsonObject heap = doc.createNestedObject("Heap");
+  heap["Free"] = ESP.getFreeHeap();
+  heap["MaxFreeBlock"] = ESP.getMaxFreeBlockSize();
+  heap["Fragmentation"] = ESP.getHeapFragmentation();
+
+  JsonObject loopDetails = doc.createNestedObject("Loop");
+  loopDetails["Passes"] = loopMetrics.passes;
+  loopDetails["Avg"] = loopMetrics.passes ? (unsigned long)(loopMetrics.totalTime / loopMetrics.passes) : 0;
+  loopDetails["MaxPass"] = loopMetrics.maxPass;
+  loopDetails["MaxStall"] = loopMetrics.maxStall;
+
+  JsonArray histogram = loopDetails.createNestedArray("Histogram");
+  for (uint8_t i = 0; i < METRICS_LOOP_BUCKETS; i++) {
+    histogram.add(loopMetrics.histogram[i]);
+  }
+
+  JsonObject i2c = doc.createNestedObject("I2C");
+  i2c["Reads"] = inputStats.reads;
+  i2c["Writes"] = relayStats.writes;
+  i2c["Rate"] = i2cTransactionsPerSecond;
+
+  JsonObject mqtt = doc.createNestedObject("Mqtt");
+  mqtt["Publishes"] = mqttStats.publishes;
+  mqtt["Failures"] = mqttStats.failures;
+  mqtt["Skipped"] = mqttStats.skipped;
+  mqtt["Overflows"] = mqttStats.overflows;
+
+  JsonObject settings = doc.createNestedObject("Config");
+  settings["Changes"] = configStats.changes;
+  settings["Writes"] = configStats.writes;
+  settings["Failures"] = configStats.failures;
+
+  //  "uri": [requests, average us, max us]
+  JsonObject http = doc.createNestedObject("Http");
+  for (uint8_t i = 0; i < routeCount; i++) {
+    JsonArray route = http.createNestedArray(routeMetrics[i].uri);
+    route.add(routeMetrics[i].requests);
+    route.add(routeMetrics[i].requests ? routeMetrics[i].totalTime / routeMetrics[i].requests : 0);
+    route.add(routeMetrics[i].maxTime);
+  }
+}
+
+#endif
@@ -0,0 +1,96 @@
+/*
+    mqttconnection.h - Connecting to the MQTT broker without holding up the inputs
+
+    PubSubClient::connect() looks the broker up with WiFi.hostByName() and
+    then waits for the TCP connection and the broker's answer. Here the
+    name is looked up by resolver.h first and the client is only given the
+    address. The TCP connect is bounded by the WiFiClient timeout,
+    MQTT_CONNECT_TIMEOUT, and the wait for the answer by MQTT_SOCKET_TIMEOUT.
+
+    Those have to be long enough for a real network, a station in modem
+    sleep answers late. While the broker is down every attempt blocks the
+    loop that long, so the inputs, the relay timers and the relays are run
+    from a recurrent scheduled function of the core meanwhile (see
+    NodeService() in node.h). The core calls it from the yield()s and
+    delay()s the connect waits in.
+*/
+
+#ifndef MQTTCONNECTION_H
+#define MQTTCONNECTION_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <PubSubClient.h>
+#include <Schedule.h>
+
+typedef void (*mqttConnectService_t)();
+
+WiFiClient *mqttNetwork = NULL;
+unsigned long mqttConnectAttemptAt = 0;     //  millis()
+bool mqttResolving = false;
+bool mqttConnecting = false;                //  In client.connect()
+mqttConnectService_t mqttConnectService = NULL;
+
+//  Makes the next MqttConnect() try right away, e.g. with new settings
+void MqttConnectNow(){
+  mqttConnectAttemptAt = millis() - MQTT_RECONNECT_INTERVAL;
+  mqttResolving = false;
+}
+
+//  service runs every MQTT_CONNECT_SERVICE_INTERVAL while a connect blocks
+void MqttConnectionBegin(WiFiClient &network, PubSubClient &client, mqttConnectService_t service){
+  mqttNetwork = &network;
+  mqttNetwork->setTimeout(MQTT_IO_TIMEOUT);
+  client.setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+
+  mqttConnectService = service;
+  schedule_recurrent_function_us([](){
+    if (mqttConnecting && mqttConnectService != NULL) mqttConnectService();
+    return true;
+  }, MQTT_CONNECT_SERVICE_INTERVAL * 1000);
+
+  MqttConnectNow();
+}
+
+//  Call it while the client is not connected, it returns true once it is.
+//  Every call returns within MQTT_CONNECT_TIMEOUT, plus MQTT_SOCKET_TIMEOUT
+//  if the broker accepts the connection but doesn't answer.
+bool MqttConnect(PubSubClient &client, const config &settings){
+  if (!mqttResolving){
+    //  Even a bounded attempt costs some time, so don't retry on every pass
+    if (millis() - mqttConnectAttemptAt < MQTT_RECONNECT_INTERVAL) return false;
+
+    mqttConnectAttemptAt = millis();
+    mqttResolving = true;
+  }
+
+  IPAddress broker;
+
+  switch (ResolverLookup(settings.mqttServer, broker)) {
+    case RESOLVER_PENDING:
+      return false;
+
+    case RESOLVER_FAILED:
+      mqttResolving = false;
+      return false;
+
+    default:
+      mqttResolving = false;
+      break;
+  }
+
+  client.setServer(broker, settings.mqttPort);
+
+  mqttNetwork->setTimeout(MQTT_CONNECT_TIMEOUT);
+  mqttConnecting = true;
+  bool connected = client.connect(settings.mqttTopic, MqttTopic(TOPIC_STATE), 0, true, "offline");
+  mqttConnecting = false;
+  mqttNetwork->setTimeout(MQTT_IO_TIMEOUT);
+
+  //  The broker may have moved, look it up again next time
+  if (!connected) ResolverForget(settings.mqttServer);
+
+  return connected;
+}
+
+#endif
@@ -0,0 +1,111 @@
+/*
+    mqtttopics.h - Prebuilt MQTT topics and an allocation free publish path
+
+    All topics of the node are formatted once into fixed buffers when the
+    configuration is loaded or the node's topic changes, so publishing does
+    not have to build them from String concatenations every time.
+
+    JSON documents are streamed into the client with MqttPublishJson(), so
+    their size is measured rather than bounded by a payload buffer.
+*/
+
+#ifndef MQTTTOPICS_H
+#define MQTTTOPICS_H
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <ArduinoJson.h>
+
+//  MQTT_CUSTOMER/MQTT_PROJECT/<node topic> and the longest suffix after it
+#define MQTT_PREFIX_LENGTH (sizeof(MQTT_CUSTOMER "/" MQTT_PROJECT "/") - 1 + MQTT_NODE_TOPIC_LENGTH - 1)
+#define MQTT_LONGEST_SUFFIX "/RESULT/POWER0/DURATION"
+#define MQTT_TOPIC_LENGTH (MQTT_PREFIX_LENGTH + sizeof(MQTT_LONGEST_SUFFIX))
+
+#if RELAY_COUNT > 10
+#error "MQTT_LONGEST_SUFFIX has room for one digit of the relay number"
+#endif
+
+#define TOPIC_RESULT_POWER(n) ((MQTT_TOPIC)(TOPIC_RESULT_POWER0 + (n)))
+#define TOPIC_RESULT_DURATION(n) ((MQTT_TOPIC)(TOPIC_RESULT_DURATION0 + (n)))
+
+struct mqttStats_t{
+  unsigned long publishes;
+  unsigned long failures;       //  publish() returned false
+  unsigned long skipped;        //  Not connected
+  unsigned long overflows;      //  The document didn't hold all of the report
+};
+
+char mqttTopics[TOPIC_COUNT][MQTT_TOPIC_LENGTH];
+mqttStats_t mqttStats;
+
+//  The node's own part of the topics, it must fit MQTT_NODE_TOPIC_LENGTH and
+//  can't add levels or wildcards
+bool MqttNodeTopicValid(const char *topic){
+  size_t length = strlen(topic);
+  return length > 0 && length < MQTT_NODE_TOPIC_LENGTH && strpbrk(topic, "/+#") == NULL;
+}
+
+void BuildMqttTopics(const char *nodeTopic, uint32_t chipId){
+  char prefix[MQTT_PREFIX_LENGTH + 1];
+  snprintf(prefix, sizeof(prefix), "%s/%s/%s", MQTT_CUSTOMER, MQTT_PROJECT, nodeTopic);
+
+  snprintf(mqttTopics[TOPIC_STATE], MQTT_TOPIC_LENGTH, "%s/STATE", prefix);
+  snprintf(mqttTopics[TOPIC_CMND], MQTT_TOPIC_LENGTH, "%s/cmnd", prefix);
+  snprintf(mqttTopics[TOPIC_LOG], MQTT_TOPIC_LENGTH, "%s/log", prefix);
+  snprintf(mqttTopics[TOPIC_HEARTBEAT], MQTT_TOPIC_LENGTH, "%s/HEARTBEAT", prefix);
+  snprintf(mqttTopics[TOPIC_TASKS], MQTT_TOPIC_LENGTH, "%s/TASKS", prefix);
+  snprintf(mqttTopics[TOPIC_METRICS], MQTT_TOPIC_LENGTH, "%s/METRICS", prefix);
+
+  //  Settings are published under the chip ID, not the configurable topic
+  snprintf(mqttTopics[TOPIC_SETTINGS], MQTT_TOPIC_LENGTH, "%s/%s/%u/settings/", MQTT_CUSTOMER, MQTT_PROJECT, chipId);
+
+  for (uint8_t i = 0; i < RELAY_COUNT; i++) {
+    snprintf(mqttTopics[TOPIC_RESULT_POWER(i)], MQTT_TOPIC_LENGTH, "%s/RESULT/POWER%u", prefix, i);
+    snprintf(mqttTopics[TOPIC_RESULT_DURATION(i)], MQTT_TOPIC_LENGTH, "%s/RESULT/POWER%u/DURATION", prefix, i);
+  }
+}
+
+const char *MqttTopic(MQTT_TOPIC topic){
+  return mqttTopics[topic];
+}
+
+bool MqttPublish(PubSubClient &client, MQTT_TOPIC topic, const char *payload, bool retained = false){
+  if (!client.connected()){
+    mqttStats.skipped++;
+    return false;
+  }
+
+  if (!client.publish(mqttTopics[topic], payload, retained)){
+    mqttStats.failures++;
+    return false;
+  }
+
+  mqttStats.publishes++;
+  return true;
+}
+
+//  A document that overflowed its capacity is missing part of the report,
+//  it is dropped rather than published incomplete
+bool MqttPublishJson(PubSubClient &client, MQTT_TOPIC topic, const JsonDocument &doc, bool retained = false){
+  if (doc.overflowed()){
+    mqttStats.overflows++;
+    return false;
+  }
+
+  if (!client.connected()){
+    mqttStats.skipped++;
+    return false;
+  }
+
+  size_t length = measureJson(doc);
+
+  if (!client.beginPublish(mqttTopics[topic], length, retained) || serializeJson(doc, client) != length || !client.endPublish()){
+    mqttStats.failures++;
+    return false;
+  }
+
+  mqttStats.publishes++;
+  return true;
+}
+
+#endif
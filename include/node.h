@@ -0,0 +1,88 @@
+/*
+    node.h - The relay side of the node
+
+    Wires up the relays, inputs, buttons, staircase light and zone timers
+    and runs them from the scheduler. The firmware and the native build
+    both start it with NodeBegin() and call NodeLoop() from their loop, so
+    the host simulation runs exactly what the node does.
+
+    Everything that needs the network is left to the caller, the node keeps
+    switching the lights without it.
+*/
+
+#ifndef NODE_H
+#define NODE_H
+
+#include <Arduino.h>
+#include <pcf8574_esp.h>
+#include <PubSubClient.h>
+
+//  Called with every debounced input edge, after the buttons had it
+typedef void (*inputObserver_t)(const inputEdge_t &edge);
+
+int8_t inputTask = SCHEDULER_NO_TASK;
+int8_t zoneTask = SCHEDULER_NO_TASK;
+
+PCF857x *nodeExpander = NULL;
+const config *nodeConfig = NULL;
+inputObserver_t nodeInputObserver = NULL;
+
+void InputTaskCallback(){
+  InputsPoll(*nodeExpander);
+
+  inputEdge_t edge;
+  while (PopInputEdge(edge)){
+    ButtonsProcessEdge(edge);
+    if (nodeInputObserver != NULL) nodeInputObserver(edge);
+  }
+
+  ButtonsUpdate(millis());
+}
+
+void ZoneTaskCallback(){
+  ZonesRun();
+}
+
+void ApplyZoneChanges(const config &previous){
+  ApplyZoneSettings(*nodeConfig);
+}
+
+//  settings must stay valid, the zones are reconfigured from it later
+void NodeBegin(PCF857x &expander, PubSubClient &client, const config &settings, lightReporter_t reporter, inputObserver_t observer){
+  nodeExpander = &expander;
+  nodeConfig = &settings;
+  nodeInputObserver = observer;
+
+  RelaysBegin(expander);
+  InputsBegin(expander);
+  StaircaseBegin(client, reporter);
+  ButtonsBegin(GestureHandler);
+
+  //  Relay timers
+  ZonesBegin(SwitchZoneOff);
+  ApplyZoneSettings(settings);
+  ReconfigRegister("zones", RECONFIG_ZONES, ApplyZoneChanges);
+
+  //  The first tasks, they run as soon as the loop does
+  inputTask = SchedulerAddTask("input", InputTaskCallback, INPUT_TASK_INTERVAL, INPUT_TASK_BUDGET);
+  zoneTask = SchedulerAddTask("zones", ZoneTaskCallback, ZONE_TASK_INTERVAL, DEFAULT_TASK_BUDGET);
+}
+
+//  The inputs, the relay timers and the relays, for where the loop is held
+//  up for longer than the inputs can wait (see mqttconnection.h). Safe to
+//  run between the tasks, they only see their work done early.
+void NodeService(){
+  InputTaskCallback();
+  ZonesRun();
+  RelaysFlush(*nodeExpander);
+}
+
+//  One pass of loop()
+void NodeLoop(){
+  MetricsLoopBegin();
+  SchedulerRun();
+  RelaysFlush(*nodeExpander);
+  MetricsLoopEnd();
+}
+
+#endif
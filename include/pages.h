@@ -0,0 +1,35 @@
+/*
+    pages.h - The web pages and the placeholders they use
+*/
+
+#ifndef PAGES_H
+#define PAGES_H
+
+#include "templates.h"
+
+//  Web pages, in the order of PAGE
+template_t pageTemplates[PAGE_COUNT] = {
+  {"/login.html"},
+  {"/index.html"},
+  {"/status.html"},
+  {"/staircaselighttimer.html"},
+  {"/entrancelight.html"},
+  {"/generalsettings.html"},
+  {"/networksettings.html"},
+  {"/tools.html"}
+};
+
+template_t headerTemplate = {"/pageheader.html"};
+
+//  Placeholder names, in the order of TEMPLATE_FIELD
+const char * const templateFields[FIELD_COUNT] = {
+  "pageheader", "year", "alert",
+  "espid", "chipid", "hardwareid", "hardwareversion", "softwareid", "firmwareid", "firmwareversion", "buildnumber",
+  "uptime", "currenttime", "lastresetreason", "flashchipsize", "flashchipspeed", "freeheapsize", "freesketchspace",
+  "friendlyname", "heartbeatinterval",
+  "mqtt-servername", "mqtt-port", "mqtt-topic",
+  "wifimode", "macaddress", "networkaddress", "ssid", "subnetmask", "gateway", "wifilist",
+  "delaylist", "sunsetoffsetlist", "sunriseoffsetlist", "timezoneslist"
+};
+
+#endif
@@ -0,0 +1,97 @@
+/*
+    reconfig.h - Applying changed settings without a restart
+
+    Every subsystem that depends on the settings registers a callback with
+    the mask of the settings it uses. A settings handler keeps a copy of the
+    settings before it changes them, and ReconfigApply() compares that copy
+    with the new values and calls only the callbacks whose settings changed.
+    A new friendly name doesn't touch the MQTT connection, and the relays
+    keep running whatever is reconfigured.
+
+    The WiFi credentials are not handled here, joining another network
+    still needs a restart.
+*/
+
+#ifndef RECONFIG_H
+#define RECONFIG_H
+
+#include <Arduino.h>
+
+#define RECONFIG_MAX_SUBSCRIBERS 8
+
+//  Groups of settings a callback can subscribe to
+#define RECONFIG_FRIENDLY_NAME  0x0001
+#define RECONFIG_HEARTBEAT      0x0002
+#define RECONFIG_TIMEZONE       0x0004
+#define RECONFIG_MQTT_SERVER    0x0008      //  Server and port
+#define RECONFIG_MQTT_TOPIC     0x0010
+#define RECONFIG_NETWORK        0x0020
+#define RECONFIG_ZONES          0x0040      //  Staircase delay and the zone timers
+#define RECONFIG_SUN_OFFSETS    0x0080
+
+//  previous holds the settings before the change, appConfig the new ones
+typedef void (*reconfigHandler_t)(const config &previous);
+
+struct reconfigSubscriber_t{
+  const char *name;
+  uint16_t mask;
+  reconfigHandler_t handler;
+};
+
+struct reconfigStats_t{
+  unsigned long applies;        //  ReconfigApply() calls that changed something
+  unsigned long callbacks;
+};
+
+reconfigSubscriber_t reconfigSubscribers[RECONFIG_MAX_SUBSCRIBERS];
+uint8_t reconfigSubscriberCount = 0;
+reconfigStats_t reconfigStats;
+
+bool ReconfigRegister(const char *name, uint16_t mask, reconfigHandler_t handler){
+  if (reconfigSubscriberCount >= RECONFIG_MAX_SUBSCRIBERS) return false;
+
+  reconfigSubscribers[reconfigSubscriberCount].name = name;
+  reconfigSubscribers[reconfigSubscriberCount].mask = mask;
+  reconfigSubscribers[reconfigSubscriberCount].handler = handler;
+  reconfigSubscriberCount++;
+  return true;
+}
+
+//  Mask of the settings groups that differ
+uint16_t ReconfigDiff(const config &a, const config &b){
+  uint16_t changed = 0;
+
+  if (strcmp(a.friendlyName, b.friendlyName) != 0) changed |= RECONFIG_FRIENDLY_NAME;
+  if (a.heartbeatInterval != b.heartbeatInterval) changed |= RECONFIG_HEARTBEAT;
+  if (a.timeZone != b.timeZone || a.dst != b.dst) changed |= RECONFIG_TIMEZONE;
+  if (strcmp(a.mqttServer, b.mqttServer) != 0 || a.mqttPort != b.mqttPort) changed |= RECONFIG_MQTT_SERVER;
+  if (strcmp(a.mqttTopic, b.mqttTopic) != 0) changed |= RECONFIG_MQTT_TOPIC;
+  if (strcmp(a.ssid, b.ssid) != 0 || strcmp(a.password, b.password) != 0) changed |= RECONFIG_NETWORK;
+  if (a.sunriseLightOffset != b.sunriseLightOffset || a.sunsetLightOffset != b.sunsetLightOffset) changed |= RECONFIG_SUN_OFFSETS;
+
+  if (a.staircaseLightDelay != b.staircaseLightDelay ||
+      memcmp(a.zoneDelays, b.zoneDelays, sizeof(a.zoneDelays)) != 0 ||
+      memcmp(a.zoneRetrigger, b.zoneRetrigger, sizeof(a.zoneRetrigger)) != 0) changed |= RECONFIG_ZONES;
+
+  return changed;
+}
+
+//  Calls the callbacks of the changed settings in the order they were
+//  registered, returns the mask of the changes
+uint16_t ReconfigApply(const config &previous, const config &current){
+  uint16_t changed = ReconfigDiff(previous, current);
+  if (changed == 0) return 0;
+
+  reconfigStats.applies++;
+
+  for (uint8_t i = 0; i < reconfigSubscriberCount; i++) {
+    if ((reconfigSubscribers[i].mask & changed) == 0) continue;
+
+    reconfigSubscribers[i].handler(previous);
+    reconfigStats.callbacks++;
+  }
+
+  return changed;
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*
+    relays.h - Shadow register for the PCF8574 relay outputs
+
+    RelayWrite() only updates a RAM copy of the port and marks it dirty,
+    RelaysFlush() writes the whole port with a single write8() once per
+    scheduler pass, and only if something actually changed. The input pins
+    are always written high so they keep working as inputs.
+
+    The relays are active low, switch them with RELAY_ON and RELAY_OFF.
+*/
+
+#ifndef RELAYS_H
+#define RELAYS_H
+
+#include <Arduino.h>
+#include <pcf8574_esp.h>
+#include "inputs.h"
+
+#define RELAY_ON  0
+#define RELAY_OFF 1
+
+struct relayStats_t{
+  unsigned long requests;       //  RelayWrite() calls
+  unsigned long writes;         //  write8() transactions
+  unsigned long skipped;        //  Flushes with nothing to write
+};
+
+uint8_t relayShadow = 0xFF;     //  Relays are active low, all off
+bool relaysDirty = false;
+relayStats_t relayStats;
+
+unsigned long i2cTransactionsPerSecond = 0;
+unsigned long i2cTransactionsLast = 0;
+unsigned long i2cRateUpdatedAt = 0;
+
+//  Takes over the current state of the port
+void RelaysBegin(PCF857x &expander){
+  relayShadow = expander.read8() | INPUT_MASK_ALL;
+  relaysDirty = false;
+  inputStats.reads++;
+}
+
+//  Same semantics as PCF857x::write(), the pin level is buffered until the next flush
+void RelayWrite(uint8_t channel, uint8_t level){
+  uint8_t shadow = level ? relayShadow | (1 << channel) : relayShadow & ~(1 << channel);
+
+  relayStats.requests++;
+
+  if (shadow != relayShadow){
+    relayShadow = shadow;
+    relaysDirty = true;
+  }
+}
+
+uint8_t RelayRead(uint8_t channel){
+  return (relayShadow >> channel) & 1;
+}
+
+bool RelayIsOn(uint8_t channel){
+  return RelayRead(channel) == RELAY_ON;
+}
+
+void RelaysFlush(PCF857x &expander){
+  if (relaysDirty){
+    expander.write8(relayShadow | INPUT_MASK_ALL);
+    relaysDirty = false;
+    relayStats.writes++;
+  }
+  else
+    relayStats.skipped++;
+
+  if (millis() - i2cRateUpdatedAt >= 1000){
+    unsigned long transactions = inputStats.reads + relayStats.writes;
+    i2cTransactionsPerSecond = (transactions - i2cTransactionsLast) * 1000 / (millis() - i2cRateUpdatedAt);
+    i2cTransactionsLast = transactions;
+    i2cRateUpdatedAt = millis();
+  }
+}
+
+#endif
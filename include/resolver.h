@@ -0,0 +1,153 @@
+/*
+    resolver.h - Host name lookups that don't block
+
+    WiFi.hostByName() waits for the answer of the DNS server, up to 10 s
+    with its default timeout, and the relays wait with it. ResolverLookup()
+    hands the query to lwIP's dns_gethostbyname() instead and returns right
+    away, the answer arrives later in a callback from the network stack.
+    Callers poll it until it returns something else than RESOLVER_PENDING.
+
+    The answers are kept for RESOLVER_CACHE_TIME, reconnects don't have to
+    ask the DNS server again.
+*/
+
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <lwip/dns.h>
+
+#define RESOLVER_MAX_HOSTS    4
+#define RESOLVER_HOST_LENGTH  64
+#define RESOLVER_TIMEOUT      5000        //  ms
+#define RESOLVER_CACHE_TIME   3600000UL   //  ms
+
+enum RESOLVER_STATUS {
+  RESOLVER_IDLE,          //  No query, the next lookup starts one
+  RESOLVER_PENDING,
+  RESOLVER_RESOLVED,
+  RESOLVER_FAILED
+};
+
+struct resolverEntry_t{
+  char host[RESOLVER_HOST_LENGTH];
+  IPAddress ip;
+  volatile RESOLVER_STATUS status;
+  unsigned long updatedAt;              //  millis() of the query, then of the answer
+};
+
+resolverEntry_t resolverEntries[RESOLVER_MAX_HOSTS];
+
+//  Called by lwIP with the answer, address is NULL if there is none
+void ResolverFound(const char *name, const ip_addr_t *address, void *arg){
+  resolverEntry_t *entry = (resolverEntry_t*)arg;
+
+  //  A late answer to a query that timed out, the entry may belong to
+  //  another host by now
+  if (entry->status != RESOLVER_PENDING || strcmp(name, entry->host) != 0) return;
+
+  if (address != NULL){
+    entry->ip = IPAddress(address);
+    entry->updatedAt = millis();
+    entry->status = RESOLVER_RESOLVED;
+  }
+  else
+    entry->status = RESOLVER_FAILED;
+}
+
+//  The entry of the host, or the least recently updated one for a new host
+resolverEntry_t *ResolverEntry(const char *host){
+  for (uint8_t i = 0; i < RESOLVER_MAX_HOSTS; i++) {
+    if (strcmp(resolverEntries[i].host, host) == 0) return &resolverEntries[i];
+  }
+
+  resolverEntry_t *oldest = NULL;
+
+  for (uint8_t i = 0; i < RESOLVER_MAX_HOSTS; i++) {
+    resolverEntry_t *entry = &resolverEntries[i];
+
+    if (entry->host[0] == 0){
+      oldest = entry;
+      break;
+    }
+    if (entry->status == RESOLVER_PENDING) continue;
+
+    if (oldest == NULL || millis() - entry->updatedAt > millis() - oldest->updatedAt) oldest = entry;
+  }
+
+  if (oldest == NULL) return NULL;
+
+  strcpy(oldest->host, host);
+  oldest->status = RESOLVER_IDLE;
+  return oldest;
+}
+
+//  Starts a lookup or checks on the one in progress. ip is set when it
+//  returns RESOLVER_RESOLVED. A failure is reported once, the call after
+//  it starts a new query.
+RESOLVER_STATUS ResolverLookup(const char *host, IPAddress &ip){
+  //  Addresses need no lookup
+  IPAddress address;
+  if (address.fromString(host)){
+    ip = address;
+    return RESOLVER_RESOLVED;
+  }
+
+  if (strlen(host) >= RESOLVER_HOST_LENGTH) return RESOLVER_FAILED;
+
+  resolverEntry_t *entry = ResolverEntry(host);
+  if (entry == NULL) return RESOLVER_PENDING;       //  Every entry is busy
+
+  switch (entry->status) {
+    case RESOLVER_RESOLVED:
+      if (millis() - entry->updatedAt < RESOLVER_CACHE_TIME){
+        ip = entry->ip;
+        return RESOLVER_RESOLVED;
+      }
+      break;
+
+    case RESOLVER_PENDING:
+      if (millis() - entry->updatedAt < RESOLVER_TIMEOUT) return RESOLVER_PENDING;
+
+      entry->status = RESOLVER_IDLE;
+      return RESOLVER_FAILED;
+
+    case RESOLVER_FAILED:
+      entry->status = RESOLVER_IDLE;
+      return RESOLVER_FAILED;
+
+    case RESOLVER_IDLE:
+      break;
+  }
+
+  ip_addr_t answer = {};
+
+  entry->status = RESOLVER_PENDING;
+  entry->updatedAt = millis();
+
+  switch (dns_gethostbyname(host, &answer, ResolverFound, entry)) {
+    case ERR_OK:                //  lwIP had it cached, no callback follows
+      entry->ip = IPAddress(&answer);
+      entry->status = RESOLVER_RESOLVED;
+      ip = entry->ip;
+      return RESOLVER_RESOLVED;
+
+    case ERR_INPROGRESS:
+      return RESOLVER_PENDING;
+
+    default:
+      entry->status = RESOLVER_IDLE;
+      return RESOLVER_FAILED;
+  }
+}
+
+//  Drops the cached address, e.g. when the host didn't answer on it
+void ResolverForget(const char *host){
+  for (uint8_t i = 0; i < RESOLVER_MAX_HOSTS; i++) {
+    if (strcmp(resolverEntries[i].host, host) == 0 && resolverEntries[i].status == RESOLVER_RESOLVED)
+      resolverEntries[i].status = RESOLVER_IDLE;
+  }
+}
+
+#endif
@@ -0,0 +1,184 @@
+/*
+    scheduler.h - Cooperative task scheduler
+
+    Every piece of periodic work is registered as a named task with its own
+    interval. SchedulerRun() is called from loop() and starts every task whose
+    deadline has passed, so a slow task (e.g. the network) only delays the
+    others by its own run time instead of gating them behind a state machine.
+
+    Tasks with an interval of 0 are one-shot: they disable themselves after
+    running and can be re-armed with SchedulerEnableTask().
+*/
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define SCHEDULER_MAX_TASKS 16
+#define SCHEDULER_NO_TASK   -1
+
+//  Task names are referenced, not copied
+#define SCHEDULER_STATS_JSON_SIZE (JSON_ARRAY_SIZE(SCHEDULER_MAX_TASKS) + SCHEDULER_MAX_TASKS * JSON_OBJECT_SIZE(6))
+
+typedef void (*taskCallback_t)();
+
+struct task_t{
+  const char *name;
+  taskCallback_t callback;
+  unsigned long interval;       //  ms, 0 = one-shot
+  unsigned long budget;         //  us, longer runs are counted as overruns
+  unsigned long nextRun;        //  millis() value the task is due at
+  bool enabled;
+
+  //  Statistics
+  unsigned long runs;
+  unsigned long overruns;
+  unsigned long lastRunTime;    //  us
+  unsigned long maxRunTime;     //  us
+  unsigned long totalRunTime;   //  us
+  unsigned long lastJitter;     //  ms the task started after its deadline
+  unsigned long maxJitter;      //  ms
+};
+
+task_t tasks[SCHEDULER_MAX_TASKS];
+uint8_t taskCount = 0;
+
+void SchedulerResetStats(int8_t id){
+  if (id < 0 || id >= taskCount) return;
+
+  tasks[id].runs = 0;
+  tasks[id].overruns = 0;
+  tasks[id].lastRunTime = 0;
+  tasks[id].maxRunTime = 0;
+  tasks[id].totalRunTime = 0;
+  tasks[id].lastJitter = 0;
+  tasks[id].maxJitter = 0;
+}
+
+//  Registers a task and returns its ID, or SCHEDULER_NO_TASK if the table is full
+int8_t SchedulerAddTask(const char *name, taskCallback_t callback, unsigned long interval, unsigned long budget, bool enabled = true){
+  if (taskCount >= SCHEDULER_MAX_TASKS) return SCHEDULER_NO_TASK;
+
+  int8_t id = taskCount++;
+
+  tasks[id].name = name;
+  tasks[id].callback = callback;
+  tasks[id].interval = interval;
+  tasks[id].budget = budget;
+  tasks[id].nextRun = millis() + interval;
+  tasks[id].enabled = enabled;
+
+  SchedulerResetStats(id);
+
+  return id;
+}
+
+//  (Re)arms a task to run after the given delay
+void SchedulerEnableTask(int8_t id, unsigned long delayMs = 0){
+  if (id < 0 || id >= taskCount) return;
+
+  tasks[id].nextRun = millis() + delayMs;
+  tasks[id].enabled = true;
+}
+
+void SchedulerDisableTask(int8_t id){
+  if (id < 0 || id >= taskCount) return;
+
+  tasks[id].enabled = false;
+}
+
+bool SchedulerIsTaskEnabled(int8_t id){
+  if (id < 0 || id >= taskCount) return false;
+
+  return tasks[id].enabled;
+}
+
+void SchedulerSetInterval(int8_t id, unsigned long interval){
+  if (id < 0 || id >= taskCount) return;
+
+  tasks[id].interval = interval;
+  tasks[id].nextRun = millis() + interval;
+}
+
+//  ms until the next enabled task is due, 0 if one is due now. Time that
+//  can be slept (or skipped by a simulation) without delaying any task.
+unsigned long SchedulerIdleTime(unsigned long maxIdle = ULONG_MAX){
+  unsigned long idle = maxIdle;
+  unsigned long now = millis();
+
+  for (uint8_t i = 0; i < taskCount; i++) {
+    if (!tasks[i].enabled) continue;
+
+    long due = (long)(tasks[i].nextRun - now);
+    if (due <= 0) return 0;
+    if ((unsigned long)due < idle) idle = due;
+  }
+
+  return idle;
+}
+
+//  Runs every task that is due. Call it from loop() as often as possible.
+void SchedulerRun(){
+  for (uint8_t i = 0; i < taskCount; i++) {
+    task_t &t = tasks[i];
+
+    if (!t.enabled) continue;
+
+    unsigned long now = millis();
+
+    //  Signed difference keeps this correct across the millis() rollover
+    if ((long)(now - t.nextRun) < 0) continue;
+
+    t.lastJitter = now - t.nextRun;
+    if (t.lastJitter > t.maxJitter) t.maxJitter = t.lastJitter;
+
+    if (t.interval == 0){
+      t.enabled = false;
+    } else {
+      //  Keep the phase, but don't try to catch up with missed runs
+      t.nextRun += t.interval;
+      if ((long)(now - t.nextRun) >= 0) t.nextRun = now + t.interval;
+    }
+
+    unsigned long startTime = micros();
+    t.callback();
+    t.lastRunTime = micros() - startTime;
+
+    t.runs++;
+    t.totalRunTime += t.lastRunTime;
+    if (t.lastRunTime > t.maxRunTime) t.maxRunTime = t.lastRunTime;
+    if (t.budget > 0 && t.lastRunTime > t.budget) t.overruns++;
+  }
+}
+
+void SchedulerPrintStats(Print &out){
+  out.println("Task          Runs      Avg(us)   Max(us)   Jitter(ms) Overruns");
+  for (uint8_t i = 0; i < taskCount; i++) {
+    task_t &t = tasks[i];
+    out.printf("%-13s %-9lu %-9lu %-9lu %-10lu %lu\r\n",
+      t.name,
+      t.runs,
+      t.runs ? t.totalRunTime / t.runs : 0,
+      t.maxRunTime,
+      t.maxJitter,
+      t.overruns);
+  }
+}
+
+void SchedulerStatsToJson(JsonArray out){
+  for (uint8_t i = 0; i < taskCount; i++) {
+    task_t &t = tasks[i];
+    JsonObject task = out.createNestedObject();
+
+    task["Name"] = t.name;
+    task["Runs"] = t.runs;
+    task["AvgRunTime"] = t.runs ? t.totalRunTime / t.runs : 0;
+    task["MaxRunTime"] = t.maxRunTime;
+    task["MaxJitter"] = t.maxJitter;
+    task["Overruns"] = t.overruns;
+  }
+}
+
+#endif
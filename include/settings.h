@@ -0,0 +1,191 @@
+/*
+    settings.h - JSON form of the settings
+
+    The settings are stored in the binary record of configstore.h, JSON is
+    the import and export format. A /config.json found at boot (e.g. one
+    written by an older firmware or uploaded with the file system image) is
+    imported once, missing values are filled in with their defaults. On a
+    running node GET /api/settings exports the settings in the same format,
+    without the password, and a POST there imports them. Values missing from
+    a POST keep their current setting.
+*/
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+
+#define SETTINGS_FILE "/config.json"
+#define SETTINGS_MAX_FILE_SIZE 1024
+
+#define SETTINGS_IMPORTED_FILE "/config.json.bak"
+
+//  Results of ReadSettings() and ReadConfig(), also used as the log event IDs
+#define SETTINGS_OK                 0
+#define SETTINGS_OPEN_FAILED        1
+#define SETTINGS_TOO_LARGE          2
+#define SETTINGS_PARSE_FAILED       3
+#define SETTINGS_WRITE_FAILED       4
+#define SETTINGS_CRC_FAILED         5
+#define SETTINGS_VERSION_UNKNOWN    6
+#define SETTINGS_MIGRATED           7
+
+const char * const settingsErrors[] = {
+  "",
+  "Failed to open config file.",
+  "Config file size is too large.",
+  "Failed to parse config file.",
+  "Failed to write config file.",
+  "Config file is corrupt.",
+  "Config file is from a newer firmware.",
+  "Config file converted from an older version."
+};
+
+//  A 0 would make the heartbeat task run only once
+bool HeartbeatIntervalValid(long seconds){
+  return seconds >= HEARTBEAT_MIN_INTERVAL && seconds <= HEARTBEAT_MAX_INTERVAL;
+}
+
+//  The values a setting missing from an imported file falls back to
+void SettingsDefaults(config &data, const char *defaultSsid, uint32_t chipId){
+  memset(&data, 0, sizeof(data));
+
+  strlcpy(data.ssid, defaultSsid, sizeof(data.ssid));
+  strlcpy(data.password, DEFAULT_PASSWORD, sizeof(data.password));
+  strlcpy(data.mqttServer, DEFAULT_MQTT_SERVER, sizeof(data.mqttServer));
+  data.mqttPort = DEFAULT_MQTT_PORT;
+  snprintf(data.mqttTopic, sizeof(data.mqttTopic), "%s-%u", DEFAULT_MQTT_TOPIC, chipId);
+
+  strlcpy(data.friendlyName, NODE_DEFAULT_FRIENDLY_NAME, sizeof(data.friendlyName));
+  data.heartbeatInterval = DEFAULT_HEARTBEAT_INTERVAL;
+
+  data.staircaseLightDelay = DEFAULT_STAIRCASE_LIGHT_DELAY;
+  for (size_t i = 0; i < RELAY_COUNT; i++) {
+    data.zoneRetrigger[i] = RETRIGGER_RESTART;
+  }
+
+  data.sunriseLightOffset = DEFAULT_SUNRISE_LIGHT_OFFSET;
+  data.sunsetLightOffset = DEFAULT_SUNSET_LIGHT_OFFSET;
+}
+
+//  Values missing from doc, or out of range, are taken from defaults. data
+//  and defaults must not be the same settings.
+void SettingsFromJson(config &data, JsonDocument &doc, const config &defaults){
+  strlcpy(data.ssid, doc["ssid"] | (const char*)defaults.ssid, sizeof(data.ssid));
+  strlcpy(data.password, doc["password"] | (const char*)defaults.password, sizeof(data.password));
+  strlcpy(data.mqttServer, doc["mqttServer"] | (const char*)defaults.mqttServer, sizeof(data.mqttServer));
+  data.mqttPort = doc["mqttPort"] | 0;
+  if (data.mqttPort == 0) data.mqttPort = defaults.mqttPort;
+
+  const char *mqttTopic = doc["mqttTopic"];
+  if (mqttTopic != NULL && MqttNodeTopicValid(mqttTopic))
+    strlcpy(data.mqttTopic, mqttTopic, sizeof(data.mqttTopic));
+  else
+    strlcpy(data.mqttTopic, defaults.mqttTopic, sizeof(data.mqttTopic));
+
+  strlcpy(data.friendlyName, doc["friendlyName"] | (const char*)defaults.friendlyName, sizeof(data.friendlyName));
+  data.timeZone = doc["timezone"] | defaults.timeZone;
+  data.dst = defaults.dst;
+
+  //  An interval out of range is treated as missing
+  long heartbeatInterval = doc["heartbeatInterval"] | 0L;
+  data.heartbeatInterval = HeartbeatIntervalValid(heartbeatInterval) ? heartbeatInterval : defaults.heartbeatInterval;
+
+  data.staircaseLightDelay = doc["staircaseLightDelay"] | 0;
+  if (data.staircaseLightDelay == 0) data.staircaseLightDelay = defaults.staircaseLightDelay;
+
+  for (size_t i = 0; i < RELAY_COUNT; i++) {
+    data.zoneDelays[i] = doc["zoneDelays"][i] | defaults.zoneDelays[i];
+
+    uint8_t retrigger = doc["zoneRetrigger"][i] | defaults.zoneRetrigger[i];
+    data.zoneRetrigger[i] = retrigger <= RETRIGGER_IGNORE ? retrigger : defaults.zoneRetrigger[i];
+  }
+
+  data.sunriseLightOffset = doc["sunriseLightOffset"] | defaults.sunriseLightOffset;
+  data.sunsetLightOffset = doc["sunsetLightOffset"] | defaults.sunsetLightOffset;
+}
+
+void SettingsFromJson(config &data, JsonDocument &doc, const char *defaultSsid, uint32_t chipId){
+  config defaults;
+
+  SettingsDefaults(defaults, defaultSsid, chipId);
+  SettingsFromJson(data, doc, defaults);
+}
+
+void SettingsToJson(const config &data, JsonDocument &doc){
+  doc["ssid"] = data.ssid;
+  doc["password"] = data.password;
+
+  doc["heartbeatInterval"] = data.heartbeatInterval;
+
+  doc["timezone"] = data.timeZone;
+
+  doc["mqttServer"] = data.mqttServer;
+  doc["mqttPort"] = data.mqttPort;
+  doc["mqttTopic"] = data.mqttTopic;
+
+  doc["friendlyName"] = data.friendlyName;
+
+  doc["staircaseLightDelay"] = data.staircaseLightDelay;
+
+  JsonArray zoneDelays = doc.createNestedArray("zoneDelays");
+  JsonArray zoneRetrigger = doc.createNestedArray("zoneRetrigger");
+  for (size_t i = 0; i < RELAY_COUNT; i++) {
+    zoneDelays.add(data.zoneDelays[i]);
+    zoneRetrigger.add(data.zoneRetrigger[i]);
+  }
+
+  doc["sunriseLightOffset"] = data.sunriseLightOffset;
+  doc["sunsetLightOffset"] = data.sunsetLightOffset;
+}
+
+//  Returns SETTINGS_OK or the reason the file could not be used
+uint8_t ReadSettings(const char *path, config &data, const char *defaultSsid, uint32_t chipId){
+  File configFile = LittleFS.open(path, "r");
+  if (!configFile) return SETTINGS_OPEN_FAILED;
+
+  size_t size = configFile.size();
+  if (size > SETTINGS_MAX_FILE_SIZE) {
+    configFile.close();
+    return SETTINGS_TOO_LARGE;
+  }
+
+  //  ArduinoJson needs a mutable buffer to parse in place
+  char buffer[SETTINGS_MAX_FILE_SIZE + 1];
+  size = configFile.readBytes(buffer, size);
+  buffer[size] = 0;
+  configFile.close();
+
+  StaticJsonDocument<JSON_SETTINGS_SIZE> doc;
+  if (deserializeJson(doc, buffer)) return SETTINGS_PARSE_FAILED;
+
+  #ifdef __debugSettings
+  serializeJsonPretty(doc,Serial);
+  Serial.println();
+  #endif
+
+  SettingsFromJson(data, doc, defaultSsid, chipId);
+  return SETTINGS_OK;
+}
+
+uint8_t WriteSettings(const char *path, const config &data){
+  StaticJsonDocument<SETTINGS_MAX_FILE_SIZE> doc;
+
+  SettingsToJson(data, doc);
+
+  #ifdef __debugSettings
+  serializeJsonPretty(doc,Serial);
+  Serial.println();
+  #endif
+
+  File configFile = LittleFS.open(path, "w");
+  if (!configFile) return SETTINGS_WRITE_FAILED;
+
+  serializeJson(doc, configFile);
+  configFile.close();
+  return SETTINGS_OK;
+}
+
+#endif
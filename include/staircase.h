@@ -0,0 +1,120 @@
+/*
+    staircase.h - Staircase and entrance light control
+
+    Turns the button gestures into light actions through the inputActions
+    table and switches the relays and their zone timers. Every change is
+    published on the relay's RESULT topic and passed to the reporter given
+    to StaircaseBegin(), which takes care of logging it.
+
+    The entrance light is also switched by the sunrise / sunset schedule.
+    A change by hand (gesture or MQTT) sets entranceLightManual, and the
+    schedule leaves the light alone until its next on / off edge.
+*/
+
+#ifndef STAIRCASE_H
+#define STAIRCASE_H
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+
+typedef void (*lightReporter_t)(LIGHT_EVENT event, uint8_t channel);
+
+//  What each gesture does on each input
+const INPUT_ACTION inputActions[INPUT_COUNT][GESTURE_COUNT] = {
+  //  Press                   Short press  Double press              Long press              Hold
+  {ACTION_NONE,             ACTION_NONE, ACTION_NONE,             ACTION_NONE,            ACTION_NONE},
+  {ACTION_STAIRCASE_START,  ACTION_NONE, ACTION_STAIRCASE_EXTEND, ACTION_ENTRANCE_TOGGLE, ACTION_STAIRCASE_FORCE_ON},
+  {ACTION_NONE,             ACTION_NONE, ACTION_NONE,             ACTION_NONE,            ACTION_NONE},
+  {ACTION_NONE,             ACTION_NONE, ACTION_NONE,             ACTION_NONE,            ACTION_NONE}
+};
+
+bool entranceLightState = false;
+bool entranceLightManual = false;
+
+PubSubClient *lightClient = NULL;
+lightReporter_t lightReporter = NULL;
+
+void StaircaseBegin(PubSubClient &client, lightReporter_t reporter){
+  lightClient = &client;
+  lightReporter = reporter;
+}
+
+void ApplyZoneSettings(const config &data){
+  for (uint8_t i = 0; i < RELAY_COUNT; i++)
+    ZoneConfigure(i, data.zoneDelays[i] * 1000, (RETRIGGER_POLICY)data.zoneRetrigger[i]);
+
+  //  The staircase zone keeps its own setting on the web page
+  ZoneConfigure(STAIRCASELIGHT_RELAY, data.staircaseLightDelay * 1000, (RETRIGGER_POLICY)data.zoneRetrigger[STAIRCASELIGHT_RELAY]);
+}
+
+void ReportLight(LIGHT_EVENT event, uint8_t channel, const char *state){
+  if (state != NULL) MqttPublish(*lightClient, TOPIC_RESULT_POWER(channel), state);
+  if (lightReporter != NULL) lightReporter(event, channel);
+}
+
+void SwitchZoneOff(uint8_t channel){
+  ZoneCancel(channel);
+  RelayWrite(channel, RELAY_OFF);
+  if (channel == ENTRANCELIGHT_RELAY) entranceLightState = false;
+  ReportLight(LIGHT_ZONE_OFF, channel, "off");
+}
+
+void StartStaircaseLight(){
+  RelayWrite(STAIRCASELIGHT_RELAY, RELAY_ON);
+  ZoneTrigger(STAIRCASELIGHT_RELAY);
+  ReportLight(LIGHT_STAIRCASE_STARTED, STAIRCASELIGHT_RELAY, "on");
+}
+
+void ExtendStaircaseLight(){
+  if (!RelayIsOn(STAIRCASELIGHT_RELAY)){
+    StartStaircaseLight();
+    return;
+  }
+
+  //  A forced on light has no timer to extend
+  if (!ZoneIsRunning(STAIRCASELIGHT_RELAY)) return;
+
+  ZoneExtend(STAIRCASELIGHT_RELAY);
+  ReportLight(LIGHT_STAIRCASE_EXTENDED, STAIRCASELIGHT_RELAY, NULL);
+}
+
+void ForceStaircaseLightOn(){
+  RelayWrite(STAIRCASELIGHT_RELAY, RELAY_ON);
+  ZoneCancel(STAIRCASELIGHT_RELAY);
+  ReportLight(LIGHT_STAIRCASE_FORCED_ON, STAIRCASELIGHT_RELAY, "on");
+}
+
+void SetEntranceLight(bool on, LIGHT_EVENT event){
+  entranceLightState = on;
+  RelayWrite(ENTRANCELIGHT_RELAY, on ? RELAY_ON : RELAY_OFF);
+  ReportLight(event, ENTRANCELIGHT_RELAY, on ? "on" : "off");
+}
+
+void ToggleEntranceLight(){
+  entranceLightManual = true;
+  SetEntranceLight(!entranceLightState, LIGHT_ENTRANCE_TOGGLED);
+}
+
+void GestureHandler(uint8_t channel, GESTURE gesture, unsigned long timestamp){
+  switch (inputActions[channel][gesture]) {
+    case ACTION_STAIRCASE_START:
+      StartStaircaseLight();
+      break;
+    case ACTION_STAIRCASE_EXTEND:
+      ExtendStaircaseLight();
+      break;
+    case ACTION_STAIRCASE_FORCE_ON:
+      ForceStaircaseLightOn();
+      break;
+    case ACTION_STAIRCASE_OFF:
+      SwitchZoneOff(STAIRCASELIGHT_RELAY);
+      break;
+    case ACTION_ENTRANCE_TOGGLE:
+      ToggleEntranceLight();
+      break;
+    default:
+      break;
+  }
+}
+
+#endif
@@ -0,0 +1,89 @@
+/*
+    staticfiles.h - Cached static assets
+
+    Files under STATIC_URI_PREFIX are served from LittleFS with a strong
+    ETag made of the firmware build number, so a browser revalidating an
+    asset gets an empty 304 answer. Links carrying ?v=<build number> are
+    versioned: they can only change with a new build, so they are marked
+    immutable and not even revalidated.
+
+    If a gzipped copy (name.gz, made by tools/compress_assets.py) exists it
+    is sent instead of the original file.
+*/
+
+#ifndef STATICFILES_H
+#define STATICFILES_H
+
+#include <Arduino.h>
+#include <ESP8266WebServer.h>
+#include <LittleFS.h>
+
+#define STATIC_URI_PREFIX   "/static/"
+#define STATIC_ETAG         "\"" BUILD_NUMBER "\""
+#define STATIC_MAX_PATH     32
+
+struct staticStats_t{
+  unsigned long requests;
+  unsigned long notModified;    //  304 answers
+  unsigned long gzipped;        //  Served from a .gz copy
+};
+
+staticStats_t staticStats;
+
+//  Only these file types are served, everything else on the file system
+//  (e.g. config.json) stays private
+const char *StaticContentType(const char *path){
+  const char *extension = strrchr(path, '.');
+  if (extension == NULL) return NULL;
+
+  if (strcmp(extension, ".ico") == 0) return "image/x-icon";
+  if (strcmp(extension, ".css") == 0) return "text/css";
+  if (strcmp(extension, ".js") == 0) return "application/javascript";
+  if (strcmp(extension, ".svg") == 0) return "image/svg+xml";
+  if (strcmp(extension, ".png") == 0) return "image/png";
+  return NULL;
+}
+
+//  Serves the request if it is for a static asset, returns false otherwise
+bool ServeStaticFile(ESP8266WebServer &server){
+  const char *uri = server.uri().c_str();
+
+  if (strncmp(uri, STATIC_URI_PREFIX, strlen(STATIC_URI_PREFIX)) != 0) return false;
+
+  //  Keep the leading '/' of the file name
+  const char *path = uri + strlen(STATIC_URI_PREFIX) - 1;
+  const char *contentType = StaticContentType(path);
+
+  if (contentType == NULL || strstr(path, "..") != NULL || strlen(path) + 3 > STATIC_MAX_PATH) return false;
+
+  char gzPath[STATIC_MAX_PATH + 1];
+  snprintf(gzPath, sizeof(gzPath), "%s.gz", path);
+
+  bool gzipped = LittleFS.exists(gzPath);
+  if (!gzipped && !LittleFS.exists(path)) return false;
+
+  staticStats.requests++;
+
+  server.sendHeader("ETag", STATIC_ETAG);
+  server.sendHeader("Cache-Control", server.arg("v") == BUILD_NUMBER ? "public, max-age=31536000, immutable" : "no-cache");
+
+  if (server.header("If-None-Match").indexOf(STATIC_ETAG) >= 0){
+    staticStats.notModified++;
+    server.send(304);
+    return true;
+  }
+
+  File f = LittleFS.open(gzipped ? gzPath : path, "r");
+  if (!f){
+    server.send(500, "text/plain", "Failed to open file.");
+    return true;
+  }
+
+  //  streamFile() adds "Content-Encoding: gzip" for .gz files by itself
+  if (gzipped) staticStats.gzipped++;
+  server.streamFile(f, contentType);
+  f.close();
+  return true;
+}
+
+#endif
@@ -9,7 +9,7 @@ struct config{
 
   char mqttServer[64];
   int mqttPort;
-  char mqttTopic[32];
+  char mqttTopic[MQTT_NODE_TOPIC_LENGTH];
 
   bool dst;
 
@@ -18,6 +18,10 @@ struct config{
 
   unsigned long staircaseLightDelay;
 
+  //  Auto-off of the other relays, in seconds (0 = none) and RETRIGGER_POLICY
+  unsigned long zoneDelays[RELAY_COUNT];
+  uint8_t zoneRetrigger[RELAY_COUNT];
+
 };
 
 struct sunData_t{
@@ -0,0 +1,106 @@
+/*
+    sun.h - Sunrise and sunset calculation
+
+    Using the algorithm found here:
+    http://williams.best.vwh.net/sunrise_sunset_algorithm.htm
+
+    Pure math on the calendar date, no clock or time zone involved.
+*/
+
+#ifndef SUN_H
+#define SUN_H
+
+#include <math.h>
+
+typedef enum {
+    Sunrise, Sunset
+} sunRiseSunset;
+
+//  1. first calculate the day of the year (1..366)
+int SunDayOfYear(int year, int month, int day){
+  int N1 = 275 * month / 9;
+  int N2 = (month + 9) / 12;
+  int N3 = 1 + (year - 4 * (year / 4) + 2) / 3;
+  return N1 - (N2 * N3) + day - 30;
+}
+
+//  UT hour (0..24) of the event on the given day of the year, -1 if the sun
+//  does not rise or set there that day. Apart from the day of the year the
+//  date doesn't matter, which is what the tables in suntable.h rely on.
+double SunEventUTOnDay(int N, double latitude, double longitude, sunRiseSunset SunEvent){
+  double zenith = 90.83333333333333;
+  double D2R = 3.1415926 / 180;
+  double R2D = 180 / 3.1415926;
+
+  //  2. convert the longitude to hour value and calculate an approximate time
+  double lngHour = longitude / 15;
+
+  double t = 0;
+  switch (SunEvent) {
+    case Sunrise:
+      t = N + ((6 - lngHour) / 24);
+      break;
+    case Sunset:
+      t = N + ((18 - lngHour) / 24);
+      break;
+  }
+
+  //  3. calculate the Sun's mean anomaly
+  double M = (0.9856 * t) - 3.289;
+
+  //  4. calculate the Sun's true longitude
+  double L = M + (1.916 * sin(M * D2R)) + (0.020 * sin(2 * M * D2R)) + 282.634;
+  if (L>360) L-=360;
+  if (L<0) L+=360;
+
+  //  5a. calculate the Sun's right ascension
+  double RA = R2D * atan(0.91764 * tan(L * D2R));
+  if (RA>360) RA-=360;
+  if (RA<0) RA+=360;
+
+  //  5b. right ascension value needs to be in the same quadrant as L
+  double Lquadrant = (floor( L/90)) * 90;
+  double RAquadrant = (floor(RA/90)) * 90;
+  RA = RA + (Lquadrant - RAquadrant);
+
+  //  5c. right ascension value needs to be converted into hours
+  RA = RA / 15;
+
+  //  6. calculate the Sun's declination
+  double sinDec = 0.39782 * sin(L * D2R);
+  double cosDec = cos(asin(sinDec));
+
+  //  7a. calculate the Sun's local hour angle
+  double cosH = (cos(zenith * D2R) - (sinDec * sin(latitude * D2R))) / (cosDec * cos(latitude * D2R));
+
+  if (cosH >  1) return -1;
+  if (cosH < -1) return -1;
+
+  //  7b. finish calculating H and convert into hours
+  double H = 0;
+  switch (SunEvent) {
+    case Sunrise:
+      H = 360 - R2D * acos(cosH);
+      break;
+    case Sunset:
+      H = R2D * acos(cosH);
+      break;
+  }
+  H = H / 15;
+
+  //  8. calculate local mean time of rising/setting
+  double T = H + RA - (0.06571 * t) - 6.622;
+
+  //  9. adjust back to UTC
+  double UT = T - lngHour;
+  if (UT<0) UT +=24;
+  if (UT>24) UT -=24;
+
+  return UT;
+}
+
+double SunEventUT(int year, int month, int day, double latitude, double longitude, sunRiseSunset SunEvent){
+  return SunEventUTOnDay(SunDayOfYear(year, month, day), latitude, longitude, SunEvent);
+}
+
+#endif
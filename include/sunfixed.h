@@ -0,0 +1,209 @@
+/*
+    sunfixed.h - Fixed-point version of the sunrise/sunset algorithm
+
+    Same steps as SunEventUTOnDay() in sun.h, without a single floating
+    point operation, the LX106 has no FPU and every soft-float double
+    operation costs hundreds to thousands of cycles.
+
+    Number formats:
+      angles          int32 binary angles, a full turn is 2^32, so they wrap
+                      around the circle on their own
+      sin, cos, ...   Q30, 1.0 = 2^30
+      days, hours     Q20
+
+    sin/cos and atan2 are CORDIC, acos is atan2(sqrt(1 - c^2), c) and the
+    square root is a bitwise integer one. The result is within a second of
+    the double version, see the "sun" command of the native build.
+
+    On a host with an FPU the double version is faster, the benchmarks
+    (see benchmark.h) print both and the ratio, on the device as well.
+    Speed is not why it is kept, though: it runs once a day, or 732 times
+    when the sun table is built. Without it the firmware calls
+    SunEventUT() and links the soft-float sin, cos, tan, atan, asin and
+    acos. Now only the benchmarks reference it. The integer kernel also
+    gives the same result on the host and on the device.
+*/
+
+#ifndef SUNFIXED_H
+#define SUNFIXED_H
+
+#include <stdint.h>
+#include "sun.h"
+
+#define SUN_Q30_ONE             (1L << 30)
+#define SUN_CORDIC_ITERATIONS   30
+
+//  Compile time conversions of the constants, no floating point at runtime
+#define SUN_DEGREES(x)  ((int32_t)(int64_t)((x) / 360.0 * 4294967296.0 + ((x) >= 0 ? 0.5 : -0.5)))
+#define SUN_Q30(x)      ((int32_t)((x) * 1073741824.0 + ((x) >= 0 ? 0.5 : -0.5)))
+#define SUN_Q20(x)      ((int32_t)((x) * 1048576.0 + ((x) >= 0 ? 0.5 : -0.5)))
+
+#define SUN_NO_EVENT    -1
+
+//  atan(2^-i) as binary angles
+const int32_t sunCordicAngles[SUN_CORDIC_ITERATIONS] = {
+  536870912, 316933406, 167458907, 85004756, 42667331, 21354465, 10679838, 5340245,
+  2670163, 1335087, 667544, 333772, 166886, 83443, 41722, 20861,
+  10430, 5215, 2608, 1304, 652, 326, 163, 81,
+  41, 20, 10, 5, 3, 1
+};
+
+//  1 / CORDIC gain in Q30
+#define SUN_CORDIC_K    652032874
+
+//  sin and cos of a binary angle, Q30
+void SunSinCos(int32_t angle, int32_t &sine, int32_t &cosine){
+  bool negate = false;
+
+  //  Rotate into -90..90 degrees, CORDIC only converges there
+  if (angle > (int32_t)0x40000000 || angle < -(int32_t)0x40000000){
+    angle = (uint32_t)angle + 0x80000000;
+    negate = true;
+  }
+
+  int32_t x = SUN_CORDIC_K;
+  int32_t y = 0;
+
+  for (uint8_t i = 0; i < SUN_CORDIC_ITERATIONS; i++) {
+    int32_t dx = x >> i;
+    int32_t dy = y >> i;
+
+    if (angle >= 0){
+      x -= dy;
+      y += dx;
+      angle -= sunCordicAngles[i];
+    }
+    else{
+      x += dy;
+      y -= dx;
+      angle += sunCordicAngles[i];
+    }
+  }
+
+  sine = negate ? -y : y;
+  cosine = negate ? -x : x;
+}
+
+//  Binary angle of the vector (x, y), |(x, y)| must not exceed 1.0 in Q30
+uint32_t SunAtan2(int32_t y, int32_t x){
+  uint32_t angle = 0;
+
+  //  Into the right half plane first
+  if (x < 0){
+    angle = 0x80000000;
+    x = -x;
+    y = -y;
+  }
+
+  for (uint8_t i = 0; i < SUN_CORDIC_ITERATIONS; i++) {
+    int32_t dx = x >> i;
+    int32_t dy = y >> i;
+
+    if (y > 0){
+      x += dy;
+      y -= dx;
+      angle += sunCordicAngles[i];
+    }
+    else{
+      x -= dy;
+      y += dx;
+      angle -= sunCordicAngles[i];
+    }
+  }
+
+  return angle;
+}
+
+uint32_t SunSqrt64(uint64_t value){
+  uint64_t result = 0;
+  uint64_t bit = 1ULL << 62;
+
+  while (bit > value) bit >>= 2;
+
+  while (bit != 0){
+    if (value >= result + bit){
+      value -= result + bit;
+      result = (result >> 1) + bit;
+    }
+    else
+      result >>= 1;
+    bit >>= 2;
+  }
+
+  return (uint32_t)result;
+}
+
+//  sqrt(1 - c^2), Q30
+int32_t SunComplement(int32_t c){
+  return SunSqrt64(((uint64_t)1 << 60) - (int64_t)c * c);
+}
+
+int32_t SunMulQ30(int32_t a, int32_t b){
+  return ((int64_t)a * b) >> 30;
+}
+
+//  A binary angle as hours (a turn is 24 h), Q20
+int32_t SunAngleToHours(uint32_t angle){
+  return ((uint64_t)angle * 24) >> 12;
+}
+
+//  UT seconds (0..86400) of the event on the given day of the year,
+//  SUN_NO_EVENT if the sun does not rise or set there that day. latitude and
+//  longitude are binary angles, see SUN_DEGREES().
+int32_t SunEventSecondsOnDay(int N, int32_t latitude, int32_t longitude, sunRiseSunset SunEvent){
+  const int32_t cosZenith = SUN_Q30(-0.014543897651582652);    //  cos(90.833 deg)
+
+  //  2. convert the longitude to hour value and calculate an approximate time
+  int32_t lngHour = ((int64_t)longitude * 24) >> 12;
+  int32_t t = ((int32_t)N << 20) + ((SunEvent == Sunrise ? SUN_Q20(6) : SUN_Q20(18)) - lngHour) / 24;
+
+  //  3. calculate the Sun's mean anomaly, unsigned so it wraps around
+  uint32_t M = (uint32_t)(((int64_t)t * SUN_DEGREES(0.9856)) >> 20) - SUN_DEGREES(3.289);
+
+  //  4. calculate the Sun's true longitude
+  int32_t sinM, cosM;
+  SunSinCos(M, sinM, cosM);
+  int32_t sin2M = 2 * SunMulQ30(sinM, cosM);
+
+  uint32_t L = M + SunMulQ30(sinM, SUN_DEGREES(1.916)) + SunMulQ30(sin2M, SUN_DEGREES(0.020)) + SUN_DEGREES(282.634);
+
+  int32_t sinL, cosL;
+  SunSinCos(L, sinL, cosL);
+
+  //  5. calculate the Sun's right ascension, atan2 puts it in the quadrant of L
+  int32_t RA = SunAngleToHours(SunAtan2(SunMulQ30(sinL, SUN_Q30(0.91764)), cosL));
+
+  //  6. calculate the Sun's declination
+  int32_t sinDec = SunMulQ30(sinL, SUN_Q30(0.39782));
+  int32_t cosDec = SunComplement(sinDec);
+
+  //  7a. calculate the Sun's local hour angle
+  int32_t sinLat, cosLat;
+  SunSinCos(latitude, sinLat, cosLat);
+
+  int64_t numerator = cosZenith - SunMulQ30(sinDec, sinLat);
+  int64_t denominator = SunMulQ30(cosDec, cosLat);
+  int64_t cosH = (numerator << 30) / denominator;
+
+  if (cosH > SUN_Q30_ONE || cosH < -SUN_Q30_ONE) return SUN_NO_EVENT;
+
+  //  7b. finish calculating H and convert into hours
+  uint32_t acosH = SunAtan2(SunComplement(cosH), cosH);
+  int32_t H = SunAngleToHours(SunEvent == Sunrise ? (uint32_t)0 - acosH : acosH);
+
+  //  8. calculate local mean time of rising/setting
+  int32_t T = H + RA - (int32_t)(((int64_t)t * SUN_Q30(0.06571)) >> 30) - SUN_Q20(6.622);
+
+  //  9. adjust back to UTC
+  int32_t UT = T - lngHour;
+  while (UT < 0) UT += SUN_Q20(24);
+  while (UT >= SUN_Q20(24)) UT -= SUN_Q20(24);
+
+  return ((int64_t)UT * 3600 + (1 << 19)) >> 20;
+}
+
+int32_t SunEventSeconds(int year, int month, int day, int32_t latitude, int32_t longitude, sunRiseSunset SunEvent){
+  return SunEventSecondsOnDay(SunDayOfYear(year, month, day), latitude, longitude, SunEvent);
+}
+
+#endif
@@ -0,0 +1,122 @@
+/*
+    suntable.h - Precomputed sunrise and sunset times
+
+    The sun events only depend on the day of the year for a fixed location,
+    so they are calculated once for all 366 days and kept as UT minutes in
+    /suntable.bin, together with the location they were made for. The file
+    is rebuilt only if the location changes.
+
+    The table is not kept in RAM, a lookup seeks to its entry and reads the
+    4 bytes of it. It runs once a day when the sun data is refreshed, the
+    file system access costs less than the 1.4 KB the table took in BSS. If
+    the file can't be written the entry is calculated instead.
+
+    The table is built with the fixed-point kernel, no floating point is
+    involved. Minutes are rounded, so a lookup is within 31 s of
+    SunEventUT().
+*/
+
+#ifndef SUNTABLE_H
+#define SUNTABLE_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "sunfixed.h"
+
+#define SUN_TABLE_FILE      "/suntable.bin"
+#define SUN_TABLE_DAYS      366
+#define SUN_TABLE_MAGIC     0x4E555354      //  "TSUN"
+#define SUN_TABLE_NO_EVENT  -1
+
+struct sunTableHeader_t{
+  uint32_t magic;
+  int32_t latitude;             //  Binary angles, see SUN_DEGREES()
+  int32_t longitude;
+};
+
+//  After the header, [day of year - 1][sunRiseSunset] UT minutes
+typedef int16_t sunTableEntry_t[2];
+
+#define SUN_TABLE_FILE_SIZE (sizeof(sunTableHeader_t) + SUN_TABLE_DAYS * sizeof(sunTableEntry_t))
+
+int32_t sunTableLatitude;
+int32_t sunTableLongitude;
+bool sunTableReady = false;     //  SunTableBegin() was called
+bool sunTableCached = false;    //  The file holds the table
+
+int16_t SunTableMinutes(int N, int32_t latitude, int32_t longitude, sunRiseSunset SunEvent){
+  int32_t UT = SunEventSecondsOnDay(N, latitude, longitude, SunEvent);
+  return UT == SUN_NO_EVENT ? SUN_TABLE_NO_EVENT : (UT + 30) / 60;
+}
+
+//  A file cut short, e.g. by a reset, fails SunTableLoad() and is built again
+bool SunTableBuild(const char *path, int32_t latitude, int32_t longitude){
+  sunTableHeader_t header = {SUN_TABLE_MAGIC, latitude, longitude};
+
+  File f = LittleFS.open(path, "w");
+  if (!f) return false;
+
+  bool ok = f.write((const uint8_t*)&header, sizeof(header)) == sizeof(header);
+
+  for (int N = 1; ok && N <= SUN_TABLE_DAYS; N++) {
+    sunTableEntry_t entry;
+
+    for (uint8_t event = Sunrise; event <= Sunset; event++) {
+      entry[event] = SunTableMinutes(N, latitude, longitude, (sunRiseSunset)event);
+    }
+
+    ok = f.write((const uint8_t*)entry, sizeof(entry)) == sizeof(entry);
+  }
+
+  f.close();
+  return ok;
+}
+
+bool SunTableLoad(const char *path, int32_t latitude, int32_t longitude){
+  sunTableHeader_t header;
+
+  File f = LittleFS.open(path, "r");
+  if (!f) return false;
+
+  bool ok = f.size() == SUN_TABLE_FILE_SIZE &&
+            f.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+            header.magic == SUN_TABLE_MAGIC && header.latitude == latitude && header.longitude == longitude;
+  f.close();
+
+  return ok;
+}
+
+//  Checks the cached table, or builds and caches it. Returns false if it had to be built.
+bool SunTableBegin(int32_t latitude, int32_t longitude){
+  sunTableLatitude = latitude;
+  sunTableLongitude = longitude;
+  sunTableReady = true;
+
+  sunTableCached = SunTableLoad(SUN_TABLE_FILE, latitude, longitude);
+  if (sunTableCached) return true;
+
+  sunTableCached = SunTableBuild(SUN_TABLE_FILE, latitude, longitude);
+  return false;
+}
+
+//  UT minutes of the event, SUN_TABLE_NO_EVENT if there is none that day
+int16_t SunTableLookup(int year, int month, int day, sunRiseSunset SunEvent){
+  if (!sunTableReady) return SUN_TABLE_NO_EVENT;
+
+  int N = SunDayOfYear(year, month, day);
+
+  if (sunTableCached){
+    int16_t minutes;
+
+    File f = LittleFS.open(SUN_TABLE_FILE, "r");
+    bool ok = f && f.seek(sizeof(sunTableHeader_t) + (N - 1) * sizeof(sunTableEntry_t) + SunEvent * sizeof(int16_t)) &&
+              f.read((uint8_t*)&minutes, sizeof(minutes)) == sizeof(minutes);
+    if (f) f.close();
+
+    if (ok) return minutes;
+  }
+
+  return SunTableMinutes(N, sunTableLatitude, sunTableLongitude, SunEvent);
+}
+
+#endif
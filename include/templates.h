@@ -0,0 +1,189 @@
+/*
+    templates.h - Cached HTML templates
+
+    The first time a page is served its file is scanned once for %field%
+    placeholders and turned into a list of segments: literal byte ranges of
+    the file and field IDs in between. Rendering then just copies the
+    literal ranges straight from the file and calls the field writer for the
+    placeholders, without reading lines into Strings or searching them.
+
+    A template is parsed again if the size or the last write time of its
+    file changes, so an edited page is picked up even if it kept its size.
+*/
+
+#ifndef TEMPLATES_H
+#define TEMPLATES_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#define TEMPLATE_LITERAL        0xFF
+#define TEMPLATE_MAX_SEGMENTS   64
+#define TEMPLATE_MAX_FIELD_NAME 24
+#define TEMPLATE_BUFFER_SIZE    128
+
+typedef void (*templateFieldWriter_t)(Print &out, uint8_t field);
+
+struct templateSegment_t{
+  uint16_t offset;      //  Position in the file
+  uint16_t length;      //  Bytes in the file, the whole %name% for fields
+  uint8_t field;        //  Field ID or TEMPLATE_LITERAL
+};
+
+struct template_t{
+  const char *path;
+  size_t size;          //  File size the segments were parsed from
+  time_t lastWrite;     //  and its last write time
+  templateSegment_t *segments;
+  uint8_t segmentCount;
+};
+
+const char * const *templateFieldNames = NULL;
+uint8_t templateFieldCount = 0;
+
+//  Placeholders are looked up in this table, the index is the field ID
+void TemplatesBegin(const char * const *fieldNames, uint8_t fieldCount){
+  templateFieldNames = fieldNames;
+  templateFieldCount = fieldCount;
+}
+
+uint8_t FindTemplateField(const char *name){
+  for (uint8_t i = 0; i < templateFieldCount; i++) {
+    if (strcmp(name, templateFieldNames[i]) == 0) return i;
+  }
+  return TEMPLATE_LITERAL;
+}
+
+bool IsTemplateFieldChar(char c){
+  return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '_';
+}
+
+bool AddTemplateSegment(templateSegment_t *segments, uint8_t &count, size_t offset, size_t length, uint8_t field){
+  if (length == 0) return true;
+  if (count >= TEMPLATE_MAX_SEGMENTS) return false;
+
+  segments[count].offset = offset;
+  segments[count].length = length;
+  segments[count].field = field;
+  count++;
+  return true;
+}
+
+//  Scans the file once and stores its segments. Unknown %...% sequences
+//  (e.g. "100%") are kept as literal text.
+bool ParseTemplate(template_t &t, File &f){
+  templateSegment_t segments[TEMPLATE_MAX_SEGMENTS];
+  uint8_t count = 0;
+
+  char name[TEMPLATE_MAX_FIELD_NAME + 1];
+  uint8_t nameLength = 0;
+  long tokenStart = -1;
+  size_t literalStart = 0;
+  size_t position = 0;
+  bool ok = true;
+
+  uint8_t buffer[TEMPLATE_BUFFER_SIZE];
+
+  f.seek(0, SeekSet);
+  while (ok && f.available()){
+    size_t n = f.read(buffer, sizeof(buffer));
+
+    for (size_t i = 0; i < n; i++, position++) {
+      char c = buffer[i];
+
+      if (tokenStart < 0){
+        if (c == '%'){
+          tokenStart = position;
+          nameLength = 0;
+        }
+        continue;
+      }
+
+      if (c == '%'){
+        name[nameLength] = 0;
+        uint8_t field = FindTemplateField(name);
+
+        if (field != TEMPLATE_LITERAL){
+          ok = ok && AddTemplateSegment(segments, count, literalStart, tokenStart - literalStart, TEMPLATE_LITERAL);
+          ok = ok && AddTemplateSegment(segments, count, tokenStart, position - tokenStart + 1, field);
+          literalStart = position + 1;
+          tokenStart = -1;
+        }
+        else{
+          //  Not a field, but this '%' may open one
+          tokenStart = position;
+          nameLength = 0;
+        }
+      }
+      else if (IsTemplateFieldChar(c) && nameLength < TEMPLATE_MAX_FIELD_NAME)
+        name[nameLength++] = c;
+      else
+        tokenStart = -1;
+    }
+  }
+
+  ok = ok && AddTemplateSegment(segments, count, literalStart, position - literalStart, TEMPLATE_LITERAL);
+
+  if (!ok){
+    Serial.printf("Template %s has too many fields.\r\n", t.path);
+    return false;
+  }
+
+  delete[] t.segments;
+  t.segments = new templateSegment_t[count];
+  memcpy(t.segments, segments, count * sizeof(templateSegment_t));
+  t.segmentCount = count;
+  t.size = f.size();
+  t.lastWrite = f.getLastWrite();
+
+  return true;
+}
+
+//  Copies length bytes from the current position of the file
+void CopyFileRange(File &f, Print &out, size_t length){
+  uint8_t buffer[TEMPLATE_BUFFER_SIZE];
+
+  while (length > 0){
+    size_t n = f.read(buffer, length < sizeof(buffer) ? length : sizeof(buffer));
+    if (n == 0) break;
+    out.write(buffer, n);
+    length -= n;
+  }
+}
+
+bool StreamFile(const char *path, Print &out){
+  File f = LittleFS.open(path, "r");
+  if (!f) return false;
+
+  CopyFileRange(f, out, f.size());
+  f.close();
+  return true;
+}
+
+bool RenderTemplate(template_t &t, Print &out, templateFieldWriter_t writer){
+  File f = LittleFS.open(t.path, "r");
+  if (!f) return false;
+
+  if (t.segments == NULL || t.size != f.size() || t.lastWrite != f.getLastWrite()){
+    if (!ParseTemplate(t, f)){
+      f.close();
+      return false;
+    }
+  }
+
+  for (uint8_t i = 0; i < t.segmentCount; i++) {
+    templateSegment_t &s = t.segments[i];
+
+    if (s.field == TEMPLATE_LITERAL){
+      f.seek(s.offset, SeekSet);
+      CopyFileRange(f, out, s.length);
+    }
+    else
+      writer(out, s.field);
+  }
+
+  f.close();
+  return true;
+}
+
+#endif
@@ -0,0 +1,185 @@
+/*
+    timeformat.h - Allocation free date and time formatting
+
+    Everything is written into caller provided buffers (or straight into a
+    Print) digit by digit, without String, printf or TimeLib's breakTime().
+    The calendar conversion is the days-from-civil algorithm of Howard
+    Hinnant, valid for the whole range of time_t.
+
+    The Format...() functions return the length written, or 0 (and an empty
+    string) if the buffer is too small.
+*/
+
+#ifndef TIMEFORMAT_H
+#define TIMEFORMAT_H
+
+#include <Arduino.h>
+#include <time.h>
+
+#define DATETIME_LENGTH     20      //  YYYY-MM-DDThh:mm:ss
+#define TIME_LENGTH         9       //  hh:mm:ss
+#define INTERVAL_LENGTH     16      //  h:mm:ss, hours up to 10 digits
+#define DURATION_LENGTH     24      //  P49710DT6H28M15S
+
+struct dateTime_t{
+  int32_t year;
+  uint8_t month;
+  uint8_t day;
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t second;
+};
+
+void SplitDateTime(time_t time, dateTime_t &dt){
+  int64_t t = time;
+  int64_t days = t / 86400;
+  int32_t seconds = t % 86400;
+
+  if (seconds < 0){
+    seconds += 86400;
+    days--;
+  }
+
+  dt.hour = seconds / 3600;
+  dt.minute = seconds / 60 % 60;
+  dt.second = seconds % 60;
+
+  //  civil_from_days(), eras of 400 years starting on March 1st
+  days += 719468;
+  int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+  uint32_t dayOfEra = days - era * 146097;
+  uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+  uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+  uint32_t monthIndex = (5 * dayOfYear + 2) / 153;
+
+  dt.day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+  dt.month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+  dt.year = yearOfEra + era * 400 + (dt.month <= 2);
+}
+
+//  Writes value with at least width digits, returns the end of the number
+char *FormatDigits(char *p, uint32_t value, uint8_t width){
+  char digits[10];
+  uint8_t count = 0;
+
+  do {
+    digits[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+
+  while (count < width) digits[count++] = '0';
+  while (count > 0) *p++ = digits[--count];
+
+  return p;
+}
+
+uint8_t CountDigits(uint32_t value){
+  uint8_t count = 1;
+  while (value >= 10){
+    value /= 10;
+    count++;
+  }
+  return count;
+}
+
+size_t FormatFailed(char *buffer, size_t size){
+  if (size > 0) buffer[0] = 0;
+  return 0;
+}
+
+//  YYYY-MM-DDThh:mm:ss, separator can be ' ' for display
+size_t FormatDateTime(char *buffer, size_t size, time_t time, char separator = 'T'){
+  dateTime_t dt;
+  SplitDateTime(time, dt);
+
+  if (dt.year < 0 || size < (size_t)(DATETIME_LENGTH - 4 + CountDigits(dt.year))) return FormatFailed(buffer, size);
+
+  char *p = FormatDigits(buffer, dt.year, 4);
+  *p++ = '-';
+  p = FormatDigits(p, dt.month, 2);
+  *p++ = '-';
+  p = FormatDigits(p, dt.day, 2);
+  *p++ = separator;
+  p = FormatDigits(p, dt.hour, 2);
+  *p++ = ':';
+  p = FormatDigits(p, dt.minute, 2);
+  *p++ = ':';
+  p = FormatDigits(p, dt.second, 2);
+  *p = 0;
+
+  return p - buffer;
+}
+
+//  hh:mm:ss of the day
+size_t FormatTime(char *buffer, size_t size, time_t time){
+  dateTime_t dt;
+  SplitDateTime(time, dt);
+
+  if (size < TIME_LENGTH) return FormatFailed(buffer, size);
+
+  char *p = FormatDigits(buffer, dt.hour, 2);
+  *p++ = ':';
+  p = FormatDigits(p, dt.minute, 2);
+  *p++ = ':';
+  p = FormatDigits(p, dt.second, 2);
+  *p = 0;
+
+  return p - buffer;
+}
+
+//  h:mm:ss, the hours are not wrapped into days
+size_t FormatInterval(char *buffer, size_t size, uint32_t seconds){
+  uint32_t hours = seconds / 3600;
+
+  if (size < (size_t)(TIME_LENGTH - 2 + CountDigits(hours))) return FormatFailed(buffer, size);
+
+  char *p = FormatDigits(buffer, hours, 1);
+  *p++ = ':';
+  p = FormatDigits(p, seconds / 60 % 60, 2);
+  *p++ = ':';
+  p = FormatDigits(p, seconds % 60, 2);
+  *p = 0;
+
+  return p - buffer;
+}
+
+//  ISO-8601 duration, e.g. P1DT2H0M5S or PT0S, zero days are left out
+size_t FormatDuration(char *buffer, size_t size, uint32_t seconds){
+  if (size < DURATION_LENGTH) return FormatFailed(buffer, size);
+
+  uint32_t days = seconds / 86400;
+  char *p = buffer;
+
+  *p++ = 'P';
+  if (days > 0){
+    p = FormatDigits(p, days, 1);
+    *p++ = 'D';
+  }
+  *p++ = 'T';
+
+  if (seconds >= 3600){
+    p = FormatDigits(p, seconds / 3600 % 24, 1);
+    *p++ = 'H';
+  }
+  if (seconds >= 60){
+    p = FormatDigits(p, seconds / 60 % 60, 1);
+    *p++ = 'M';
+  }
+  p = FormatDigits(p, seconds % 60, 1);
+  *p++ = 'S';
+  *p = 0;
+
+  return p - buffer;
+}
+
+size_t PrintDateTime(Print &out, time_t time, char separator = 'T'){
+  char buffer[DATETIME_LENGTH + 8];
+  return out.write((const uint8_t*)buffer, FormatDateTime(buffer, sizeof(buffer), time, separator));
+}
+
+size_t PrintInterval(Print &out, uint32_t seconds){
+  char buffer[INTERVAL_LENGTH];
+  return out.write((const uint8_t*)buffer, FormatInterval(buffer, sizeof(buffer), seconds));
+}
+
+#endif
@@ -0,0 +1,174 @@
+/*
+    zones.h - Auto-off timers for the relay channels
+
+    Every relay channel (zone) can have its own auto-off duration and
+    retrigger policy. Instead of one OS timer per channel, the deadlines of
+    the running zones are kept in a binary min-heap, so ZonesRun() only has
+    to look at the top of the heap no matter how many zones are configured.
+*/
+
+#ifndef ZONES_H
+#define ZONES_H
+
+#include <Arduino.h>
+
+#define ZONE_NOT_QUEUED -1
+
+typedef void (*zoneExpiredHandler_t)(uint8_t channel);
+
+struct zone_t{
+  unsigned long duration;       //  ms, 0 = no auto-off
+  RETRIGGER_POLICY policy;
+  unsigned long deadline;       //  millis() the zone switches off at
+  int8_t heapIndex;             //  Position in zoneHeap, ZONE_NOT_QUEUED if not running
+};
+
+zone_t zones[RELAY_COUNT];
+uint8_t zoneHeap[RELAY_COUNT];
+uint8_t zoneHeapSize = 0;
+zoneExpiredHandler_t zoneExpiredHandler = NULL;
+
+//  millis() safe "a is due before b"
+bool ZoneBefore(uint8_t a, uint8_t b){
+  return (long)(zones[a].deadline - zones[b].deadline) < 0;
+}
+
+void ZoneHeapSwap(uint8_t i, uint8_t j){
+  uint8_t channel = zoneHeap[i];
+  zoneHeap[i] = zoneHeap[j];
+  zoneHeap[j] = channel;
+
+  zones[zoneHeap[i]].heapIndex = i;
+  zones[zoneHeap[j]].heapIndex = j;
+}
+
+void ZoneSiftUp(uint8_t i){
+  while (i > 0){
+    uint8_t parent = (i - 1) / 2;
+    if (!ZoneBefore(zoneHeap[i], zoneHeap[parent])) break;
+    ZoneHeapSwap(i, parent);
+    i = parent;
+  }
+}
+
+void ZoneSiftDown(uint8_t i){
+  while (true){
+    uint8_t smallest = i;
+    uint8_t left = 2 * i + 1;
+    uint8_t right = 2 * i + 2;
+
+    if (left < zoneHeapSize && ZoneBefore(zoneHeap[left], zoneHeap[smallest])) smallest = left;
+    if (right < zoneHeapSize && ZoneBefore(zoneHeap[right], zoneHeap[smallest])) smallest = right;
+    if (smallest == i) break;
+
+    ZoneHeapSwap(i, smallest);
+    i = smallest;
+  }
+}
+
+//  Sets a new deadline and puts the zone to its place in the heap
+void ZoneSchedule(uint8_t channel, unsigned long deadline){
+  zone_t &z = zones[channel];
+  z.deadline = deadline;
+
+  if (z.heapIndex == ZONE_NOT_QUEUED){
+    z.heapIndex = zoneHeapSize;
+    zoneHeap[zoneHeapSize++] = channel;
+  }
+
+  ZoneSiftUp(z.heapIndex);
+  ZoneSiftDown(z.heapIndex);
+}
+
+void ZonesBegin(zoneExpiredHandler_t handler){
+  zoneExpiredHandler = handler;
+  zoneHeapSize = 0;
+
+  for (uint8_t i = 0; i < RELAY_COUNT; i++) {
+    zones[i].duration = 0;
+    zones[i].policy = RETRIGGER_RESTART;
+    zones[i].heapIndex = ZONE_NOT_QUEUED;
+  }
+}
+
+void ZoneConfigure(uint8_t channel, unsigned long duration, RETRIGGER_POLICY policy){
+  if (channel >= RELAY_COUNT) return;
+
+  zones[channel].duration = duration;
+  zones[channel].policy = policy;
+}
+
+bool ZoneIsRunning(uint8_t channel){
+  return channel < RELAY_COUNT && zones[channel].heapIndex != ZONE_NOT_QUEUED;
+}
+
+//  ms left until the zone switches off, 0 if it is not running
+unsigned long ZoneRemaining(uint8_t channel){
+  if (!ZoneIsRunning(channel)) return 0;
+
+  long remaining = zones[channel].deadline - millis();
+  return remaining > 0 ? remaining : 0;
+}
+
+void ZoneCancel(uint8_t channel){
+  if (!ZoneIsRunning(channel)) return;
+
+  uint8_t i = zones[channel].heapIndex;
+  zoneHeapSize--;
+
+  if (i != zoneHeapSize){
+    ZoneHeapSwap(i, zoneHeapSize);
+    ZoneSiftUp(i);
+    ZoneSiftDown(i);
+  }
+
+  zones[channel].heapIndex = ZONE_NOT_QUEUED;
+}
+
+//  Starts the zone's timer, or applies its retrigger policy if it is already
+//  running. Returns false if the zone has no auto-off.
+bool ZoneTrigger(uint8_t channel){
+  if (channel >= RELAY_COUNT || zones[channel].duration == 0) return false;
+
+  zone_t &z = zones[channel];
+
+  if (!ZoneIsRunning(channel)){
+    ZoneSchedule(channel, millis() + z.duration);
+    return true;
+  }
+
+  switch (z.policy) {
+    case RETRIGGER_RESTART:
+      ZoneSchedule(channel, millis() + z.duration);
+      break;
+    case RETRIGGER_EXTEND:
+      ZoneSchedule(channel, z.deadline + z.duration);
+      break;
+    case RETRIGGER_IGNORE:
+      break;
+  }
+
+  return true;
+}
+
+//  Adds another duration to a running zone regardless of its policy
+bool ZoneExtend(uint8_t channel){
+  if (!ZoneIsRunning(channel)) return ZoneTrigger(channel);
+
+  ZoneSchedule(channel, zones[channel].deadline + zones[channel].duration);
+  return true;
+}
+
+//  Expires every zone whose deadline has passed, cheap enough for every tick
+void ZonesRun(){
+  while (zoneHeapSize > 0){
+    uint8_t channel = zoneHeap[0];
+
+    if ((long)(millis() - zones[channel].deadline) < 0) break;
+
+    ZoneCancel(channel);
+    if (zoneExpiredHandler != NULL) zoneExpiredHandler(channel);
+  }
+}
+
+#endif
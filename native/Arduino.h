@@ -0,0 +1,319 @@
+/*
+    Arduino.h - Host implementation of the Arduino core subset used by the
+    firmware logic
+
+    Together with the other headers in this directory it forms the hardware
+    abstraction layer of the native build: the firmware modules keep calling
+    the Arduino API (millis(), Print, PCF857x, LittleFS, PubSubClient,
+    ESP8266WebServer, WiFiUDP, the lwIP resolver, String) and get these fakes instead of the ESP8266 libraries.
+
+    Time is virtual. It only moves when HalAdvance() (or delay()) is called,
+    so a run on the host is deterministic.
+
+    Unlike the firmware headers everything here is inline: the Time library
+    includes this header from its own translation units.
+*/
+
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <limits.h>
+#include <strings.h>
+#include <time.h>
+#include <WString.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+#define PROGMEM
+
+#define LOW           0
+#define HIGH          1
+#define INPUT         0x00
+#define OUTPUT        0x01
+#define INPUT_PULLUP  0x02
+
+#define RISING        0x01
+#define FALLING       0x02
+#define CHANGE        0x03
+
+#define DEC 10
+#define HEX 16
+
+#define HAL_PIN_COUNT 17
+
+//  Virtual clock
+
+inline uint64_t halClock = 0;          //  us since boot
+
+inline unsigned long millis(){
+  return (unsigned long)(halClock / 1000);
+}
+
+inline unsigned long micros(){
+  return (unsigned long)halClock;
+}
+
+inline void HalAdvanceMicros(uint64_t us);
+
+inline void HalAdvance(unsigned long ms){
+  HalAdvanceMicros((uint64_t)ms * 1000);
+}
+
+inline void delay(unsigned long ms){
+  HalAdvance(ms);
+}
+
+inline void delayMicroseconds(unsigned int us){
+  HalAdvanceMicros(us);
+}
+
+inline void yield(){
+}
+
+//  CPU cycles (time stamp counter where there is one), for the benchmarks
+inline uint64_t HalCycles(){
+  #if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+  #else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+  #endif
+}
+
+//  ESP, the chip figures the reports carry. HalSetHeap() sets the heap
+//  figures, the native build's own accounting is in heap.h.
+class EspClass {
+  public:
+    uint32_t getFreeHeap() { return freeHeap; }
+    uint32_t getMaxFreeBlockSize() { return maxFreeBlock; }
+    uint8_t getHeapFragmentation() { return fragmentation; }
+    uint32_t getChipId() { return 0; }
+    uint32_t getCycleCount() { return (uint32_t)HalCycles(); }
+
+    void HalSetHeap(uint32_t free, uint32_t maxBlock, uint8_t fragmentation) {
+      freeHeap = free;
+      maxFreeBlock = maxBlock;
+      this->fragmentation = fragmentation;
+    }
+
+  private:
+    uint32_t freeHeap = 40000;
+    uint32_t maxFreeBlock = 30000;
+    uint8_t fragmentation = 10;
+};
+
+inline EspClass ESP;
+
+//  GPIO
+
+typedef void (*halInterruptHandler_t)();
+
+inline uint8_t halPinLevels[HAL_PIN_COUNT];
+inline halInterruptHandler_t halInterruptHandlers[HAL_PIN_COUNT];
+inline uint8_t halInterruptModes[HAL_PIN_COUNT];
+
+inline void pinMode(uint8_t pin, uint8_t mode){
+  if (pin < HAL_PIN_COUNT && mode == INPUT_PULLUP) halPinLevels[pin] = HIGH;
+}
+
+inline int digitalRead(uint8_t pin){
+  return pin < HAL_PIN_COUNT ? halPinLevels[pin] : LOW;
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t level){
+  if (pin < HAL_PIN_COUNT) halPinLevels[pin] = level;
+}
+
+inline int digitalPinToInterrupt(uint8_t pin){
+  return pin;
+}
+
+inline void attachInterrupt(uint8_t pin, halInterruptHandler_t handler, int mode){
+  if (pin >= HAL_PIN_COUNT) return;
+
+  halInterruptHandlers[pin] = handler;
+  halInterruptModes[pin] = mode;
+}
+
+inline void noInterrupts(){
+}
+
+inline void interrupts(){
+}
+
+//  Drives an input pin from the outside and fires its interrupt handler
+inline void HalSetPin(uint8_t pin, uint8_t level){
+  if (pin >= HAL_PIN_COUNT || halPinLevels[pin] == level) return;
+
+  halPinLevels[pin] = level;
+
+  uint8_t edge = level ? RISING : FALLING;
+  if (halInterruptHandlers[pin] != NULL && (halInterruptModes[pin] & edge))
+    halInterruptHandlers[pin]();
+}
+
+//  Called for every clock step, e.g. to replay scheduled input changes or
+//  to deliver the answers of the fake network
+typedef void (*halClockHook_t)(uint64_t now);
+
+#define HAL_MAX_CLOCK_HOOKS 8
+
+inline halClockHook_t halClockHooks[HAL_MAX_CLOCK_HOOKS];
+inline uint8_t halClockHookCount = 0;
+
+inline void HalAddClockHook(halClockHook_t hook){
+  for (uint8_t i = 0; i < halClockHookCount; i++) {
+    if (halClockHooks[i] == hook) return;
+  }
+
+  if (halClockHookCount < HAL_MAX_CLOCK_HOOKS) halClockHooks[halClockHookCount++] = hook;
+}
+
+inline void HalAdvanceMicros(uint64_t us){
+  halClock += us;
+
+  for (uint8_t i = 0; i < halClockHookCount; i++) halClockHooks[i](halClock);
+}
+
+//  Print
+
+class Print;
+
+class Printable {
+  public:
+    virtual ~Printable() {}
+    virtual size_t printTo(Print &p) const = 0;
+};
+
+class Print {
+  public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) = 0;
+
+    virtual size_t write(const uint8_t *buffer, size_t size){
+      size_t n = 0;
+      while (size--) n += write(*buffer++);
+      return n;
+    }
+
+    size_t write(const char *s){
+      return s == NULL ? 0 : write((const uint8_t*)s, strlen(s));
+    }
+
+    size_t write(const char *buffer, size_t size){
+      return write((const uint8_t*)buffer, size);
+    }
+
+    virtual void flush() {}
+
+    size_t printf(const char *format, ...){
+      char buffer[256];
+      va_list args;
+
+      va_start(args, format);
+      int length = vsnprintf(buffer, sizeof(buffer), format, args);
+      va_end(args);
+
+      if (length < 0) return 0;
+      return write((const uint8_t*)buffer, (size_t)length < sizeof(buffer) ? length : sizeof(buffer) - 1);
+    }
+
+    size_t print(const char *s)         { return write(s); }
+    size_t print(char c)                { return write((uint8_t)c); }
+    size_t print(int n)                 { return printf("%d", n); }
+    size_t print(unsigned int n)        { return printf("%u", n); }
+    size_t print(long n)                { return printf("%ld", n); }
+    size_t print(unsigned long n)       { return printf("%lu", n); }
+    size_t print(long long n)           { return printf("%lld", n); }
+    size_t print(unsigned long long n)  { return printf("%llu", n); }
+    size_t print(double n, int digits = 2) { return printf("%.*f", digits, n); }
+    size_t print(const Printable &p)    { return p.printTo(*this); }
+
+    size_t println()                    { return write("\r\n"); }
+
+    template<typename T>
+    size_t println(T value){
+      size_t n = print(value);
+      return n + println();
+    }
+};
+
+//  Serial goes to stdout
+
+class HalSerial : public Print {
+  public:
+    void begin(unsigned long speed) {}
+    void setDebugOutput(bool enabled) {}
+
+    size_t write(uint8_t c) override {
+      return fputc(c, stdout) == EOF ? 0 : 1;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) override {
+      return fwrite(buffer, 1, size, stdout);
+    }
+
+    using Print::write;
+};
+
+inline HalSerial Serial;
+
+//  Non-standard libc helpers of the Arduino core
+
+inline char *ultoa(unsigned long value, char *buffer, int base){
+  char digits[33];
+  int i = 0;
+
+  do {
+    digits[i++] = "0123456789abcdefghijklmnopqrstuvwxyz"[value % base];
+    value /= base;
+  } while (value);
+
+  for (int j = 0; j < i; j++) buffer[j] = digits[i - 1 - j];
+  buffer[i] = 0;
+  return buffer;
+}
+
+inline char *ltoa(long value, char *buffer, int base){
+  if (value < 0 && base == 10){
+    buffer[0] = '-';
+    ultoa(-value, buffer + 1, base);
+    return buffer;
+  }
+  return ultoa((unsigned long)value, buffer, base);
+}
+
+inline char *itoa(int value, char *buffer, int base){
+  return ltoa(value, buffer, base);
+}
+
+inline char *utoa(unsigned int value, char *buffer, int base){
+  return ultoa(value, buffer, base);
+}
+
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+inline size_t strlcpy(char *dst, const char *src, size_t size){
+  size_t length = strlen(src);
+
+  if (size){
+    size_t n = length < size - 1 ? length : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = 0;
+  }
+  return length;
+}
+#endif
+
+#endif
@@ -0,0 +1,61 @@
+/*
+    ESP8266WebServer.h - Fake web server
+
+    Collects what a handler sends into a response record instead of a
+    socket, enough for the page rendering code to run on the host.
+*/
+
+#ifndef NATIVE_ESP8266WEBSERVER_H
+#define NATIVE_ESP8266WEBSERVER_H
+
+#include <Arduino.h>
+#include <string>
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+#define CONTENT_LENGTH_NOT_SET ((size_t) -2)
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+
+class ESP8266WebServer {
+  public:
+    ESP8266WebServer(int port = 80) {}
+
+    void begin() {}
+    void handleClient() {}
+
+    void setContentLength(size_t length) { contentLength = length; }
+
+    void sendHeader(const char *name, const char *value, bool first = false) { headers++; }
+
+    void send(int code, const char *contentType = NULL, const char *content = "") {
+      status = code;
+      body = content;
+    }
+
+    void sendContent(const char *content, size_t size) {
+      body.append(content, size);
+      if (size) chunks++;
+    }
+
+    void sendContent(const char *content) {
+      sendContent(content, strlen(content));
+    }
+
+    //  Fake side
+
+    void HalReset() {
+      status = 0;
+      headers = 0;
+      chunks = 0;
+      contentLength = CONTENT_LENGTH_NOT_SET;
+      body.clear();
+    }
+
+    int status = 0;
+    unsigned int headers = 0;
+    unsigned int chunks = 0;
+    size_t contentLength = CONTENT_LENGTH_NOT_SET;
+    std::string body;
+};
+
+#endif
@@ -0,0 +1,60 @@
+/*
+    ESP8266WiFi.h - Fake of the parts of the ESP8266 WiFi library the
+    network modules use: IPAddress and the timeout of WiFiClient, which
+    the fake PubSubClient waits for when the broker is unreachable
+*/
+
+#ifndef NATIVE_ESP8266WIFI_H
+#define NATIVE_ESP8266WIFI_H
+
+#include <Arduino.h>
+#include <lwip/dns.h>
+
+class IPAddress : public Printable {
+  public:
+    IPAddress() {}
+
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+      bytes[0] = a;
+      bytes[1] = b;
+      bytes[2] = c;
+      bytes[3] = d;
+    }
+
+    IPAddress(const ip_addr_t *address) { memcpy(bytes, &address->addr, 4); }
+
+    bool fromString(const char *address) {
+      unsigned int a, b, c, d;
+      char rest;
+
+      if (sscanf(address, "%u.%u.%u.%u%c", &a, &b, &c, &d, &rest) != 4 || a > 255 || b > 255 || c > 255 || d > 255) return false;
+
+      *this = IPAddress(a, b, c, d);
+      return true;
+    }
+
+    bool isSet() const { return bytes[0] || bytes[1] || bytes[2] || bytes[3]; }
+
+    bool operator==(const IPAddress &other) const { return memcmp(bytes, other.bytes, 4) == 0; }
+    bool operator!=(const IPAddress &other) const { return !(*this == other); }
+
+    uint8_t operator[](int index) const { return bytes[index]; }
+
+    size_t printTo(Print &p) const override {
+      return p.printf("%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+    }
+
+  private:
+    uint8_t bytes[4] = {0, 0, 0, 0};
+};
+
+class WiFiClient {
+  public:
+    void setTimeout(unsigned long timeout) { this->timeout = timeout; }
+    unsigned long getTimeout() const { return timeout; }
+
+  private:
+    unsigned long timeout = 1000;       //  ms, the Stream default
+};
+
+#endif
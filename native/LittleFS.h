@@ -0,0 +1,163 @@
+/*
+    LittleFS.h - Host file system backed by a directory
+
+    Paths are resolved under the root passed to HalSetRoot() ("data" by
+    default), so the native build reads the same files that are uploaded
+    to the device.
+*/
+
+#ifndef NATIVE_LITTLEFS_H
+#define NATIVE_LITTLEFS_H
+
+#include <Arduino.h>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HAL_MAX_PATH 256
+
+enum SeekMode {
+  SeekSet = 0,
+  SeekCur = 1,
+  SeekEnd = 2
+};
+
+class File : public Print {
+  public:
+    File() {}
+    File(FILE *f, const char *path) : file(f, fclose) {
+      strncpy(fileName, path, sizeof(fileName) - 1);
+    }
+
+    operator bool() const { return (bool)file; }
+
+    size_t write(uint8_t c) override {
+      return file && fputc(c, file.get()) != EOF ? 1 : 0;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) override {
+      return file ? fwrite(buffer, 1, size, file.get()) : 0;
+    }
+
+    using Print::write;
+
+    int read() {
+      return file ? fgetc(file.get()) : -1;
+    }
+
+    size_t read(uint8_t *buffer, size_t size) {
+      return file ? fread(buffer, 1, size, file.get()) : 0;
+    }
+
+    size_t readBytes(char *buffer, size_t size) {
+      return read((uint8_t*)buffer, size);
+    }
+
+    //  Stream's String readers, one character at a time like the core
+    String readStringUntil(char terminator) {
+      String s;
+      int c;
+      while ((c = read()) >= 0 && c != terminator) s += (char)c;
+      return s;
+    }
+
+    String readString() {
+      String s;
+      int c;
+      while ((c = read()) >= 0) s += (char)c;
+      return s;
+    }
+
+    bool seek(uint32_t position, SeekMode mode = SeekSet) {
+      return file && fseek(file.get(), position, mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END) == 0;
+    }
+
+    size_t position() const {
+      return file ? ftell(file.get()) : 0;
+    }
+
+    size_t size() const {
+      struct stat st;
+      if (!file) return 0;
+      fflush(file.get());
+      return fstat(fileno(file.get()), &st) == 0 ? st.st_size : 0;
+    }
+
+    time_t getLastWrite() const {
+      struct stat st;
+      if (!file) return 0;
+      fflush(file.get());
+      return fstat(fileno(file.get()), &st) == 0 ? st.st_mtime : 0;
+    }
+
+    int available() {
+      return file ? size() - position() : 0;
+    }
+
+    void flush() override {
+      if (file) fflush(file.get());
+    }
+
+    void close() {
+      file.reset();
+    }
+
+    const char *name() const {
+      const char *slash = strrchr(fileName, '/');
+      return slash ? slash + 1 : fileName;
+    }
+
+  private:
+    std::shared_ptr<FILE> file;
+    char fileName[HAL_MAX_PATH] = "";
+};
+
+class FS {
+  public:
+    bool begin() { return true; }
+    void end() {}
+
+    void HalSetRoot(const char *path) {
+      strncpy(root, path, sizeof(root) - 1);
+    }
+
+    File open(const char *path, const char *mode) {
+      char fullPath[HAL_MAX_PATH];
+      Resolve(path, fullPath);
+
+      //  "w" and "a" are the only write modes of the real FS
+      FILE *f = fopen(fullPath, mode[0] == 'r' ? "rb" : mode[0] == 'a' ? "ab+" : "wb+");
+      return f ? File(f, path) : File();
+    }
+
+    bool exists(const char *path) {
+      char fullPath[HAL_MAX_PATH];
+      struct stat st;
+      return stat(Resolve(path, fullPath), &st) == 0;
+    }
+
+    bool remove(const char *path) {
+      char fullPath[HAL_MAX_PATH];
+      return ::remove(Resolve(path, fullPath)) == 0;
+    }
+
+    bool rename(const char *from, const char *to) {
+      char fromPath[HAL_MAX_PATH];
+      char toPath[HAL_MAX_PATH];
+      return ::rename(Resolve(from, fromPath), Resolve(to, toPath)) == 0;
+    }
+
+  private:
+    const char *Resolve(const char *path, char *fullPath) {
+      //  A path that doesn't fit resolves to nothing, so it can't be opened
+      int length = snprintf(fullPath, HAL_MAX_PATH, "%s%s%s", root, path[0] == '/' ? "" : "/", path);
+      if (length < 0 || length >= HAL_MAX_PATH) fullPath[0] = 0;
+      return fullPath;
+    }
+
+    char root[HAL_MAX_PATH] = "data";
+};
+
+FS LittleFS;
+
+#endif
@@ -0,0 +1,145 @@
+/*
+    PubSubClient.h - Fake MQTT client
+
+    Every publish is counted and handed to the broker hook, incoming
+    messages can be injected with HalDeliver(). A message streamed with
+    beginPublish() is handed over by endPublish(), if it had the length
+    announced.
+
+    While the broker is unavailable connect() fails after the timeout of
+    the WiFiClient has passed on the virtual clock, like the TCP connect
+    of the real client blocks. The clock advances in 1 ms steps, the way
+    the core waits for the connection, so the recurrent functions of
+    Schedule.h keep running meanwhile.
+*/
+
+#ifndef NATIVE_PUBSUBCLIENT_H
+#define NATIVE_PUBSUBCLIENT_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#define MQTT_MAX_PACKET_SIZE 256
+
+#define MQTT_CONNECTION_TIMEOUT     -4
+#define MQTT_CONNECTION_LOST        -3
+#define MQTT_CONNECT_FAILED         -2
+#define MQTT_DISCONNECTED           -1
+#define MQTT_CONNECTED               0
+
+typedef void (*mqttCallback_t)(char *topic, uint8_t *payload, unsigned int length);
+typedef void (*halBrokerHook_t)(const char *topic, const char *payload, bool retained);
+
+class PubSubClient : public Print {
+  public:
+    PubSubClient() {}
+    PubSubClient(WiFiClient &client) : network(&client) {}
+
+    PubSubClient &setServer(const char *domain, uint16_t port) { return *this; }
+    PubSubClient &setServer(IPAddress ip, uint16_t port) { return *this; }
+    PubSubClient &setSocketTimeout(uint16_t timeout) { return *this; }
+    PubSubClient &setCallback(mqttCallback_t callback) { this->callback = callback; return *this; }
+    bool setBufferSize(uint16_t size) { return true; }
+
+    bool connect(const char *id) {
+      connectAttempts++;
+      if (!brokerAvailable && network != NULL){
+        for (unsigned long waited = 0; waited < network->getTimeout(); waited++) HalAdvance(1);
+      }
+
+      isConnected = brokerAvailable;
+      return isConnected;
+    }
+
+    bool connect(const char *id, const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage) {
+      return connect(id);
+    }
+
+    bool connect(const char *id, const char *user, const char *password) {
+      return connect(id);
+    }
+
+    void disconnect() { isConnected = false; }
+
+    bool connected() { return isConnected; }
+
+    int state() { return isConnected ? MQTT_CONNECTED : MQTT_DISCONNECTED; }
+
+    bool loop() { return isConnected; }
+
+    bool subscribe(const char *topic) { return isConnected; }
+
+    bool publish(const char *topic, const char *payload, bool retained = false) {
+      if (!isConnected) return false;
+
+      publishes++;
+      if (brokerHook != NULL) brokerHook(topic, payload, retained);
+      return true;
+    }
+
+    bool beginPublish(const char *topic, unsigned int length, bool retained) {
+      if (!isConnected) return false;
+
+      streamTopic = topic;
+      streamPayload = "";
+      streamLength = length;
+      streamRetained = retained;
+      streaming = true;
+      return true;
+    }
+
+    size_t write(uint8_t c) override {
+      if (!streaming) return 0;
+
+      streamPayload += (char)c;
+      return 1;
+    }
+
+    using Print::write;
+
+    int endPublish() {
+      if (!streaming) return 0;
+
+      streaming = false;
+      if (streamPayload.length() != streamLength) return 0;
+
+      return publish(streamTopic.c_str(), streamPayload.c_str(), streamRetained);
+    }
+
+    //  Fake side
+
+    void HalSetBrokerAvailable(bool available) {
+      brokerAvailable = available;
+      if (!available) isConnected = false;
+    }
+
+    void HalSetBrokerHook(halBrokerHook_t hook) { brokerHook = hook; }
+
+    //  Delivers a message as if it arrived from the broker
+    void HalDeliver(const char *topic, const char *payload) {
+      if (callback == NULL) return;
+
+      char topicBuffer[MQTT_MAX_PACKET_SIZE];
+      strncpy(topicBuffer, topic, sizeof(topicBuffer) - 1);
+      topicBuffer[sizeof(topicBuffer) - 1] = 0;
+      callback(topicBuffer, (uint8_t*)payload, strlen(payload));
+    }
+
+    unsigned long publishes = 0;
+    unsigned long connectAttempts = 0;
+
+  private:
+    WiFiClient *network = NULL;
+    bool brokerAvailable = true;
+    bool isConnected = false;
+    mqttCallback_t callback = NULL;
+    halBrokerHook_t brokerHook = NULL;
+
+    bool streaming = false;
+    String streamTopic;
+    String streamPayload;
+    unsigned int streamLength = 0;
+    bool streamRetained = false;
+};
+
+#endif
@@ -0,0 +1,55 @@
+/*
+    Schedule.h - Fake of the ESP8266 core's recurrent scheduled functions
+
+    The core calls them from every yield() and delay(), also while a
+    library blocks in one, and after each loop(). Here they run from a
+    clock hook, so they also run while a fake blocks by advancing the
+    clock in small steps, like PubSubClient's connect() does.
+*/
+
+#ifndef NATIVE_SCHEDULE_H
+#define NATIVE_SCHEDULE_H
+
+#include <Arduino.h>
+#include <functional>
+
+#define HAL_MAX_RECURRENT_FUNCTIONS 4
+
+struct halRecurrentFunction_t{
+  std::function<bool(void)> function;
+  uint32_t interval;            //  us
+  uint64_t dueAt;
+};
+
+halRecurrentFunction_t halRecurrentFunctions[HAL_MAX_RECURRENT_FUNCTIONS];
+uint8_t halRecurrentFunctionCount = 0;
+
+//  Clock hook, runs the functions that are due. One that returns false is removed.
+void HalRunRecurrentFunctions(uint64_t now){
+  for (uint8_t i = 0; i < halRecurrentFunctionCount; ) {
+    halRecurrentFunction_t &f = halRecurrentFunctions[i];
+
+    if (now < f.dueAt){
+      i++;
+      continue;
+    }
+
+    f.dueAt = now + f.interval;
+    if (f.function()){
+      i++;
+      continue;
+    }
+
+    halRecurrentFunctions[i] = halRecurrentFunctions[--halRecurrentFunctionCount];
+  }
+}
+
+bool schedule_recurrent_function_us(const std::function<bool(void)> &fn, uint32_t repeat_us, const std::function<bool(void)> &alarm = nullptr){
+  if (halRecurrentFunctionCount >= HAL_MAX_RECURRENT_FUNCTIONS) return false;
+
+  halRecurrentFunctions[halRecurrentFunctionCount++] = {fn, repeat_us, halClock + repeat_us};
+  HalAddClockHook(HalRunRecurrentFunctions);
+  return true;
+}
+
+#endif
@@ -0,0 +1,2 @@
+//  Pre-1.0 Arduino header, included by the Time library when ARDUINO is not defined
+#include <Arduino.h>
@@ -0,0 +1,138 @@
+/*
+    WString.h - Host implementation of the Arduino String subset the old
+    page renderer used
+
+    Like the ESP8266 core it keeps the text on the heap and grows the
+    buffer to exactly the length needed, so the allocations counted by
+    heap.h are close to the device's. The core's small string buffer for
+    up to 11 characters is left out.
+*/
+
+#ifndef NATIVE_WSTRING_H
+#define NATIVE_WSTRING_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+class String {
+  public:
+    String() {}
+    String(const char *s) { if (s != NULL) copy(s, strlen(s)); }
+    String(const String &other) { copy(other.c_str(), other.len); }
+    String(String &&other) : buffer(other.buffer), capacity(other.capacity), len(other.len) {
+      other.buffer = NULL;
+      other.capacity = other.len = 0;
+    }
+
+    explicit String(unsigned long value) {
+      char digits[24];
+      snprintf(digits, sizeof(digits), "%lu", value);
+      copy(digits, strlen(digits));
+    }
+
+    ~String() { free(buffer); }
+
+    String &operator=(const String &other) {
+      if (this != &other) copy(other.c_str(), other.len);
+      return *this;
+    }
+
+    String &operator=(String &&other) {
+      if (this == &other) return *this;
+
+      free(buffer);
+      buffer = other.buffer;
+      capacity = other.capacity;
+      len = other.len;
+      other.buffer = NULL;
+      other.capacity = other.len = 0;
+      return *this;
+    }
+
+    String &operator=(const char *s) {
+      if (s == NULL) len = 0;
+      else copy(s, strlen(s));
+      return *this;
+    }
+
+    unsigned int length() const { return len; }
+    const char *c_str() const { return buffer != NULL ? buffer : ""; }
+
+    //  Exactly size characters, no growth factor
+    bool reserve(unsigned int size) {
+      if (buffer != NULL && capacity >= size) return true;
+
+      char *grown = (char*)realloc(buffer, size + 1);
+      if (grown == NULL) return false;
+
+      if (buffer == NULL) grown[0] = 0;
+      buffer = grown;
+      capacity = size;
+      return true;
+    }
+
+    bool concat(const char *s, unsigned int length) {
+      if (length == 0) return true;
+      if (!reserve(len + length)) return false;
+
+      memmove(buffer + len, s, length);
+      len += length;
+      buffer[len] = 0;
+      return true;
+    }
+
+    String &operator+=(const String &other) { concat(other.c_str(), other.len); return *this; }
+    String &operator+=(const char *s) { if (s != NULL) concat(s, strlen(s)); return *this; }
+    String &operator+=(char c) { concat(&c, 1); return *this; }
+
+    int indexOf(char c, unsigned int from = 0) const {
+      if (from >= len) return -1;
+      const char *found = (const char*)memchr(buffer + from, c, len - from);
+      return found != NULL ? found - buffer : -1;
+    }
+
+    int indexOf(const String &s, unsigned int from = 0) const {
+      if (from > len) return -1;
+      const char *found = strstr(c_str() + from, s.c_str());
+      return found != NULL ? found - c_str() : -1;
+    }
+
+    //  Every occurrence, like the core
+    void replace(const String &find, const String &replacement) {
+      if (len == 0 || find.len == 0) return;
+
+      String result;
+      const char *start = c_str();
+      const char *found;
+
+      while ((found = strstr(start, find.c_str())) != NULL){
+        result.concat(start, found - start);
+        result += replacement;
+        start = found + find.len;
+      }
+
+      if (start == c_str()) return;
+
+      result += start;
+      *this = static_cast<String&&>(result);
+    }
+
+    bool operator==(const char *s) const { return strcmp(c_str(), s) == 0; }
+    bool operator!=(const char *s) const { return !(*this == s); }
+
+  private:
+    void copy(const char *s, unsigned int length) {
+      if (!reserve(length)) return;
+
+      memmove(buffer, s, length);
+      len = length;
+      buffer[len] = 0;
+    }
+
+    char *buffer = NULL;
+    unsigned int capacity = 0;
+    unsigned int len = 0;
+};
+
+#endif
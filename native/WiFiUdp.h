@@ -0,0 +1,110 @@
+/*
+    WiFiUdp.h - Fake UDP socket
+
+    Every packet sent is handed to the peer set with HalSetPeer(), which
+    may write an answer and say how long it takes to arrive. parsePacket()
+    returns the answers once their time on the virtual clock has come.
+    Without a peer, or when it doesn't answer, nothing comes back.
+*/
+
+#ifndef NATIVE_WIFIUDP_H
+#define NATIVE_WIFIUDP_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#define HAL_UDP_MAX_PACKET  64
+#define HAL_UDP_MAX_QUEUED  4
+
+//  Returns the length of the answer, 0 for none, and sets delay to the ms
+//  it takes to arrive
+typedef size_t (*halUdpPeer_t)(const uint8_t *request, size_t length, uint8_t *answer, unsigned long &delay);
+
+struct halUdpPacket_t{
+  unsigned long dueAt;
+  size_t length;
+  uint8_t data[HAL_UDP_MAX_PACKET];
+};
+
+class WiFiUDP {
+  public:
+    uint8_t begin(uint16_t port) { return 1; }
+    void stop() {}
+
+    int beginPacket(IPAddress ip, uint16_t port) {
+      outLength = 0;
+      lastAddress = ip;
+      lastPort = port;
+      return 1;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) {
+      if (size > sizeof(out) - outLength) size = sizeof(out) - outLength;
+      memcpy(out + outLength, buffer, size);
+      outLength += size;
+      return size;
+    }
+
+    int endPacket() {
+      sent++;
+      if (peer == NULL || queued >= HAL_UDP_MAX_QUEUED) return 1;
+
+      halUdpPacket_t &packet = queue[queued];
+      unsigned long delay = 0;
+
+      packet.length = peer(out, outLength, packet.data, delay);
+      if (packet.length == 0) return 1;
+
+      packet.dueAt = millis() + delay;
+      queued++;
+      return 1;
+    }
+
+    //  Size of the next packet that has arrived, 0 if there is none
+    int parsePacket() {
+      current = NULL;
+
+      for (uint8_t i = 0; i < queued; i++) {
+        if ((long)(millis() - queue[i].dueAt) < 0) continue;
+
+        received = queue[i];
+        current = &received;
+        queue[i] = queue[--queued];
+        return received.length;
+      }
+      return 0;
+    }
+
+    int read(uint8_t *buffer, size_t length) {
+      if (current == NULL) return 0;
+      if (length > current->length) length = current->length;
+      memcpy(buffer, current->data, length);
+      return length;
+    }
+
+    //  Fake side
+
+    void HalSetPeer(halUdpPeer_t peer) { this->peer = peer; }
+
+    void HalReset() {
+      queued = 0;
+      current = NULL;
+      sent = 0;
+    }
+
+    unsigned long sent = 0;
+    IPAddress lastAddress;
+    uint16_t lastPort = 0;
+
+  private:
+    halUdpPeer_t peer = NULL;
+    uint8_t out[HAL_UDP_MAX_PACKET];
+    size_t outLength = 0;
+
+    halUdpPacket_t queue[HAL_UDP_MAX_QUEUED];
+    uint8_t queued = 0;
+    halUdpPacket_t received;
+    halUdpPacket_t *current = NULL;
+};
+
+#endif
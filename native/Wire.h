@@ -0,0 +1,38 @@
+/*
+    Wire.h - Host stand-in for the I2C bus, the devices are faked one level up
+*/
+
+#ifndef NATIVE_WIRE_H
+#define NATIVE_WIRE_H
+
+#include <Arduino.h>
+
+class TwoWire {
+  public:
+    void begin() {}
+    void begin(int sda, int scl) {}
+    void setClock(uint32_t frequency) {}
+
+    void beginTransmission(uint8_t address) { this->address = address; }
+
+    //  Only the devices registered with HalAddI2CDevice() answer
+    uint8_t endTransmission() {
+      for (uint8_t i = 0; i < deviceCount; i++) {
+        if (devices[i] == address) return 0;
+      }
+      return 2;
+    }
+
+    void HalAddI2CDevice(uint8_t address) {
+      if (deviceCount < sizeof(devices)) devices[deviceCount++] = address;
+    }
+
+  private:
+    uint8_t address = 0;
+    uint8_t devices[8];
+    uint8_t deviceCount = 0;
+};
+
+TwoWire Wire;
+
+#endif
@@ -0,0 +1,56 @@
+/*
+    common.h - Stand-ins for the shared ../_common headers
+
+    The device build takes the site defaults and the enums shared by all
+    the nodes from ../_common, which is not part of this repository. The
+    native build gets these instead, so it builds from a clean checkout.
+*/
+
+#ifndef NATIVE_COMMON_H
+#define NATIVE_COMMON_H
+
+//  Site defaults
+#define DEFAULT_PASSWORD "password"
+#define DEFAULT_MQTT_SERVER "test.mosquitto.org"
+#define DEFAULT_MQTT_PORT 1883
+#define DEFAULT_MQTT_TOPIC "ESP"
+#define NODE_DEFAULT_FRIENDLY_NAME "Stairlight"
+#define DEFAULT_HEARTBEAT_INTERVAL 300
+
+#define ADMIN_USERNAME "admin"
+#define ADMIN_PASSWORD "admin"
+
+#define NTP_REFRESH_INTERVAL 3600
+#define WIFI_CONNECTION_TIMEOUT 10
+#define ACCESS_POINT_TIMEOUT 300000
+#define OTA_BLINKING_RATE 3
+
+#define LATITUDE 47.4979
+#define LONGITUDE 19.0402
+
+enum EVENTCATEGORIES {
+  System,
+  Conn,
+  Reboot,
+  Authentication,
+  Login,
+  PageHandler,
+  MqttMsg,
+  MqttParamChange,
+  TimeZoneChange,
+  FriendlyNameChange,
+  HeartbeatIntervalChange,
+  StaircaseLight,
+  StaircaselightDelay,
+  EntranceLight,
+  RefreshSunsetSunrise
+};
+
+enum CONNECTION_STATE {
+  STATE_CHECK_WIFI_CONNECTION,
+  STATE_WIFI_CONNECT,
+  STATE_CHECK_INTERNET_CONNECTION,
+  STATE_INTERNET_CONNECTED
+};
+
+#endif
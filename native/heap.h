@@ -0,0 +1,64 @@
+/*
+    heap.h - Heap accounting for the native build
+
+    Wraps the glibc allocator to count allocations and keep track of the
+    bytes in use and their peak, for the benchmarks. Include it in exactly
+    one translation unit.
+*/
+
+#ifndef NATIVE_HEAP_H
+#define NATIVE_HEAP_H
+
+#include <stdlib.h>
+#include <malloc.h>
+
+extern "C" {
+  void *__libc_malloc(size_t size);
+  void *__libc_calloc(size_t count, size_t size);
+  void *__libc_realloc(void *p, size_t size);
+  void __libc_free(void *p);
+}
+
+unsigned long halAllocations = 0;
+long halHeapInUse = 0;
+long halHeapPeak = 0;
+
+void HalHeapAdd(void *p){
+  if (p == NULL) return;
+
+  halHeapInUse += malloc_usable_size(p);
+  if (halHeapInUse > halHeapPeak) halHeapPeak = halHeapInUse;
+}
+
+void HalHeapRemove(void *p){
+  if (p != NULL) halHeapInUse -= malloc_usable_size(p);
+}
+
+extern "C" void *malloc(size_t size){
+  void *p = __libc_malloc(size);
+  halAllocations++;
+  HalHeapAdd(p);
+  return p;
+}
+
+extern "C" void *calloc(size_t count, size_t size){
+  void *p = __libc_calloc(count, size);
+  halAllocations++;
+  HalHeapAdd(p);
+  return p;
+}
+
+extern "C" void *realloc(void *p, size_t size){
+  HalHeapRemove(p);
+  void *q = __libc_realloc(p, size);
+  halAllocations++;
+  HalHeapAdd(q != NULL ? q : (size ? p : NULL));
+  return q;
+}
+
+extern "C" void free(void *p){
+  HalHeapRemove(p);
+  __libc_free(p);
+}
+
+#endif
@@ -0,0 +1,117 @@
+/*
+    lwip/dns.h - Fake of the lwIP resolver
+
+    Hosts are set up with HalDnsSetHost(). dns_gethostbyname() never
+    answers right away, the callback follows after the host's delay on the
+    virtual clock, the way lwIP calls it from the network stack. Hosts that
+    were never set up don't answer at all, like an unreachable DNS server.
+*/
+
+#ifndef NATIVE_LWIP_DNS_H
+#define NATIVE_LWIP_DNS_H
+
+#include <Arduino.h>
+
+#define HAL_DNS_MAX_HOSTS   8
+#define HAL_DNS_MAX_QUERIES 8
+
+typedef int8_t err_t;
+
+#define ERR_OK          0
+#define ERR_INPROGRESS  -5
+#define ERR_ARG         -16
+
+//  In network byte order, like lwIP keeps it
+struct ip_addr_t{
+  uint32_t addr;
+};
+
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ipaddr, void *callback_arg);
+
+struct halDnsHost_t{
+  char name[64];
+  bool exists;                  //  Or the server answers that there is no such host
+  ip_addr_t address;
+  unsigned long delay;          //  ms
+};
+
+struct halDnsQuery_t{
+  bool active;
+  const halDnsHost_t *host;
+  unsigned long dueAt;
+  dns_found_callback found;
+  void *arg;
+};
+
+halDnsHost_t halDnsHosts[HAL_DNS_MAX_HOSTS];
+uint8_t halDnsHostCount = 0;
+halDnsQuery_t halDnsQueries[HAL_DNS_MAX_QUERIES];
+unsigned long halDnsQueryCount = 0;
+
+//  address is "a.b.c.d", or NULL for a host that doesn't exist
+void HalDnsSetHost(const char *name, const char *address, unsigned long delay){
+  halDnsHost_t *host = NULL;
+
+  for (uint8_t i = 0; i < halDnsHostCount; i++) {
+    if (strcmp(halDnsHosts[i].name, name) == 0) host = &halDnsHosts[i];
+  }
+  if (host == NULL){
+    if (halDnsHostCount >= HAL_DNS_MAX_HOSTS) return;
+    host = &halDnsHosts[halDnsHostCount++];
+  }
+
+  unsigned int a = 0, b = 0, c = 0, d = 0;
+
+  strlcpy(host->name, name, sizeof(host->name));
+  host->exists = address != NULL && sscanf(address, "%u.%u.%u.%u", &a, &b, &c, &d) == 4;
+
+  uint8_t bytes[4] = {(uint8_t)a, (uint8_t)b, (uint8_t)c, (uint8_t)d};
+  memcpy(&host->address.addr, bytes, 4);
+  host->delay = delay;
+}
+
+//  Forgets the hosts and drops the queries without answering them
+void HalDnsReset(){
+  halDnsHostCount = 0;
+  memset(halDnsQueries, 0, sizeof(halDnsQueries));
+}
+
+//  Clock hook, answers the queries that are due
+void HalDnsRun(uint64_t now){
+  for (uint8_t i = 0; i < HAL_DNS_MAX_QUERIES; i++) {
+    halDnsQuery_t &query = halDnsQueries[i];
+    if (!query.active || (long)(now / 1000 - query.dueAt) < 0) continue;
+
+    query.active = false;
+    query.found(query.host->name, query.host->exists ? &query.host->address : NULL, query.arg);
+  }
+}
+
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg){
+  halDnsQueryCount++;
+  HalAddClockHook(HalDnsRun);
+
+  const halDnsHost_t *host = NULL;
+  for (uint8_t i = 0; i < halDnsHostCount; i++) {
+    if (strcmp(halDnsHosts[i].name, hostname) == 0) host = &halDnsHosts[i];
+  }
+
+  //  Nobody answers
+  if (host == NULL) return ERR_INPROGRESS;
+
+  for (uint8_t i = 0; i < HAL_DNS_MAX_QUERIES; i++) {
+    halDnsQuery_t &query = halDnsQueries[i];
+    if (query.active) continue;
+
+    query.active = true;
+    query.host = host;
+    query.dueAt = millis() + host->delay;
+    query.found = found;
+    query.arg = callback_arg;
+    return ERR_INPROGRESS;
+  }
+
+  return ERR_ARG;
+}
+
+#endif
@@ -0,0 +1,81 @@
+/*
+    pcf8574_esp.h - Fake PCF8574 I/O expander
+
+    Models the quasi-bidirectional port: a pin reads low if it is written
+    low or pulled low from the outside (HalSetInputs()). Like the real chip
+    the INT line goes low on an input change and is released by the next
+    read. A write hook sees every write as it happens, also the ones made
+    while the loop is held up.
+*/
+
+#ifndef NATIVE_PCF8574_ESP_H
+#define NATIVE_PCF8574_ESP_H
+
+#include <Arduino.h>
+#include <Wire.h>
+
+typedef void (*halWriteHook_t)(uint8_t previous, uint8_t value);
+
+class PCF857x {
+  public:
+    PCF857x(uint8_t address, TwoWire *wire, bool is8575 = false) : address(address) {}
+
+    void begin(uint8_t defaultValues = 0xFF) { outputs = defaultValues; }
+
+    uint8_t read8() {
+      reads++;
+      ReleaseInterrupt();
+      return outputs & inputs;
+    }
+
+    void write8(uint8_t value) {
+      uint8_t previous = outputs;
+
+      writes++;
+      outputs = value;
+      if (writeHook != NULL) writeHook(previous, value);
+    }
+
+    uint8_t read(uint8_t pin) { return (read8() >> pin) & 1; }
+
+    void write(uint8_t pin, uint8_t value) {
+      write8(value ? outputs | (1 << pin) : outputs & ~(1 << pin));
+    }
+
+    uint8_t getLastError() { return 0; }
+
+    //  Fake side
+
+    //  Levels the outside world drives the pins to, 1 = released
+    void HalSetInputs(uint8_t levels) {
+      if (levels == inputs) return;
+
+      inputs = levels;
+      if (interruptPin >= 0) HalSetPin(interruptPin, LOW);
+    }
+
+    void HalSetInterruptPin(int8_t pin) {
+      interruptPin = pin;
+      if (pin >= 0) halPinLevels[pin] = HIGH;
+    }
+
+    uint8_t HalOutputs() { return outputs; }
+
+    void HalSetWriteHook(halWriteHook_t hook) { writeHook = hook; }
+
+    unsigned long reads = 0;
+    unsigned long writes = 0;
+
+  private:
+    void ReleaseInterrupt() {
+      if (interruptPin >= 0) halPinLevels[interruptPin] = HIGH;
+    }
+
+    uint8_t address;
+    uint8_t outputs = 0xFF;
+    uint8_t inputs = 0xFF;
+    int8_t interruptPin = -1;
+    halWriteHook_t writeHook = NULL;
+};
+
+#endif
@@ -0,0 +1,407 @@
+/*
+    simulation.h - Discrete event simulation of the firmware on the host
+
+    Replays a trace of input changes against the fake expander on the
+    virtual clock. Between events the clock jumps straight to the next due
+    scheduler task or trace entry, so a day of button presses runs in
+    seconds.
+
+    Trace format, one entry per line, '#' starts a comment:
+
+        start 2021-06-21 06:00:00       optional, sets now()
+        <time> <input> press|release
+        <time> relay <channel> on|off   expected relay transition
+        <time> mqtt <topic> <payload>   expected message, <topic> is matched
+                                        against the end of the topic
+
+    <time> is ms since the start of the trace or hh:mm:ss[.mmm].
+
+    If the trace has expectations, every relay transition and MQTT message
+    must match the next expected one of its kind within
+    SIM_EXPECT_TOLERANCE ms, anything else is counted as unexpected and
+    the expectations never met as missing.
+
+    While running it records every relay transition and every MQTT message
+    and checks the staircase light against a model of its timer:
+    - press to relay latency of the presses that switch the light on,
+    - the light must switch off at the deadline the model expects
+      (duration, retrigger policy and extensions), never before it.
+*/
+
+#ifndef NATIVE_SIMULATION_H
+#define NATIVE_SIMULATION_H
+
+#include <Arduino.h>
+#include <TimeLib.h>
+#include <pcf8574_esp.h>
+#include <PubSubClient.h>
+#include <vector>
+#include <algorithm>
+
+#define SIM_EXPECT_TOLERANCE (2 * ZONE_TASK_INTERVAL)    //  ms
+
+struct simInput_t{
+  unsigned long time;       //  ms
+  uint8_t channel;
+  bool pressed;
+};
+
+struct simTransition_t{
+  unsigned long time;
+  uint8_t channel;
+  bool on;
+};
+
+struct simExpectation_t{
+  unsigned long time;
+  bool mqtt;                //  MQTT message or relay transition
+  uint8_t channel;
+  bool on;
+  char topic[32];
+  char payload[16];
+  bool met;
+};
+
+struct simResult_t{
+  unsigned long duration;             //  Simulated ms
+  unsigned long inputChanges;
+  unsigned long presses;
+  unsigned long lightEvents;          //  Reported by staircase.h
+  unsigned long transitions;
+  unsigned long mqttMessages;
+  unsigned long loopPasses;
+
+  unsigned long latencyCount;         //  Presses that switched the light on
+  unsigned long latencyTotal;         //  ms
+  unsigned long latencyMax;           //  ms
+
+  unsigned long timerChecks;          //  Off transitions compared with the model
+  unsigned long timerEarly;           //  Switched off before the deadline
+  unsigned long timerLate;            //  Switched off later than the zone task allows
+  unsigned long timerMaxError;        //  ms
+
+  unsigned long expectationsMet;
+  unsigned long unexpected;           //  Relay transitions and messages nobody expected
+  unsigned long missing;              //  Expectations never met
+};
+
+std::vector<simInput_t> simInputs;
+std::vector<simTransition_t> simTransitions;
+std::vector<simExpectation_t> simExpectations;
+size_t simNextInput = 0;
+
+PCF857x *simExpander = NULL;
+uint8_t simInputLevels = INPUT_MASK_ALL;
+simResult_t simResult;
+
+//  Model of the staircase timer
+bool simLightTimed = false;
+unsigned long simLightDeadline = 0;
+long simPendingPress = -1;          //  Time of the press waiting for the light
+
+bool simVerbose = false;
+
+//  "1234" or "hh:mm:ss[.mmm]"
+bool SimParseTime(const char *text, unsigned long &ms){
+  unsigned int h, m, s, f = 0;
+
+  if (sscanf(text, "%u:%u:%u.%u", &h, &m, &s, &f) >= 3){
+    ms = ((h * 60UL + m) * 60UL + s) * 1000UL + f;
+    return true;
+  }
+
+  char *end;
+  ms = strtoul(text, &end, 10);
+  return *end == 0 && end != text;
+}
+
+bool SimLoadTrace(const char *path){
+  FILE *f = fopen(path, "r");
+  if (f == NULL){
+    Serial.printf("Failed to open trace %s\r\n", path);
+    return false;
+  }
+
+  char line[128];
+  unsigned int lineNumber = 0;
+
+  simInputs.clear();
+  simExpectations.clear();
+
+  while (fgets(line, sizeof(line), f) != NULL){
+    lineNumber++;
+
+    char *comment = strchr(line, '#');
+    if (comment != NULL) *comment = 0;
+
+    char first[32], second[32], third[32], fourth[16];
+    int fields = sscanf(line, "%31s %31s %31s %15s", first, second, third, fourth);
+    if (fields <= 0) continue;
+
+    if (strcmp(first, "start") == 0){
+      int year, month, day, hour, minute, second;
+      if (sscanf(line, " start %d-%d-%d %d:%d:%d", &year, &month, &day, &hour, &minute, &second) == 6)
+        setTime(hour, minute, second, day, month, year);
+      continue;
+    }
+
+    simInput_t input;
+    unsigned int channel;
+
+    if (fields == 4 && strcmp(second, "relay") == 0){
+      simExpectation_t expectation = {};
+
+      if (!SimParseTime(first, expectation.time) || sscanf(third, "%u", &channel) != 1 || channel >= RELAY_COUNT
+          || (strcmp(fourth, "on") != 0 && strcmp(fourth, "off") != 0)){
+        Serial.printf("%s:%u: invalid relay expectation\r\n", path, lineNumber);
+        fclose(f);
+        return false;
+      }
+
+      expectation.channel = channel;
+      expectation.on = strcmp(fourth, "on") == 0;
+      simExpectations.push_back(expectation);
+      continue;
+    }
+
+    if (fields == 4 && strcmp(second, "mqtt") == 0){
+      simExpectation_t expectation = {};
+
+      if (!SimParseTime(first, expectation.time)){
+        Serial.printf("%s:%u: invalid MQTT expectation\r\n", path, lineNumber);
+        fclose(f);
+        return false;
+      }
+
+      expectation.mqtt = true;
+      strcpy(expectation.topic, third);
+      strcpy(expectation.payload, fourth);
+      simExpectations.push_back(expectation);
+      continue;
+    }
+
+    if (fields != 3 || !SimParseTime(first, input.time) || sscanf(second, "%u", &channel) != 1 || channel >= INPUT_COUNT
+        || (strcmp(third, "press") != 0 && strcmp(third, "release") != 0)){
+      Serial.printf("%s:%u: invalid entry\r\n", path, lineNumber);
+      fclose(f);
+      return false;
+    }
+
+    input.channel = channel;
+    input.pressed = strcmp(third, "press") == 0;
+    simInputs.push_back(input);
+  }
+
+  fclose(f);
+
+  //  Stable, so bounces written in order stay in order
+  std::stable_sort(simInputs.begin(), simInputs.end(), [](const simInput_t &a, const simInput_t &b){ return a.time < b.time; });
+  std::stable_sort(simExpectations.begin(), simExpectations.end(), [](const simExpectation_t &a, const simExpectation_t &b){ return a.time < b.time; });
+  return true;
+}
+
+//  Clock hook: drives the expander pins when their time has come
+void SimApplyInputs(uint64_t now){
+  unsigned long ms = now / 1000;
+
+  while (simNextInput < simInputs.size() && simInputs[simNextInput].time <= ms){
+    simInput_t &input = simInputs[simNextInput++];
+    uint8_t mask = inputMasks[input.channel];
+
+    simInputLevels = input.pressed ? simInputLevels & ~mask : simInputLevels | mask;
+    simExpander->HalSetInputs(simInputLevels);
+    simResult.inputChanges++;
+
+    if (input.pressed){
+      simResult.presses++;
+
+      if (inputActions[input.channel][GESTURE_PRESS] == ACTION_STAIRCASE_START
+          && !RelayIsOn(STAIRCASELIGHT_RELAY) && simPendingPress < 0)
+        simPendingPress = input.time;
+    }
+  }
+}
+
+bool SimEndsWith(const char *text, const char *suffix){
+  size_t textLength = strlen(text);
+  size_t suffixLength = strlen(suffix);
+  return suffixLength <= textLength && strcmp(text + textLength - suffixLength, suffix) == 0;
+}
+
+//  Matches a relay transition or MQTT message against the next expectation
+//  of its kind
+void SimCheckExpected(bool mqtt, uint8_t channel, bool on, const char *topic, const char *payload){
+  if (simExpectations.empty()) return;
+
+  unsigned long now = millis();
+
+  for (simExpectation_t &expectation : simExpectations) {
+    if (expectation.met || expectation.mqtt != mqtt) continue;
+
+    //  Past its window, it ends up as missing
+    long error = (long)(now - expectation.time);
+    if (error > SIM_EXPECT_TOLERANCE) continue;
+
+    bool same = mqtt ? SimEndsWith(topic, expectation.topic) && strcmp(payload, expectation.payload) == 0
+                     : channel == expectation.channel && on == expectation.on;
+
+    if (same && error >= -SIM_EXPECT_TOLERANCE){
+      expectation.met = true;
+      simResult.expectationsMet++;
+      return;
+    }
+    break;
+  }
+
+  simResult.unexpected++;
+
+  if (mqtt) Serial.printf("%10lu  unexpected: mqtt %s %s\r\n", now, topic, payload);
+  else Serial.printf("%10lu  unexpected: relay %u %s\r\n", now, channel, on ? "on" : "off");
+}
+
+void SimBrokerHook(const char *topic, const char *payload, bool retained){
+  simResult.mqttMessages++;
+  if (simVerbose) Serial.printf("%10lu  mqtt %s %s\r\n", millis(), topic, payload);
+
+  SimCheckExpected(true, 0, false, topic, payload);
+}
+
+//  Feed the light events of staircase.h in here to keep the model in step
+void SimLightEvent(LIGHT_EVENT event, uint8_t channel){
+  simResult.lightEvents++;
+  if (channel != STAIRCASELIGHT_RELAY) return;
+
+  zone_t &z = zones[STAIRCASELIGHT_RELAY];
+
+  switch (event) {
+    case LIGHT_STAIRCASE_STARTED:
+      if (!simLightTimed || z.policy == RETRIGGER_RESTART)
+        simLightDeadline = millis() + z.duration;
+      else if (z.policy == RETRIGGER_EXTEND)
+        simLightDeadline += z.duration;
+      simLightTimed = true;
+      break;
+    case LIGHT_STAIRCASE_EXTENDED:
+      if (simLightTimed) simLightDeadline += z.duration;
+      break;
+    case LIGHT_STAIRCASE_FORCED_ON:
+      simLightTimed = false;
+      break;
+    default:
+      break;
+  }
+}
+
+void SimRecordTransition(uint8_t channel, bool on){
+  unsigned long now = millis();
+
+  simTransitions.push_back({now, channel, on});
+  simResult.transitions++;
+
+  if (simVerbose) Serial.printf("%10lu  relay %u %s\r\n", now, channel, on ? "on" : "off");
+
+  SimCheckExpected(false, channel, on, NULL, NULL);
+
+  if (channel != STAIRCASELIGHT_RELAY) return;
+
+  if (on && simPendingPress >= 0){
+    unsigned long latency = now - simPendingPress;
+
+    simResult.latencyCount++;
+    simResult.latencyTotal += latency;
+    if (latency > simResult.latencyMax) simResult.latencyMax = latency;
+    simPendingPress = -1;
+  }
+
+  if (!on && simLightTimed){
+    long error = (long)(now - simLightDeadline);
+
+    simResult.timerChecks++;
+    if (error < 0) simResult.timerEarly++;
+    else if (error > ZONE_TASK_INTERVAL) simResult.timerLate++;
+
+    unsigned long absError = error < 0 ? -error : error;
+    if (absError > simResult.timerMaxError) simResult.timerMaxError = absError;
+
+    if (simVerbose && (error < 0 || error > ZONE_TASK_INTERVAL))
+      Serial.printf("%10lu  timer error: off %ld ms after the deadline\r\n", now, error);
+  }
+
+  if (!on) simLightTimed = false;
+}
+
+//  Write hook of the expander
+void SimRecordWrite(uint8_t previous, uint8_t value){
+  uint8_t changed = previous ^ value;
+
+  for (uint8_t i = 0; i < RELAY_COUNT; i++) {
+    if (changed & (1 << i)) SimRecordTransition(i, ((value >> i) & 1) == RELAY_ON);
+  }
+}
+
+void SimulationBegin(PCF857x &expander, PubSubClient &client){
+  simExpander = &expander;
+  simNextInput = 0;
+  simInputLevels = INPUT_MASK_ALL;
+  simTransitions.clear();
+  memset(&simResult, 0, sizeof(simResult));
+
+  simLightTimed = false;
+  simPendingPress = -1;
+
+  client.HalSetBrokerHook(SimBrokerHook);
+  expander.HalSetWriteHook(SimRecordWrite);
+  HalAddClockHook(SimApplyInputs);
+}
+
+//  Runs the trace plus tail ms after its last entry. loopPass is one pass
+//  of loop() without advancing the clock.
+void SimulationRun(void (*loopPass)(), unsigned long tail){
+  unsigned long start = millis();
+  unsigned long end = start + (simInputs.empty() ? 0 : simInputs.back().time) + tail;
+
+  //  Trace times are relative to the start of the run
+  for (simInput_t &input : simInputs) input.time += start;
+  for (simExpectation_t &expectation : simExpectations) expectation.time += start;
+
+  while ((long)(millis() - end) < 0){
+    loopPass();
+    simResult.loopPasses++;
+
+    //  Jump to whatever happens next
+    unsigned long idle = SchedulerIdleTime(end - millis());
+
+    if (simNextInput < simInputs.size()){
+      long untilInput = (long)(simInputs[simNextInput].time - millis());
+      if (untilInput < (long)idle) idle = untilInput > 0 ? untilInput : 0;
+    }
+
+    HalAdvance(idle > 0 ? idle : 1);
+  }
+
+  simResult.duration = millis() - start;
+
+  for (const simExpectation_t &expectation : simExpectations) {
+    if (expectation.met) continue;
+
+    simResult.missing++;
+
+    if (expectation.mqtt) Serial.printf("%10lu  missing: mqtt %s %s\r\n", expectation.time, expectation.topic, expectation.payload);
+    else Serial.printf("%10lu  missing: relay %u %s\r\n", expectation.time, expectation.channel, expectation.on ? "on" : "off");
+  }
+}
+
+void SimulationPrintResult(Print &out){
+  simResult_t &r = simResult;
+
+  out.printf("Simulated:        %lu ms in %lu loop passes\r\n", r.duration, r.loopPasses);
+  out.printf("Input changes:    %lu (%lu presses)\r\n", r.inputChanges, r.presses);
+  out.printf("Light events:     %lu\r\n", r.lightEvents);
+  out.printf("Relay changes:    %lu\r\n", r.transitions);
+  out.printf("MQTT messages:    %lu (%.2f per light event)\r\n", r.mqttMessages, r.lightEvents ? (double)r.mqttMessages / r.lightEvents : 0.0);
+  out.printf("Press to relay:   %lu presses, avg %lu ms, max %lu ms\r\n", r.latencyCount, r.latencyCount ? r.latencyTotal / r.latencyCount : 0, r.latencyMax);
+  out.printf("Timer checks:     %lu, %lu early, %lu late, max error %lu ms\r\n", r.timerChecks, r.timerEarly, r.timerLate, r.timerMaxError);
+  out.printf("Expectations:     %lu met, %lu missing, %lu unexpected\r\n", r.expectationsMet, r.missing, r.unexpected);
+}
+
+#endif
@@ -1,14 +1,14 @@
 #define __debugSettings
 
 //#define _use_local_sun_data
+//#define _use_sun_table
 #define _use_local_staircase_timer
+#define _use_input_interrupt
+//#define _use_benchmarks
+//#define _use_relay_self_test
 
 #include "includes.h"
 
-typedef enum {
-    Sunrise, Sunset
-} sunRiseSunset;
-
 //  Web server
 ESP8266WebServer server(80);
 
@@ -17,10 +17,21 @@ WiFiClient wclient;
 PubSubClient PSclient(wclient);
 
 //  Timers and their flags
-os_timer_t heartbeatTimer;
-os_timer_t sunDataTimer;
 os_timer_t accessPointTimer;
-os_timer_t staircaseTimer;
+
+//  Scheduler tasks
+int8_t httpTask = SCHEDULER_NO_TASK;
+int8_t mqttTask = SCHEDULER_NO_TASK;
+int8_t networkTask = SCHEDULER_NO_TASK;
+int8_t heartbeatTask = SCHEDULER_NO_TASK;
+int8_t ntpTask = SCHEDULER_NO_TASK;
+int8_t sunDataTask = SCHEDULER_NO_TASK;
+int8_t entranceLightTask = SCHEDULER_NO_TASK;
+int8_t eventsTask = SCHEDULER_NO_TASK;
+int8_t benchmarkTask = SCHEDULER_NO_TASK;
+int8_t journalTask = SCHEDULER_NO_TASK;
+int8_t configTask = SCHEDULER_NO_TASK;
+int8_t bootTask = SCHEDULER_NO_TASK;
 
 //  I2C
 PCF857x i2c_relays(I2C_LED_PANEL0_ADDRESS, &Wire);
@@ -30,238 +41,176 @@ sunData_t sunData;
 config appConfig;
 bool isAccessPoint = false;
 bool isAccessPointCreated = false;
+volatile bool accessPointTimedOut = false;
 TimeChangeRule *tcr;        // Pointer to the time change rule
 
 unsigned long inputPattern;
-unsigned long buttonPressedTime = 4294967295 - 3600000;  //  a high number is needed to prevent millis() overflow problem
 enum CONNECTION_STATE connectionState;
 
+
+//  NeedsEntranceLight() at the last run of the entrance task, -1 before the first one
+int8_t entranceLightScheduled = -1;
+
 //  Flags
-bool needsHeartbeat = false;
-bool needsSunData = false;
-bool entranceLightState = false;
-bool stairlightExpired = false;
 bool ntpInitialized = false;
+bool otaStarted = false;
 
-WiFiUDP Udp;
-
-void LogEvent(int Category, int ID, String Title, String Data){
-  if (PSclient.connected()){
+//  WiFi connection in progress, see STATE_WIFI_CONNECT
+bool wifiConnecting = false;
+unsigned long wifiConnectStartedAt = 0;
 
-    String msg = "{";
+WiFiUDP Udp;
 
-    msg += "\"Node\":" + (String)ESP.getChipId() + ",";
-    msg += "\"Category\":" + (String)Category + ",";
-    msg += "\"ID\":" + (String)ID + ",";
-    msg += "\"Title\":\"" + Title + "\",";
-    msg += "\"Data\":\"" + Data + "\"}";
+//  Page rendering context
+time_t pageLocalTime;
+const char *pageAlert = "";
+int8_t pageNetworkCount = 0;
 
-    Serial.println(msg);
+//  Cursors of the event log consumers and the records each lost, see eventlog.h
+uint32_t eventLogLiveCursor = 0;
+uint32_t eventLogMqttCursor = 0;
+unsigned long eventLogLiveLost = 0;
+unsigned long eventLogMqttLost = 0;
 
-    PSclient.publish((MQTT_CUSTOMER + String("/") + MQTT_PROJECT + String("/") + appConfig.mqttTopic + "/log").c_str(), msg.c_str(), false);
-  }
+//  Only queues the event, SendLiveEvents() and PublishEventLog() deliver it
+void LogEvent(int Category, int ID, const char *Title, const char *Data){
+  EventLogPush(Category, ID, Title, Data);
 }
 
-void SetRandomSeed(){
-    uint32_t seed;
+void LogEvent(int Category, int ID, const char *Title, const String &Data){
+  EventLogPush(Category, ID, Title, Data.c_str());
+}
 
-    // random works best with a seed that can use 31 bits
-    // analogRead on a unconnected pin tends toward less than four bits
-    seed = analogRead(0);
-    delay(1);
+size_t EventRecordMessage(const eventRecord_t &record, char *buffer, size_t size){
+  StaticJsonDocument<JSON_OBJECT_SIZE(8)> doc;
 
-    for (int shifts = 3; shifts < 31; shifts += 3)
-    {
-        seed ^= analogRead(0) << shifts;
-        delay(1);
-    }
+  JsonObject msg = doc.to<JsonObject>();
+  msg["Node"] = ESP.getChipId();
+  EventRecordToJson(record, msg);
 
-    randomSeed(seed);
+  return serializeJson(doc, buffer, size);
 }
 
-void accessPointTimerCallback(void *pArg) {
-  ESP.reset();
-}
+//  The serial console and SSE clients get every record once, nothing is
+//  kept for them if they aren't listening
+void SendLiveEvents(){
+  char msg[EVENT_MESSAGE_LENGTH];
+  const eventRecord_t *record;
 
-void heartbeatTimerCallback(void *pArg) {
-  needsHeartbeat = true;
-}
+  EventLogCatchUp(eventLogLiveCursor, eventLogLiveLost);
 
-void StaircaseTimerCallback(void *pArg) {
-    stairlightExpired = true;
-}
+  while ((record = EventLogGet(eventLogLiveCursor)) != NULL){
+    EventRecordMessage(*record, msg, sizeof(msg));
 
-void sunDataTimerCallback(void *pArg) {
-  needsSunData = true;
-}
+    Serial.println(msg);
+    EventsSend("log", msg);
 
-bool loadSettings(config& data) {
-  File configFile = LittleFS.open("/config.json", "r");
-  if (!configFile) {
-    Serial.println("Failed to open config file");
-    LogEvent(EVENTCATEGORIES::System, 1, "FS failure", "Failed to open config file.");
-    return false;
+    eventLogLiveCursor++;
   }
+}
 
-  size_t size = configFile.size();
-  if (size > 1024) {
-    Serial.println("Config file size is too large");
-    LogEvent(EVENTCATEGORIES::System, 2, "FS failure", "Config file size is too large.");
-    return false;
-  }
+//  Sends the records the broker hasn't seen yet as one message, once a batch
+//  is full or the oldest record has waited EVENT_LOG_BATCH_DELAY. The cursor
+//  only moves on a successful publish, so a broker outage doesn't lose them.
+void PublishEventLog(){
+  EventLogCatchUp(eventLogMqttCursor, eventLogMqttLost);
 
-  // Allocate a buffer to store contents of the file.
-  std::unique_ptr<char[]> buf(new char[size]);
+  uint32_t pending = EventLogPending(eventLogMqttCursor);
+  if (pending == 0) return;
 
-  // We don't use String here because ArduinoJson library requires the input
-  // buffer to be mutable. If you don't use ArduinoJson, you may as well
-  // use configFile.readString instead.
-  configFile.readBytes(buf.get(), size);
-  configFile.close();
+  if (pending < EVENT_LOG_BATCH_SIZE && millis() - EventLogGet(eventLogMqttCursor)->uptime < EVENT_LOG_BATCH_DELAY) return;
 
-  StaticJsonDocument<JSON_SETTINGS_SIZE> doc;
-  DeserializationError error = deserializeJson(doc, buf.get());
+  const size_t capacity = JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(EVENT_LOG_BATCH_SIZE) + EVENT_LOG_BATCH_SIZE * JSON_OBJECT_SIZE(7);
+  StaticJsonDocument<capacity> doc;
 
-  if (error) {
-    Serial.println("Failed to parse config file");
-    LogEvent(EVENTCATEGORIES::System, 3, "FS failure", "Failed to parse config file.");
-    Serial.println(error.c_str());
-    return false;
-  }
+  doc["Node"] = ESP.getChipId();
+  JsonArray events = doc.createNestedArray("Events");
 
-  #ifdef __debugSettings
-  serializeJsonPretty(doc,Serial);
-  Serial.println();
-  #endif
+  uint8_t count = 0;
+  while (count < EVENT_LOG_BATCH_SIZE && count < pending){
+    EventRecordToJson(*EventLogGet(eventLogMqttCursor + count), events.createNestedObject());
 
-  if (doc["ssid"]){
-    strcpy(appConfig.ssid, doc["ssid"]);
-  }
-  else
-  {
-    strcpy(appConfig.ssid, defaultSSID);
-  }
-  
-  if (doc["password"]){
-    strcpy(appConfig.password, doc["password"]);
-  }
-  else
-  {
-    strcpy(appConfig.password, DEFAULT_PASSWORD);
-  }
-  
-  if (doc["mqttServer"]){
-    strcpy(appConfig.mqttServer, doc["mqttServer"]);
-  }
-  else
-  {
-    strcpy(appConfig.mqttServer, DEFAULT_MQTT_SERVER);
-  }
-  
-  if (doc["mqttPort"]){
-    appConfig.mqttPort = doc["mqttPort"];
-  }
-  else
-  {
-    appConfig.mqttPort = DEFAULT_MQTT_PORT;
+    if (measureJson(doc) >= EVENT_LOG_PAYLOAD_LENGTH){
+      events.remove(count);
+      break;
+    }
+    count++;
   }
 
-    if (doc["mqttTopic"]){
-    strcpy(appConfig.mqttTopic, doc["mqttTopic"]);
-  }
-  else
-  {
-    sprintf(appConfig.mqttTopic, "%s-%u", DEFAULT_MQTT_TOPIC, ESP.getChipId());
-  }
-  
-  if (doc["friendlyName"]){
-    strcpy(appConfig.friendlyName, doc["friendlyName"]);
-  }
-  else
-  {
-    strcpy(appConfig.friendlyName, NODE_DEFAULT_FRIENDLY_NAME);
-  }
-  
-  if (doc["timezone"]){
-    appConfig.timeZone = doc["timezone"];
-  }
-  else
-  {
-    appConfig.timeZone = 0;
-  }
-  
-  if (doc["heartbeatInterval"]){
-    appConfig.heartbeatInterval = doc["heartbeatInterval"];
-  }
-  else
-  {
-    appConfig.heartbeatInterval = DEFAULT_HEARTBEAT_INTERVAL;
-  }
+  char payload[EVENT_LOG_PAYLOAD_LENGTH];
 
-  if (doc["staircaseLightDelay"]){
-    appConfig.staircaseLightDelay = doc["staircaseLightDelay"];
-  }
-  else
-  {
-    appConfig.staircaseLightDelay = DEFAULT_STAIRCASE_LIGHT_DELAY;
-  }
+  serializeJson(doc, payload, sizeof(payload));
 
-  if (doc["sunriseLightOffset"]){
-    appConfig.sunriseLightOffset = doc["sunriseLightOffset"];
-  }
-  else
-  {
-    appConfig.sunriseLightOffset = DEFAULT_SUNRISE_LIGHT_OFFSET;
-  }
+  if (MqttPublish(PSclient, TOPIC_LOG, payload)) eventLogMqttCursor += count;
+}
 
-  if (doc["sunsetLightOffset"]){
-    appConfig.sunsetLightOffset = doc["sunsetLightOffset"];
-  }
-  else
-  {
-    appConfig.sunsetLightOffset = DEFAULT_SUNSET_LIGHT_OFFSET;
-  }
+//  The hardware RNG gives a full 32 bit seed at once, without the ten 1 ms
+//  analogRead() samples this used to take
+void SetRandomSeed(){
+    randomSeed(RANDOM_REG32);
+}
 
-  return true;
+bool flushSettings();
+
+//  Writes the pending settings and the queued events first, they'd be lost otherwise
+void ResetNode(){
+  flushSettings();
+  JournalFlush();
+  ESP.reset();
 }
 
-bool saveSettings() {
-  StaticJsonDocument<1024> doc;
+//  Runs in the SDK's timer context, the network task does the reset
+void accessPointTimerCallback(void *pArg) {
+  accessPointTimedOut = true;
+}
 
-  doc["ssid"] = appConfig.ssid;
-  doc["password"] = appConfig.password;
+//  The binary record, or the JSON settings if there is no usable record
+bool loadSettings(config& data) {
+  uint8_t error = ReadConfig(CONFIG_FILE, data);
+  bool imported = false;
 
-  doc["heartbeatInterval"] = appConfig.heartbeatInterval;
+  if (error != SETTINGS_OK && error != SETTINGS_MIGRATED && LittleFS.exists(SETTINGS_FILE)){
+    error = ReadSettings(SETTINGS_FILE, data, defaultSSID, ESP.getChipId());
+    imported = error == SETTINGS_OK;
+    if (imported) error = SETTINGS_MIGRATED;
+  }
 
-  doc["timezone"] = appConfig.timeZone;
+  if (error == SETTINGS_MIGRATED){
+    Serial.println(settingsErrors[error]);
+    LogEvent(EVENTCATEGORIES::System, error, "Settings", settingsErrors[error]);
 
-  doc["mqttServer"] = appConfig.mqttServer;
-  doc["mqttPort"] = appConfig.mqttPort;
-  doc["mqttTopic"] = appConfig.mqttTopic;
+    error = WriteConfig(CONFIG_FILE, CONFIG_TEMP_FILE, data);
 
-  doc["friendlyName"] = appConfig.friendlyName;
+    //  Only once the record is safe, so a failed write imports again next time
+    if (error == SETTINGS_OK && imported) LittleFS.rename(SETTINGS_FILE, SETTINGS_IMPORTED_FILE);
+  }
 
-  doc["staircaseLightDelay"] = appConfig.staircaseLightDelay;
-  doc["sunriseLightOffset"] = appConfig.sunriseLightOffset;
-  doc["sunsetLightOffset"] = appConfig.sunsetLightOffset;
+  if (error != SETTINGS_OK) {
+    Serial.println(settingsErrors[error]);
+    LogEvent(EVENTCATEGORIES::System, error, "FS failure", settingsErrors[error]);
+    return false;
+  }
 
-  #ifdef __debugSettings
-  serializeJsonPretty(doc,Serial);
-  Serial.println();
-  #endif
+  return true;
+}
+
+bool saveSettings() {
+  uint8_t error = SaveConfig(appConfig);
 
-  File configFile = LittleFS.open("/config.json", "w");
-  if (!configFile) {
-    Serial.println("Failed to open config file for writing");
-    LogEvent(System, 4, "FS failure", "Failed to open config file for writing.");
+  if (error != SETTINGS_OK) {
+    Serial.println(settingsErrors[error]);
+    LogEvent(EVENTCATEGORIES::System, error, "FS failure", settingsErrors[error]);
     return false;
   }
-  serializeJson(doc, configFile);
-  configFile.close();
 
   return true;
 }
 
+//  Only writes if something changed since the last save
+bool flushSettings() {
+  return !configDirty || saveSettings();
+}
+
 void defaultSettings(){
   #ifdef __debugSettings
   strcpy(appConfig.ssid, DEBUG_WIFI_SSID);
@@ -284,6 +233,11 @@ void defaultSettings(){
   appConfig.heartbeatInterval = DEFAULT_HEARTBEAT_INTERVAL;
 
   appConfig.staircaseLightDelay = DEFAULT_STAIRCASE_LIGHT_DELAY;
+  for (size_t i = 0; i < RELAY_COUNT; i++) {
+    appConfig.zoneDelays[i] = 0;
+    appConfig.zoneRetrigger[i] = RETRIGGER_RESTART;
+  }
+
   appConfig.sunriseLightOffset = DEFAULT_SUNRISE_LIGHT_OFFSET;
   appConfig.sunsetLightOffset = DEFAULT_SUNSET_LIGHT_OFFSET;
 
@@ -294,196 +248,174 @@ void defaultSettings(){
   }
 }
 
-String DateTimeToString(time_t time){
-
-  String myTime = "";
-  char s[2];
-
-  //  years
-  itoa(year(time), s, DEC);
-  myTime+= s;
-  myTime+="-";
-
-
-  //  months
-  itoa(month(time), s, DEC);
-  myTime+= s;
-  myTime+="-";
-
-  //  days
-  itoa(day(time), s, DEC);
-  myTime+= s;
-
-  myTime+=" ";
-
-  //  hours
-  itoa(hour(time), s, DEC);
-  myTime+= s;
-  myTime+=":";
-
-  //  minutes
-  if(minute(time) <10)
-    myTime+="0";
+//  latitude and longitude are binary angles, see SUN_DEGREES() in sunfixed.h
+time_t CalculateSunData(time_t time, int32_t latitude, int32_t longitude, sunRiseSunset SunEvent){
+  #ifdef _use_sun_table
+  //  The table file for LATITUDE/LONGITUDE is checked or built by BootTaskCallback(),
+  //  long before the first NTP sync starts the sun data task
+  int16_t minutes = SunTableLookup(year(time), month(time), day(time), SunEvent);
+  if (minutes == SUN_TABLE_NO_EVENT) return -1;
+  long UT = minutes * 60L;
+  #else
+  long UT = SunEventSeconds(year(time), month(time), day(time), latitude, longitude, SunEvent);
+  if (UT == SUN_NO_EVENT) return -1;
+  #endif
 
-  itoa(minute(time), s, DEC);
-  myTime+= s;
-  myTime+=":";
+  //  10. convert UT value to local time zone of latitude/longitude
+  long localT = UT + 3600L * appConfig.timeZone;
 
-  //  seconds
-  if(second(time) <10)
-    myTime+="0";
+  time_t lastMidnight = now() - 3600 * hour(time) - 60 * minute(time) - second(time);
 
-  itoa(second(time), s, DEC);
-  myTime+= s;
+  if (timezones[appConfig.timeZone]->locIsDST(time)){
+    return lastMidnight + 3600 + localT;
+  } else{
+    return lastMidnight + localT;
+  }
 
-  return myTime;
 }
 
-String TimeIntervalToString(time_t time){
-
-  String myTime = "";
-  char s[2];
-
-  //  hours
-  itoa((time/3600), s, DEC);
-  myTime+= s;
-  myTime+=":";
-
-  //  minutes
-  if(minute(time) <10)
-    myTime+="0";
-
-  itoa(minute(time), s, DEC);
-  myTime+= s;
-  myTime+=":";
-
-  //  seconds
-  if(second(time) <10)
-    myTime+="0";
-
-  itoa(second(time), s, DEC);
-  myTime+= s;
-  return myTime;
+bool is_authenticated(){
+  #ifdef __debugSettings
+  return true;
+  #endif
+  if (server.hasHeader("Cookie")){
+    String cookie = server.header("Cookie");
+    if (cookie.indexOf("EspAuth=1") != -1) {
+      LogEvent(EVENTCATEGORIES::Authentication, 1, "Success", "");
+      return true;
+    }
+  }
+  LogEvent(EVENTCATEGORIES::Authentication, 2, "Failure", "");
+  return false;
 }
 
-time_t CalculateSunData(time_t time, double_t latitude, double_t longitude, sunRiseSunset SunEvent){
-  //  Using the algorithm found here:
-  //  http://williams.best.vwh.net/sunrise_sunset_algorithm.htm
-
-  double zenith = 90.83333333333333;
-  double D2R = 3.1415926 / 180;
-  double R2D = 180 / 3.1415926;
-
-  //  1. first calculate the day of the year
-  double N1 = floor(275 * month(time) / 9);
-  double N2 = floor((month(time) + 9) / 12);
-	double N3 = (1 + floor((year(time) - 4 * floor(year(time) / 4) + 2) / 3));
-	double N = N1 - (N2 * N3) + day(time) - 30;
-
-  //  2. convert the longitude to hour value and calculate an approximate time
-  double lngHour = longitude / 15;
-
-  double t = 0;
-  switch (SunEvent) {
-    case Sunrise:
-      t = N + ((6 - lngHour) / 24);
-      break;
-    case Sunset:
-      t = N + ((18 - lngHour) / 24);
-      break;
+void WriteDelayList(Print &out){
+  for (size_t i = 30; i < 151; i+=15) {
+    out.print("<option");
+    if (appConfig.staircaseLightDelay==i) out.print(" selected");
+    out.print(" value=\"");
+    out.print(i);
+    out.print("\">");
+    out.print(i);
+    out.print(" seconds</option>\n");
   }
+}
 
-  //  3. calculate the Sun's mean anomaly
-  double M = (0.9856 * t) - 3.289;
+void WriteOffsetList(Print &out, int selected, const char *event){
+  for (int i = -60; i <= 60; i+=10) {
+    out.print("<option");
+    if (selected==i) out.print(" selected");
+    out.print(" value=\"");
+    out.print(i);
+    out.print("\">");
+    if (i==0){
+      out.print(" exactly at ");
+    }
+    else{
+      out.print(abs(i));
+      out.print(i<0 ? " minutes before " : " minutes after ");
+    }
+    out.print(event);
+    out.print("</option>\n");
+  }
+}
 
-  //  4. calculate the Sun's true longitude
-  double L = M + (1.916 * sin(M * D2R)) + (0.020 * sin(2 * M * D2R)) + 282.634;
-  if (L>360) L-=360;
-  if (L<0) L+=360;
+void WriteTimezonesList(Print &out){
+  for (unsigned long i = 0; i < sizeof(tzDescriptions)/sizeof(tzDescriptions[0]); i++) {
+    out.print("<option ");
+    if (appConfig.timeZone == i){
+      out.print("selected ");
+    }
+    out.print("value=\"");
+    out.print(i);
+    out.print("\">");
+    out.print(tzDescriptions[i]);
+    out.print("</option>\n");
+  }
+}
 
-  //  5a. calculate the Sun's right ascension
-  double RA = R2D * atan(0.91764 * tan(L * D2R));
-  if (RA>360) RA-=360;
-  if (RA<0) RA+=360;
+void WriteWifiList(Print &out){
+  for (int8_t i = 0; i < pageNetworkCount; i++) {
+    out.print("<div class=\"radio\"><label><input ");
+    if (i==0) out.print("id=\"ssid\" ");
 
-  //  5b. right ascension value needs to be in the same quadrant as L
-  double Lquadrant = (floor( L/90)) * 90;
-  double RAquadrant = (floor(RA/90)) * 90;
-  RA = RA + (Lquadrant - RAquadrant);
+    out.print("type=\"radio\" name=\"ssid\" value=\"");
+    out.print(WiFi.SSID(i));
+    out.print("\">");
+    out.print(WiFi.SSID(i));
+    out.print("</label></div>");
+  }
+}
 
-  //  5c. right ascension value needs to be converted into hours
-  RA = RA / 15;
+void WritePageField(Print &out, uint8_t field){
+  bool isAP = WiFi.getMode() == WIFI_AP;
 
-  //  6. calculate the Sun's declination
-  double sinDec = 0.39782 * sin(L * D2R);
-	double cosDec = cos(asin(sinDec));
+  switch (field) {
+    case FIELD_PAGEHEADER:        RenderTemplate(headerTemplate, out, WritePageField); break;
+    case FIELD_YEAR:              out.print(year(pageLocalTime)); break;
+    case FIELD_ALERT:             out.print(pageAlert); break;
 
-  //  7a. calculate the Sun's local hour angle
-  double cosH = (cos(zenith * D2R) - (sinDec * sin(latitude * D2R))) / (cosDec * cos(latitude * D2R));
+    //  System information
+    case FIELD_ESPID:
+    case FIELD_CHIPID:            out.print(ESP.getChipId()); break;
+    case FIELD_HARDWAREID:        out.print(HARDWARE_ID); break;
+    case FIELD_HARDWAREVERSION:   out.print(HARDWARE_VERSION); break;
+    case FIELD_SOFTWAREID:
+    case FIELD_FIRMWAREID:        out.print(SOFTWARE_ID); break;
+    case FIELD_FIRMWAREVERSION:   out.print(FIRMWARE_VERSION); break;
+    case FIELD_BUILDNUMBER:       out.print(BUILD_NUMBER); break;
+    case FIELD_UPTIME:            PrintInterval(out, millis()/1000); break;
+    case FIELD_CURRENTTIME:       PrintDateTime(out, pageLocalTime, ' '); break;
+    case FIELD_LASTRESETREASON:   out.print(ESP.getResetReason()); break;
+    case FIELD_FLASHCHIPSIZE:     out.print(ESP.getFlashChipSize()); break;
+    case FIELD_FLASHCHIPSPEED:    out.print(ESP.getFlashChipSpeed()); break;
+    case FIELD_FREEHEAPSIZE:      out.print(ESP.getFreeHeap()); break;
+    case FIELD_FREESKETCHSPACE:   out.print(ESP.getFreeSketchSpace()); break;
+    case FIELD_FRIENDLYNAME:      out.print(appConfig.friendlyName); break;
+    case FIELD_HEARTBEATINTERVAL: out.print(appConfig.heartbeatInterval); break;
 
-  if (cosH >  1) return -1;
-  if (cosH < -1) return -1;
+    //  MQTT settings
+    case FIELD_MQTT_SERVERNAME:   out.print(appConfig.mqttServer); break;
+    case FIELD_MQTT_PORT:         out.print(appConfig.mqttPort); break;
+    case FIELD_MQTT_TOPIC:        out.print(appConfig.mqttTopic); break;
 
-  //  7b. finish calculating H and convert into hours
-  double H = 0;
-  switch (SunEvent) {
-    case Sunrise:
-      H = 360 - R2D * acos(cosH);
-      break;
-    case Sunset:
-      H = R2D * acos(cosH);
+    //  Network settings
+    case FIELD_WIFIMODE:          out.print(isAP ? "Access Point" : "Station"); break;
+    case FIELD_MACADDRESS:        out.print(isAP ? WiFi.softAPmacAddress() : WiFi.macAddress()); break;
+    case FIELD_NETWORKADDRESS:    out.print(isAP ? WiFi.softAPIP().toString() : WiFi.localIP().toString()); break;
+    case FIELD_SSID:              out.print(WiFi.SSID()); break;
+    case FIELD_SUBNETMASK:        out.print(isAP ? String("n/a") : WiFi.subnetMask().toString()); break;
+    case FIELD_GATEWAY:           out.print(isAP ? String("n/a") : WiFi.gatewayIP().toString()); break;
+    case FIELD_WIFILIST:          WriteWifiList(out); break;
+
+    //  Lists
+    case FIELD_DELAYLIST:         WriteDelayList(out); break;
+    case FIELD_SUNSETOFFSETLIST:  WriteOffsetList(out, appConfig.sunsetLightOffset, "sunset"); break;
+    case FIELD_SUNRISEOFFSETLIST: WriteOffsetList(out, appConfig.sunriseLightOffset, "sunrise"); break;
+    case FIELD_TIMEZONESLIST:     WriteTimezonesList(out); break;
+
+    default:
       break;
   }
+}
 
-  //  8. calculate local mean time of rising/setting
-  double T = H + RA - (0.06571 * t) - 6.622;
-
-  //  9. adjust back to UTC
-  double UT = T - lngHour;
-  if (UT<0) UT +=24;
-  if (UT>24) UT -=24;
-
-  //  10. convert UT value to local time zone of latitude/longitude
-  double localT = UT + appConfig.timeZone;
-  double num = localT;
-  int hours = floor(localT);
-
-  num-=floor(localT);
-  num*=60;
-  int minutes = floor(num);
-
-  num-=floor(num);
-  num*=60;
-
-  int seconds = num;
-
-  time_t lastMidnight = now() - 3600 * hour(time) - 60 * minute(time) - second(time);
+void SendPage(PAGE page){
+  pageLocalTime = timezones[appConfig.timeZone]->toLocal(now(), &tcr);
 
-  if (timezones[appConfig.timeZone]->locIsDST(time)){
-    return lastMidnight + 3600 * (hours + 1) + 60 * minutes + seconds;
-  } else{
-    return lastMidnight + 3600 * hours + 60 * minutes + seconds;
+  if (!LittleFS.exists(pageTemplates[page].path)){
+    server.send(500, "text/plain", "Failed to render page.");
+    return;
   }
 
-}
+  ChunkedResponse response(server);
 
-bool is_authenticated(){
-  #ifdef __debugSettings
-  return true;
-  #endif
-  if (server.hasHeader("Cookie")){
-    String cookie = server.header("Cookie");
-    if (cookie.indexOf("EspAuth=1") != -1) {
-      LogEvent(EVENTCATEGORIES::Authentication, 1, "Success", "");
-      return true;
-    }
-  }
-  LogEvent(EVENTCATEGORIES::Authentication, 2, "Failure", "");
-  return false;
+  response.begin(200, "text/html");
+  RenderTemplate(pageTemplates[page], response, WritePageField);
+  response.end();
 }
 
 void handleLogin(){
-  String msg = "";
+  pageAlert = "";
   if (server.hasHeader("Cookie")){
     String cookie = server.header("Cookie");
   }
@@ -500,32 +432,11 @@ void handleLogin(){
       LogEvent(EVENTCATEGORIES::Login, 2, "Success", "User name: " + server.arg("username"));
       return;
     }
-    msg = "<div class=\"alert alert-danger\"><strong>Error!</strong> Wrong user name and/or password specified.<a href=\"#\" class=\"close\" data-dismiss=\"alert\" aria-label=\"close\">&times;</a></div>";
+    pageAlert = "<div class=\"alert alert-danger\"><strong>Error!</strong> Wrong user name and/or password specified.<a href=\"#\" class=\"close\" data-dismiss=\"alert\" aria-label=\"close\">&times;</a></div>";
     LogEvent(EVENTCATEGORIES::Login, 2, "Failure", "User name: " + server.arg("username") + " - Password: " + server.arg("password"));
   }
 
-  File f = LittleFS.open("/pageheader.html", "r");
-  String headerString;
-  if (f.available()) headerString = f.readString();
-  f.close();
-
-  time_t localTime = timezones[appConfig.timeZone]->toLocal(now(), &tcr);
-
-  f = LittleFS.open("/login.html", "r");
-
-  String s, htmlString;
-
-  while (f.available()){
-    s = f.readStringUntil('\n');
-
-    if (s.indexOf("%pageheader%")>-1) s.replace("%pageheader%", headerString);
-    if (s.indexOf("%year%")>-1) s.replace("%year%", (String)year(localTime));
-    if (s.indexOf("%alert%")>-1) s.replace("%alert%", msg);
-
-    htmlString+=s;
-  }
-  f.close();
-  server.send(200, "text/html", htmlString);
+  SendPage(PAGE_LOGIN);
   LogEvent(PageHandler, 2, "Page served", "/");
 }
 
@@ -538,34 +449,7 @@ void handleRoot() {
     return;
   }
 
-  File f = LittleFS.open("/pageheader.html", "r");
-  String headerString;
-  if (f.available()) headerString = f.readString();
-  f.close();
-
-  time_t localTime = timezones[appConfig.timeZone]->toLocal(now(), &tcr);
-
-  f = LittleFS.open("/index.html", "r");
-
-  String FirmwareVersionString = String(FIRMWARE_VERSION);
-
-  String s, htmlString;
-
-  while (f.available()){
-    s = f.readStringUntil('\n');
-
-    if (s.indexOf("%pageheader%")>-1) s.replace("%pageheader%", headerString);
-    if (s.indexOf("%year%")>-1) s.replace("%year%", (String)year(localTime));
-    if (s.indexOf("%espid%")>-1) s.replace("%espid%", (String)ESP.getChipId());
-    if (s.indexOf("%hardwareid%")>-1) s.replace("%hardwareid%", HARDWARE_ID);
-    if (s.indexOf("%hardwareversion%")>-1) s.replace("%hardwareversion%", HARDWARE_VERSION);
-    if (s.indexOf("%softwareid%")>-1) s.replace("%softwareid%", SOFTWARE_ID);
-    if (s.indexOf("%firmwareversion%")>-1) s.replace("%firmwareversion%", FirmwareVersionString);
-
-    htmlString+=s;
-  }
-  f.close();
-  server.send(200, "text/html", htmlString);
+  SendPage(PAGE_INDEX);
   LogEvent(EVENTCATEGORIES::PageHandler, 2, "Page served", "/");
 }
 
@@ -578,68 +462,7 @@ void handleStatus() {
      return;
   }
 
-  File f = LittleFS.open("/pageheader.html", "r");
-  String headerString;
-  if (f.available()) headerString = f.readString();
-  f.close();
-
-  time_t localTime = timezones[appConfig.timeZone]->toLocal(now(), &tcr);
-
-  String s;
-
-  f = LittleFS.open("/status.html", "r");
-
-  String FirmwareVersionString = String(FIRMWARE_VERSION);
-  String htmlString, ds18b20list;
-
-  while (f.available()){
-    s = f.readStringUntil('\n');
-
-    //  System information
-    if (s.indexOf("%pageheader%")>-1) s.replace("%pageheader%", headerString);
-    if (s.indexOf("%year%")>-1) s.replace("%year%", (String)year(localTime));
-    if (s.indexOf("%chipid%")>-1) s.replace("%chipid%", (String)ESP.getChipId());
-    if (s.indexOf("%hardwareid%")>-1) s.replace("%hardwareid%", HARDWARE_ID);
-    if (s.indexOf("%hardwareversion%")>-1) s.replace("%hardwareversion%", HARDWARE_VERSION);
-    if (s.indexOf("%firmwareid%")>-1) s.replace("%firmwareid%", SOFTWARE_ID);
-    if (s.indexOf("%firmwareversion%")>-1) s.replace("%firmwareversion%", FirmwareVersionString);
-    if (s.indexOf("%uptime%")>-1) s.replace("%uptime%", TimeIntervalToString(millis()/1000));
-    if (s.indexOf("%currenttime%")>-1) s.replace("%currenttime%", DateTimeToString(localTime));
-    if (s.indexOf("%lastresetreason%")>-1) s.replace("%lastresetreason%", ESP.getResetReason());
-    if (s.indexOf("%flashchipsize%")>-1) s.replace("%flashchipsize%",String(ESP.getFlashChipSize()));
-    if (s.indexOf("%flashchipspeed%")>-1) s.replace("%flashchipspeed%",String(ESP.getFlashChipSpeed()));
-    if (s.indexOf("%freeheapsize%")>-1) s.replace("%freeheapsize%",String(ESP.getFreeHeap()));
-    if (s.indexOf("%freesketchspace%")>-1) s.replace("%freesketchspace%",String(ESP.getFreeSketchSpace()));
-    if (s.indexOf("%friendlyname%")>-1) s.replace("%friendlyname%",appConfig.friendlyName);
-    if (s.indexOf("%mqtt-topic%")>-1) s.replace("%mqtt-topic%",appConfig.mqttTopic);
-
-    //  Network settings
-    switch (WiFi.getMode()) {
-      case WIFI_AP:
-        if (s.indexOf("%wifimode%")>-1) s.replace("%wifimode%", "Access Point");
-        if (s.indexOf("%macaddress%")>-1) s.replace("%macaddress%",String(WiFi.softAPmacAddress()));
-        if (s.indexOf("%networkaddress%")>-1) s.replace("%networkaddress%",WiFi.softAPIP().toString());
-        if (s.indexOf("%ssid%")>-1) s.replace("%ssid%",String(WiFi.SSID()));
-        if (s.indexOf("%subnetmask%")>-1) s.replace("%subnetmask%","n/a");
-        if (s.indexOf("%gateway%")>-1) s.replace("%gateway%","n/a");
-        break;
-      case WIFI_STA:
-        if (s.indexOf("%wifimode%")>-1) s.replace("%wifimode%", "Station");
-        if (s.indexOf("%macaddress%")>-1) s.replace("%macaddress%",String(WiFi.macAddress()));
-        if (s.indexOf("%networkaddress%")>-1) s.replace("%networkaddress%",WiFi.localIP().toString());
-        if (s.indexOf("%ssid%")>-1) s.replace("%ssid%",String(WiFi.SSID()));
-        if (s.indexOf("%subnetmask%")>-1) s.replace("%subnetmask%",WiFi.subnetMask().toString());
-        if (s.indexOf("%gateway%")>-1) s.replace("%gateway%",WiFi.gatewayIP().toString());
-        break;
-      default:
-        //  This should not happen...
-        break;
-    }
-
-      htmlString+=s;
-    }
-    f.close();
-  server.send(200, "text/html", htmlString);
+  SendPage(PAGE_STATUS);
   LogEvent(EVENTCATEGORIES::PageHandler, 2, "Page served", "status.html");
 }
 
@@ -653,11 +476,14 @@ void handleStaircaseLightTimer() {
    }
 
   if (server.method() == HTTP_POST){  //  POST
+    config previous = appConfig;
+
     if (server.hasArg("timerValue")){
       appConfig.staircaseLightDelay = server.arg("timerValue").toInt();
       LogEvent(EVENTCATEGORIES::StaircaselightDelay, 1, "New delay", server.arg("timerValue").c_str());
     }
-    saveSettings();
+
+    if (ReconfigApply(previous, appConfig)) ConfigChanged();
 
     if (PSclient.connected()){
 
@@ -671,49 +497,17 @@ void handleStaircaseLightTimer() {
       Serial.println();
       #endif
 
-      String myJsonString;
+      char payload[MQTT_PAYLOAD_LENGTH];
 
-      serializeJson(doc, myJsonString);
+      serializeJson(doc, payload, sizeof(payload));
 
-      PSclient.publish((MQTT_CUSTOMER + String("/") + MQTT_PROJECT + "/" + ESP.getChipId() + "/settings/").c_str(), myJsonString.c_str(), false );
+      MqttPublish(PSclient, TOPIC_SETTINGS, payload);
     }
   }
 
-  File f = LittleFS.open("/pageheader.html", "r");
-  String headerString;
-  if (f.available()) headerString = f.readString();
-  f.close();
-
-  time_t localTime = timezones[appConfig.timeZone]->toLocal(now(), &tcr);
-
-  f = LittleFS.open("/staircaselighttimer.html", "r");
-
-  String s, htmlString, delaylist;
-
-  delaylist = "";
-  for (size_t i = 30; i < 151; i+=15) {
-    delaylist+="<option";
-    if (appConfig.staircaseLightDelay==i) delaylist+=" selected";
-    delaylist+=" value=\"";
-    delaylist+=(String)i;
-    delaylist+="\">";
-    delaylist+=(String)i;
-    delaylist+=" seconds</option>";
-    delaylist+="\n";
-  }
-
-  while (f.available()){
-    s = f.readStringUntil('\n');
-
-    if (s.indexOf("%pageheader%")>-1) s.replace("%pageheader%", headerString);
-    if (s.indexOf("%year%")>-1) s.replace("%year%", (String)year(localTime));
-    if (s.indexOf("%delaylist%")>-1) s.replace("%delaylist%", delaylist);
-    htmlString+=s;
-  }
-  f.close();
-  server.send(200, "text/html", htmlString);
-  LogEvent(EVENTCATEGORIES::PageHandler, 2, "Page served", "staircaselighttimer.html");
-}
+  SendPage(PAGE_STAIRCASELIGHTTIMER);
+  LogEvent(EVENTCATEGORIES::PageHandler, 2, "Page served", "staircaselighttimer.html");
+}
 
 void handleEntranceLight() {
   LogEvent(EVENTCATEGORIES::PageHandler, 1, "Page requested", "entrancelight.html");
@@ -725,6 +519,8 @@ void handleEntranceLight() {
    }
 
   if (server.method() == HTTP_POST){  //  POST
+    config previous = appConfig;
+
     for (int i = 0; i < server.args(); i++) {
       Serial.print(server.argName(i));
       Serial.print(": ");
@@ -738,67 +534,11 @@ void handleEntranceLight() {
       appConfig.sunsetLightOffset = server.arg("sunsetOffset").toInt();
       LogEvent(EVENTCATEGORIES::EntranceLight, 1, "New sunset offset", server.arg("sunsetOffset").c_str());
     }
-    saveSettings();
-  }
-
-  File f = LittleFS.open("/pageheader.html", "r");
-  String headerString;
-  if (f.available()) headerString = f.readString();
-  f.close();
-
-  time_t localTime = timezones[appConfig.timeZone]->toLocal(now(), &tcr);
-
-  f = LittleFS.open("/entrancelight.html", "r");
 
-  String s, htmlString, sunsetoffsetlist, sunriseoffsetlist;
-
-
-  sunsetoffsetlist = "";
-  for (int i = -60; i <= 60; i+=10) {
-    sunsetoffsetlist+="<option";
-    if (appConfig.sunsetLightOffset==i) sunsetoffsetlist+=" selected";
-    sunsetoffsetlist+=" value=\"";
-    sunsetoffsetlist+=(String)(i);
-    sunsetoffsetlist+="\">";
-    if(i==0) sunsetoffsetlist+=" exactly at sunset</option>";
-      else{
-        sunsetoffsetlist+=(String)(abs(i));
-        if(i<0) sunsetoffsetlist+=" minutes before sunset</option>";
-        else
-        if(i>0) sunsetoffsetlist+=" minutes after sunset</option>";
-      }
-
-    sunsetoffsetlist+="\n";
-  }
-
-  sunriseoffsetlist = "";
-  for (int i = -60; i <= 60; i+=10) {
-    sunriseoffsetlist+="<option";
-    if (appConfig.sunriseLightOffset==i) sunriseoffsetlist+=" selected";
-    sunriseoffsetlist+=" value=\"";
-    sunriseoffsetlist+=(String)i;
-    sunriseoffsetlist+="\">";
-    if(i==0) sunriseoffsetlist+=" exactly at sunrise</option>";
-      else{
-        sunriseoffsetlist+=(String)(abs(i));
-        if(i<0) sunriseoffsetlist+=" minutes before sunrise</option>";
-        else
-        if(i>0) sunriseoffsetlist+=" minutes after sunrise</option>";
-      }
-    sunriseoffsetlist+="\n";
+    if (ReconfigApply(previous, appConfig)) ConfigChanged();
   }
 
-  while (f.available()){
-    s = f.readStringUntil('\n');
-
-    if (s.indexOf("%pageheader%")>-1) s.replace("%pageheader%", headerString);
-    if (s.indexOf("%year%")>-1) s.replace("%year%", (String)year(localTime));
-    if (s.indexOf("%sunsetoffsetlist%")>-1) s.replace("%sunsetoffsetlist%", sunsetoffsetlist);
-    if (s.indexOf("%sunriseoffsetlist%")>-1) s.replace("%sunriseoffsetlist%", sunriseoffsetlist);
-    htmlString+=s;
-  }
-  f.close();
-  server.send(200, "text/html", htmlString);
+  SendPage(PAGE_ENTRANCELIGHT);
   LogEvent(EVENTCATEGORIES::PageHandler, 2, "Page served", "entrancelight.html");
 }
 
@@ -812,107 +552,62 @@ void handleGeneralSettings() {
    }
 
   if (server.method() == HTTP_POST){  //  POST
-    bool mqttDirty = false;
+    config previous = appConfig;
 
     if (server.hasArg("timezoneselector")){
-      signed char oldTimeZone = appConfig.timeZone;
       appConfig.timeZone = atoi(server.arg("timezoneselector").c_str());
-
-      adjustTime((appConfig.timeZone - oldTimeZone) * SECS_PER_HOUR);
-
       LogEvent(EVENTCATEGORIES::TimeZoneChange, 1, "New time zone", "UTC " + server.arg("timezoneselector"));
     }
 
     if (server.hasArg("friendlyname")){
-      strcpy(appConfig.friendlyName, server.arg("friendlyname").c_str());
+      strlcpy(appConfig.friendlyName, server.arg("friendlyname").c_str(), sizeof(appConfig.friendlyName));
       LogEvent(EVENTCATEGORIES::FriendlyNameChange, 1, "New friendly name", appConfig.friendlyName);
     }
 
     if (server.hasArg("heartbeatinterval")){
-      os_timer_disarm(&heartbeatTimer);
-      appConfig.heartbeatInterval = server.arg("heartbeatinterval").toInt();
-      LogEvent(EVENTCATEGORIES::HeartbeatIntervalChange, 1, "New Heartbeat interval", (String)appConfig.heartbeatInterval);
-      os_timer_arm(&heartbeatTimer, appConfig.heartbeatInterval * 1000, true);
+      long heartbeatInterval = server.arg("heartbeatinterval").toInt();
+
+      //  Rejected rather than clamped, like the MQTT topic below
+      if (!HeartbeatIntervalValid(heartbeatInterval)){
+        LogEvent(EVENTCATEGORIES::HeartbeatIntervalChange, 2, "Invalid Heartbeat interval", server.arg("heartbeatinterval"));
+      }
+      else {
+        appConfig.heartbeatInterval = heartbeatInterval;
+        LogEvent(EVENTCATEGORIES::HeartbeatIntervalChange, 1, "New Heartbeat interval", (String)appConfig.heartbeatInterval);
+      }
     }
 
     //  MQTT settings
     if (server.hasArg("mqttbroker")){
       if ((String)appConfig.mqttServer != server.arg("mqttbroker")){
-        mqttDirty = true;
-        sprintf(appConfig.mqttServer, "%s", server.arg("mqttbroker").c_str());
+        strlcpy(appConfig.mqttServer, server.arg("mqttbroker").c_str(), sizeof(appConfig.mqttServer));
         LogEvent(EVENTCATEGORIES::MqttParamChange, 1, "New MQTT broker", appConfig.mqttServer);
       }
     }
 
     if (server.hasArg("mqttport")){
       if (appConfig.mqttPort != atoi(server.arg("mqttport").c_str())){
-        mqttDirty = true;
         appConfig.mqttPort = atoi(server.arg("mqttport").c_str());
         LogEvent(EVENTCATEGORIES::MqttParamChange, 2, "New MQTT port", server.arg("mqttport").c_str());
       }
     }
 
     if (server.hasArg("mqtttopic")){
-      if ((String)appConfig.mqttTopic != server.arg("mqtttopic")){
-        mqttDirty = true;
-        sprintf(appConfig.mqttTopic, "%s", server.arg("mqtttopic").c_str());
+      //  Rejected rather than cut, the topics are sized for MQTT_NODE_TOPIC_LENGTH
+      if (!MqttNodeTopicValid(server.arg("mqtttopic").c_str())){
+        LogEvent(EVENTCATEGORIES::MqttParamChange, 3, "Invalid MQTT topic", server.arg("mqtttopic"));
+      }
+      else if ((String)appConfig.mqttTopic != server.arg("mqtttopic")){
+        strlcpy(appConfig.mqttTopic, server.arg("mqtttopic").c_str(), sizeof(appConfig.mqttTopic));
         LogEvent(EVENTCATEGORIES::MqttParamChange, 1, "New MQTT topic", appConfig.mqttTopic);
       }
     }
 
-    if (mqttDirty)
-      PSclient.disconnect();
-
-    saveSettings();
-    ESP.reset();
-
-  }
-
-  File f = LittleFS.open("/pageheader.html", "r");
-  String headerString;
-  if (f.available()) headerString = f.readString();
-  f.close();
-
-  time_t localTime = timezones[appConfig.timeZone]->toLocal(now(), &tcr);
-
-  f = LittleFS.open("/generalsettings.html", "r");
-
-  String s, htmlString, timezoneslist;
-
-  char ss[2];
-
-  for (unsigned long i = 0; i < sizeof(tzDescriptions)/sizeof(tzDescriptions[0]); i++) {
-    itoa(i, ss, DEC);
-    timezoneslist+="<option ";
-    if (appConfig.timeZone == i){
-      timezoneslist+= "selected ";
-    }
-    timezoneslist+= "value=\"";
-    timezoneslist+=ss;
-    timezoneslist+="\">";
-
-    timezoneslist+= tzDescriptions[i];
-
-    timezoneslist+="</option>";
-    timezoneslist+="\n";
+    //  Only the subsystems whose settings changed are restarted
+    if (ReconfigApply(previous, appConfig)) ConfigChanged();
   }
 
-  while (f.available()){
-    s = f.readStringUntil('\n');
-
-    if (s.indexOf("%pageheader%")>-1) s.replace("%pageheader%", headerString);
-    if (s.indexOf("%year%")>-1) s.replace("%year%", (String)year(localTime));
-    if (s.indexOf("%mqtt-servername%")>-1) s.replace("%mqtt-servername%", appConfig.mqttServer);
-    if (s.indexOf("%mqtt-port%")>-1) s.replace("%mqtt-port%", String(appConfig.mqttPort));
-    if (s.indexOf("%mqtt-topic%")>-1) s.replace("%mqtt-topic%", appConfig.mqttTopic);
-    if (s.indexOf("%timezoneslist%")>-1) s.replace("%timezoneslist%", timezoneslist);
-    if (s.indexOf("%friendlyname%")>-1) s.replace("%friendlyname%", appConfig.friendlyName);
-    if (s.indexOf("%heartbeatinterval%")>-1) s.replace("%heartbeatinterval%", (String)appConfig.heartbeatInterval);
-
-    htmlString+=s;
-  }
-  f.close();
-  server.send(200, "text/html", htmlString);
+  SendPage(PAGE_GENERALSETTINGS);
 
   LogEvent(EVENTCATEGORIES::PageHandler, 2, "Page served", "generalsettings.html");
 }
@@ -930,46 +625,18 @@ void handleNetworkSettings() {
     if (server.hasArg("ssid")){
       strcpy(appConfig.ssid, server.arg("ssid").c_str());
       strcpy(appConfig.password, server.arg("password").c_str());
-      saveSettings();
+      ConfigChanged();
 
       isAccessPoint=false;
       connectionState = STATE_CHECK_WIFI_CONNECTION;
       WiFi.disconnect(false);
 
-      ESP.reset();
+      ResetNode();
     }
   }
 
-  File f = LittleFS.open("/pageheader.html", "r");
-
-  String headerString;
-
-  if (f.available()) headerString = f.readString();
-  f.close();
-
-  time_t localTime = timezones[appConfig.timeZone]->toLocal(now(), &tcr);
-
-  f = LittleFS.open("/networksettings.html", "r");
-  String s, htmlString, wifiList;
-
-  byte numberOfNetworks = WiFi.scanNetworks();
-  for (size_t i = 0; i < numberOfNetworks; i++) {
-    wifiList+="<div class=\"radio\"><label><input ";
-    if (i==0) wifiList+="id=\"ssid\" ";
-
-    wifiList+="type=\"radio\" name=\"ssid\" value=\"" + WiFi.SSID(i) + "\">" + WiFi.SSID(i) + "</label></div>";
-  }
-
-  while (f.available()){
-    s = f.readStringUntil('\n');
-
-    if (s.indexOf("%pageheader%")>-1) s.replace("%pageheader%", headerString);
-    if (s.indexOf("%year%")>-1) s.replace("%year%", (String)year(localTime));
-    if (s.indexOf("%wifilist%")>-1) s.replace("%wifilist%", wifiList);
-      htmlString+=s;
-    }
-    f.close();
-  server.send(200, "text/html", htmlString);
+  pageNetworkCount = WiFi.scanNetworks();
+  SendPage(PAGE_NETWORKSETTINGS);
 
   LogEvent(EVENTCATEGORIES::PageHandler, 2, "Page served", "networksettings.html");
 }
@@ -988,36 +655,16 @@ void handleTools() {
     if (server.hasArg("reset")){
       LogEvent(EVENTCATEGORIES::Reboot, 1, "Reset", "");
       defaultSettings();
-      ESP.reset();
+      ResetNode();
     }
 
     if (server.hasArg("restart")){
       LogEvent(EVENTCATEGORIES::Reboot, 2, "Restart", "");
-      ESP.reset();
+      ResetNode();
     }
   }
 
-  File f = LittleFS.open("/pageheader.html", "r");
-  String headerString;
-  if (f.available()) headerString = f.readString();
-  f.close();
-
-  time_t localTime = timezones[appConfig.timeZone]->toLocal(now(), &tcr);
-
-  f = LittleFS.open("/tools.html", "r");
-
-  String s, htmlString;
-
-  while (f.available()){
-    s = f.readStringUntil('\n');
-
-    if (s.indexOf("%pageheader%")>-1) s.replace("%pageheader%", headerString);
-    if (s.indexOf("%year%")>-1) s.replace("%year%", (String)year(localTime));
-
-      htmlString+=s;
-    }
-    f.close();
-  server.send(200, "text/html", htmlString);
+  SendPage(PAGE_TOOLS);
 
   LogEvent(EVENTCATEGORIES::PageHandler, 2, "Page served", "tools.html");
 }
@@ -1031,6 +678,8 @@ void handleTools() {
 */
 
 void handleNotFound(){
+  if (ServeStaticFile(server)) return;
+
   String message = "File Not Found\n\n";
   message += "URI: ";
   message += server.uri();
@@ -1045,18 +694,319 @@ void handleNotFound(){
   server.send(404, "text/plain", message);
 }
 
+//  JSON API, the documents are serialized straight into the response
+bool ApiAuthenticated(){
+  if (is_authenticated()) return true;
+
+  server.send(401, "application/json", "{\"Error\":\"Not authenticated\"}");
+  return false;
+}
+
+void SendJson(JsonDocument &doc){
+  ChunkedResponse response(server);
+
+  server.sendHeader("Cache-Control", "no-cache");
+  response.begin(200, "application/json");
+  serializeJson(doc, response);
+  response.end();
+}
+
+void handleApiStatus(){
+  if (!ApiAuthenticated()) return;
+
+  //  Reset reason, SSID, MAC and IP are copied into the document
+  const size_t capacity = JSON_OBJECT_SIZE(14) + JSON_OBJECT_SIZE(5) + JSON_OBJECT_SIZE(2) + 128;
+  StaticJsonDocument<capacity> doc;
+
+  doc["Node"] = ESP.getChipId();
+  doc["FriendlyName"] = (const char*)appConfig.friendlyName;
+  doc["Firmware"] = FIRMWARE_VERSION_SHORT;
+  doc["Uptime"] = millis() / 1000;
+  doc["Time"] = (unsigned long)now();
+  doc["TimeSynced"] = ntp.synced;
+  doc["Freeheap"] = ESP.getFreeHeap();
+  doc["MaxFreeBlock"] = ESP.getMaxFreeBlockSize();
+  doc["HeapFragmentation"] = ESP.getHeapFragmentation();
+  doc["I2CRate"] = i2cTransactionsPerSecond;
+  doc["LastResetReason"] = ESP.getResetReason();
+
+  JsonObject wifiDetails = doc.createNestedObject("Wifi");
+  wifiDetails["SSId"] = WiFi.SSID();
+  wifiDetails["RSSI"] = WiFi.RSSI();
+  wifiDetails["MACAddress"] = WiFi.macAddress();
+  wifiDetails["IPAddress"] = WiFi.localIP().toString();
+  wifiDetails["InternetConnected"] = connectionState == STATE_INTERNET_CONNECTED;
+
+  JsonObject mqttDetails = doc.createNestedObject("Mqtt");
+  mqttDetails["Connected"] = PSclient.connected();
+  mqttDetails["Publishes"] = mqttStats.publishes;
+
+  SendJson(doc);
+}
+
+void handleApiRelays(){
+  if (!ApiAuthenticated()) return;
+
+  const size_t capacity = JSON_ARRAY_SIZE(RELAY_COUNT) + RELAY_COUNT * JSON_OBJECT_SIZE(5);
+  StaticJsonDocument<capacity> doc;
+
+  for (uint8_t i = 0; i < RELAY_COUNT; i++) {
+    JsonObject relay = doc.createNestedObject();
+    relay["Channel"] = i;
+    relay["On"] = RelayIsOn(i);
+    relay["Duration"] = zones[i].duration / 1000;
+    relay["Remaining"] = (ZoneRemaining(i) + 999) / 1000;
+    relay["Retrigger"] = (uint8_t)zones[i].policy;
+  }
+
+  SendJson(doc);
+}
+
+void WriteJournalRecord(Print &out, const eventRecord_t &record, uint32_t index){
+  StaticJsonDocument<JSON_OBJECT_SIZE(7)> doc;
+
+  if (index > 0) out.print(',');
+  EventRecordToJson(record, doc.to<JsonObject>());
+  serializeJson(doc, out);
+}
+
+//  The newest ?limit= records of the journal, streamed from the segments
+void handleApiLog(){
+  if (!ApiAuthenticated()) return;
+
+  uint32_t limit = server.hasArg("limit") ? server.arg("limit").toInt() : JOURNAL_API_DEFAULT_LIMIT;
+
+  JournalFlush();
+  uint32_t records = JournalCount();
+
+  ChunkedResponse response(server);
+
+  server.sendHeader("Cache-Control", "no-cache");
+  response.begin(200, "application/json");
+  response.print('[');
+  JournalRead(response, WriteJournalRecord, records > limit ? records - limit : 0);
+  response.print(']');
+  response.end();
+}
+
+void handleApiConfig(){
+  if (!ApiAuthenticated()) return;
+
+  const size_t capacity = JSON_OBJECT_SIZE(11) + 2 * JSON_ARRAY_SIZE(RELAY_COUNT);
+  StaticJsonDocument<capacity> doc;
+
+  //  No passwords here
+  doc["FriendlyName"] = (const char*)appConfig.friendlyName;
+  doc["HeartbeatInterval"] = appConfig.heartbeatInterval;
+  doc["TimeZone"] = appConfig.timeZone;
+  doc["SSId"] = (const char*)appConfig.ssid;
+  doc["MqttServer"] = (const char*)appConfig.mqttServer;
+  doc["MqttPort"] = appConfig.mqttPort;
+  doc["MqttTopic"] = (const char*)appConfig.mqttTopic;
+  doc["StaircaseLightDelay"] = appConfig.staircaseLightDelay;
+  doc["SunriseLightOffset"] = appConfig.sunriseLightOffset;
+  doc["SunsetLightOffset"] = appConfig.sunsetLightOffset;
+
+  JsonArray zoneDelays = doc.createNestedArray("ZoneDelays");
+  JsonArray zoneRetrigger = doc.createNestedArray("ZoneRetrigger");
+  for (uint8_t i = 0; i < RELAY_COUNT; i++) {
+    zoneDelays.add(appConfig.zoneDelays[i]);
+    zoneRetrigger.add(appConfig.zoneRetrigger[i]);
+  }
+
+  SendJson(doc);
+}
+
+//  Export and import in the /config.json format, see settings.h. New WiFi
+//  credentials are stored but, like on the network page, only used after a
+//  restart.
+void handleApiSettings(){
+  if (!ApiAuthenticated()) return;
+
+  StaticJsonDocument<JSON_SETTINGS_SIZE> doc;
+
+  if (server.method() == HTTP_POST){
+    if (deserializeJson(doc, server.arg("plain")) || !doc.is<JsonObject>()){
+      server.send(400, "application/json", "{\"Error\":\"Invalid settings\"}");
+      return;
+    }
+
+    config previous = appConfig;
+    SettingsFromJson(appConfig, doc, previous);
+
+    uint16_t changed = ReconfigApply(previous, appConfig);
+    if (changed) ConfigChanged();
+    LogEvent(EVENTCATEGORIES::System, 1, "Settings imported", changed ? "changed" : "unchanged");
+
+    doc.clear();
+  }
+
+  SettingsToJson(appConfig, doc);
+  doc.remove("password");
+
+  SendJson(doc);
+}
+
+//  Last relay state and timer seconds sent as events
+uint8_t eventRelayState = 0xFF;
+unsigned long eventRemaining[RELAY_COUNT];
+
+//  Prometheus text format. Left open like the static files, scrapers can't log in,
+//  and nothing here is sensitive. Scrapes don't reset the max values, the MQTT
+//  report does.
+void WriteMetric(Print &out, const char *name, const char *type, unsigned long value){
+  out.printf("# TYPE node_%s %s\nnode_%s %lu\n", name, type, name, value);
+}
+
+void handleMetrics(){
+  ChunkedResponse response(server);
+
+  server.sendHeader("Cache-Control", "no-cache");
+  response.begin(200, "text/plain; version=0.0.4");
+
+  WriteMetric(response, "uptime_seconds", "counter", millis() / 1000);
+  WriteMetric(response, "heap_free_bytes", "gauge", ESP.getFreeHeap());
+  WriteMetric(response, "heap_max_free_block_bytes", "gauge", ESP.getMaxFreeBlockSize());
+  WriteMetric(response, "heap_fragmentation_percent", "gauge", ESP.getHeapFragmentation());
+
+  unsigned long cumulative = 0;
+  response.print("# TYPE node_loop_duration_us histogram\n");
+  for (uint8_t i = 0; i < METRICS_LOOP_BUCKETS - 1; i++) {
+    cumulative += loopMetrics.histogram[i];
+    response.printf("node_loop_duration_us_bucket{le=\"%lu\"} %lu\n", metricsLoopBounds[i], cumulative);
+  }
+  response.printf("node_loop_duration_us_bucket{le=\"+Inf\"} %lu\n", loopMetrics.passes);
+  response.print("node_loop_duration_us_sum ");
+  response.println((unsigned long long)loopMetrics.totalTime);
+  response.printf("node_loop_duration_us_count %lu\n", loopMetrics.passes);
+
+  WriteMetric(response, "loop_max_pass_us", "gauge", loopMetrics.maxPass);
+  WriteMetric(response, "loop_max_stall_us", "gauge", loopMetrics.maxStall);
+
+  WriteMetric(response, "i2c_reads_total", "counter", inputStats.reads);
+  WriteMetric(response, "i2c_writes_total", "counter", relayStats.writes);
+  WriteMetric(response, "i2c_transactions_per_second", "gauge", i2cTransactionsPerSecond);
+
+  WriteMetric(response, "mqtt_publishes_total", "counter", mqttStats.publishes);
+  WriteMetric(response, "mqtt_failures_total", "counter", mqttStats.failures);
+  WriteMetric(response, "mqtt_skipped_total", "counter", mqttStats.skipped);
+  WriteMetric(response, "mqtt_overflows_total", "counter", mqttStats.overflows);
+
+  WriteMetric(response, "event_log_records_total", "counter", eventLogStats.logged);
+  response.print("# TYPE node_event_log_lost_total counter\n");
+  response.printf("node_event_log_lost_total{consumer=\"live\"} %lu\n", eventLogLiveLost);
+  response.printf("node_event_log_lost_total{consumer=\"mqtt\"} %lu\n", eventLogMqttLost);
+  response.printf("node_event_log_lost_total{consumer=\"journal\"} %lu\n", journalStats.lost);
+  WriteMetric(response, "journal_records_total", "counter", journalStats.records);
+  WriteMetric(response, "journal_rotations_total", "counter", journalStats.rotations);
+  WriteMetric(response, "journal_errors_total", "counter", journalStats.errors);
+
+  WriteMetric(response, "config_changes_total", "counter", configStats.changes);
+  WriteMetric(response, "config_writes_total", "counter", configStats.writes);
+  WriteMetric(response, "config_write_failures_total", "counter", configStats.failures);
+  WriteMetric(response, "reconfig_applies_total", "counter", reconfigStats.applies);
+  WriteMetric(response, "reconfig_callbacks_total", "counter", reconfigStats.callbacks);
+
+  response.print("# TYPE node_http_requests_total counter\n");
+  for (uint8_t i = 0; i < routeCount; i++) {
+    response.printf("node_http_requests_total{uri=\"%s\"} %lu\n", routeMetrics[i].uri, routeMetrics[i].requests);
+  }
+  response.print("# TYPE node_http_service_time_us_total counter\n");
+  for (uint8_t i = 0; i < routeCount; i++) {
+    response.printf("node_http_service_time_us_total{uri=\"%s\"} %lu\n", routeMetrics[i].uri, routeMetrics[i].totalTime);
+  }
+  response.print("# TYPE node_http_max_service_time_us gauge\n");
+  for (uint8_t i = 0; i < routeCount; i++) {
+    response.printf("node_http_max_service_time_us{uri=\"%s\"} %lu\n", routeMetrics[i].uri, routeMetrics[i].maxTime);
+  }
+
+  response.end();
+}
+
+//  server.on() with the handler's service time recorded in the route metrics
+void OnTimed(const char *uri, HTTPMethod method, ESP8266WebServer::THandlerFunction handler){
+  int8_t route = MetricsAddRoute(uri);
+
+  server.on(uri, method, [route, handler](){
+    unsigned long start = micros();
+    handler();
+    MetricsRouteServed(route, micros() - start);
+  });
+}
+
+void OnTimed(const char *uri, ESP8266WebServer::THandlerFunction handler){
+  OnTimed(uri, HTTP_ANY, handler);
+}
+
+//  Makes the events task send the complete state on its next run
+void ResyncEvents(){
+  eventRelayState = ~relayShadow;
+  for (uint8_t i = 0; i < RELAY_COUNT; i++) {
+    eventRemaining[i] = ULONG_MAX;
+  }
+}
+
+void handleEvents(){
+  if (!ApiAuthenticated()) return;
+
+  EventsSubscribe(server.client());
+  ResyncEvents();
+}
+
+void SendInputEvent(const inputEdge_t &edge){
+  char data[64];
+
+  snprintf(data, sizeof(data), "{\"Pattern\":%u,\"Changed\":%u,\"Time\":%lu}", edge.pattern, edge.changed, edge.timestamp);
+  EventsSend("input", data);
+}
+
+void SendStateEvents(){
+  char data[96];
+
+  if (relayShadow != eventRelayState){
+    int length = snprintf(data, sizeof(data), "{\"Relays\":[");
+    for (uint8_t i = 0; i < RELAY_COUNT; i++) {
+      length += snprintf(data + length, sizeof(data) - length, i ? ",%u" : "%u", RelayIsOn(i));
+    }
+    snprintf(data + length, sizeof(data) - length, "]}");
+
+    EventsSend("relays", data);
+    eventRelayState = relayShadow;
+  }
+
+  for (uint8_t i = 0; i < RELAY_COUNT; i++) {
+    unsigned long remaining = (ZoneRemaining(i) + 999) / 1000;
+    if (remaining == eventRemaining[i]) continue;
+
+    snprintf(data, sizeof(data), "{\"Channel\":%u,\"Remaining\":%lu}", i, remaining);
+    EventsSend("timer", data);
+    eventRemaining[i] = remaining;
+  }
+}
+
 void SendHeartbeat(){
 
-    if (PSclient.connected()){
+    if (PSclient.connected() || EventsHaveClients()){
 
   time_t localTime = timezones[appConfig.timeZone]->toLocal(now(), &tcr);
 
-    const size_t capacity = JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(6) + 180;
+    const size_t capacity = JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(11) + 180 +
+                            JSON_OBJECT_SIZE(2) + JSON_OBJECT_SIZE(BOOT_MAX_PHASES) + JSON_OBJECT_SIZE(BOOT_MILESTONE_COUNT);
     StaticJsonDocument<capacity> doc;
 
-    doc["Time"] = DateTimeToString(localTime);
+    //  Both outlive the document, so they aren't copied into it
+    char time[DATETIME_LENGTH];
+    char uptime[DURATION_LENGTH];
+    FormatDateTime(time, sizeof(time), localTime);
+    FormatDuration(uptime, sizeof(uptime), millis() / 1000);
+
+    doc["Time"] = (const char*)time;
+    doc["Uptime"] = (const char*)uptime;
     doc["Node"] = ESP.getChipId();
     doc["Freeheap"] = ESP.getFreeHeap();
+    doc["MaxFreeBlock"] = ESP.getMaxFreeBlockSize();
+    doc["HeapFragmentation"] = ESP.getHeapFragmentation();
+    doc["I2CRate"] = i2cTransactionsPerSecond;
     doc["FriendlyName"] = appConfig.friendlyName;
     doc["HeartbeatInterval"] = appConfig.heartbeatInterval;
 
@@ -1065,35 +1015,57 @@ void SendHeartbeat(){
     wifiDetails["MACAddress"] = String(WiFi.macAddress());
     wifiDetails["IPAddress"] = WiFi.localIP().toString();
 
+    //  Until the broker has got it once
+    if (!bootReported) BootToJson(doc.createNestedObject("Boot"));
+
     #ifdef __debugSettings
     serializeJsonPretty(doc,Serial);
     Serial.println();
     #endif
 
-    String myJsonString;
+    char payload[HEARTBEAT_PAYLOAD_LENGTH];
 
-    serializeJson(doc, myJsonString);
+    serializeJson(doc, payload, sizeof(payload));
 
-    PSclient.publish((MQTT_CUSTOMER + String("/") + MQTT_PROJECT + "/" + appConfig.mqttTopic + "/HEARTBEAT").c_str(), myJsonString.c_str(), false);
+    if (MqttPublish(PSclient, TOPIC_HEARTBEAT, payload)) bootReported = true;
+    EventsSend("heartbeat", payload);
   }
+}
 
-  needsHeartbeat = false;
+void SendTaskStats(){
+  if (!PSclient.connected()) return;
+
+  StaticJsonDocument<SCHEDULER_STATS_JSON_SIZE> doc;
+  SchedulerStatsToJson(doc.to<JsonArray>());
+
+  MqttPublishJson(PSclient, TOPIC_TASKS, doc);
+}
+
+void SendMetrics(){
+  if (!PSclient.connected()) return;
+
+  StaticJsonDocument<METRICS_JSON_SIZE> doc;
+  MetricsToJson(doc);
+
+  if (MqttPublishJson(PSclient, TOPIC_METRICS, doc)) MetricsResetWindow();
 }
 
 void RefreshSunData(){
 
   time_t localTime = timezones[appConfig.timeZone]->toLocal(now(), &tcr);
 
-  sunData.Sunrise = CalculateSunData(localTime, LATITUDE, LONGITUDE, Sunrise);
-  sunData.Sunset  = CalculateSunData(localTime, LATITUDE, LONGITUDE, Sunset );
+  sunData.Sunrise = CalculateSunData(localTime, SUN_DEGREES(LATITUDE), SUN_DEGREES(LONGITUDE), Sunrise);
+  sunData.Sunset  = CalculateSunData(localTime, SUN_DEGREES(LATITUDE), SUN_DEGREES(LONGITUDE), Sunset );
 
-  localTime = timezones[appConfig.timeZone]->toLocal(sunData.Sunrise, &tcr);
-  String sr = DateTimeToString(localTime);
+  char sr[TIME_LENGTH];
+  char ss[TIME_LENGTH];
+  char data[EVENT_DATA_LENGTH];
 
-  localTime = timezones[appConfig.timeZone]->toLocal(sunData.Sunset, &tcr);
-  String ss = DateTimeToString(localTime);
+  FormatTime(sr, sizeof(sr), timezones[appConfig.timeZone]->toLocal(sunData.Sunrise, &tcr));
+  FormatTime(ss, sizeof(ss), timezones[appConfig.timeZone]->toLocal(sunData.Sunset, &tcr));
+  snprintf(data, sizeof(data), "Sunrise: %s - Sunset: %s", sr, ss);
 
-  LogEvent(EVENTCATEGORIES::RefreshSunsetSunrise, 1, "Sun data calculated", "Sunrise: " + sr + " - Sunset: " + ss);
+  LogEvent(EVENTCATEGORIES::RefreshSunsetSunrise, 1, "Sun data calculated", data);
 }
 
 bool NeedsEntranceLight(){
@@ -1104,34 +1076,37 @@ bool NeedsEntranceLight(){
   mySunrise+=appConfig.sunriseLightOffset * 60;
   mySunset+=appConfig.sunsetLightOffset * 60;
 
-  //  Sunrise
-  if ( hour() < hour(mySunrise) ) return true;
-  if ( hour() == hour(mySunrise) ){
-    if ( minute() < minute(mySunrise) ) return true;
-    if ( minute() == minute(mySunrise) ){
-      if ( second() < second(mySunrise) ) return true;
-    }
-  }
-
-  //  Sunset
-  if ( hour() < hour(mySunset) ) return false;
-  if ( hour() == hour(mySunset) ){
-    if ( minute() < minute(mySunset) ) return false;
-    if ( minute() == minute(mySunset) ){
-      if ( second() < second(mySunset) ) return false;
-    }
-  }
+  //  Only the time of day counts
+  uint32_t timeOfDay = elapsedSecsToday(now());
 
-  return true;
+  return timeOfDay < elapsedSecsToday(mySunrise) || timeOfDay >= elapsedSecsToday(mySunset);
 }
 
-void StartStaircaseLight(){
-    i2c_relays.write(STAIRCASELIGHT_RELAY, 0);
-    os_timer_arm(&staircaseTimer, appConfig.staircaseLightDelay * 1000, true);
-    LogEvent(EVENTCATEGORIES::StaircaseLight, 1, "Staircaselights", String(appConfig.staircaseLightDelay));
-    if (PSclient.connected()){
-        PSclient.publish((MQTT_CUSTOMER + String("/") + MQTT_PROJECT + String("/") + appConfig.mqttTopic + "/RESULT/POWER1").c_str(), "on", false );
-    }
+void ReportLightEvent(LIGHT_EVENT event, uint8_t channel){
+  char remaining[12];
+  ultoa(ZoneRemaining(channel) / 1000, remaining, DEC);
+
+  switch (event) {
+    case LIGHT_ZONE_OFF:
+      if (channel == STAIRCASELIGHT_RELAY)
+        LogEvent(EVENTCATEGORIES::StaircaseLight, 1, "Staircaselights", "off");
+      break;
+    case LIGHT_STAIRCASE_STARTED:
+      LogEvent(EVENTCATEGORIES::StaircaseLight, 1, "Staircaselights", remaining);
+      break;
+    case LIGHT_STAIRCASE_EXTENDED:
+      LogEvent(EVENTCATEGORIES::StaircaseLight, 2, "Staircaselights extended", remaining);
+      break;
+    case LIGHT_STAIRCASE_FORCED_ON:
+      LogEvent(EVENTCATEGORIES::StaircaseLight, 3, "Staircaselights", "forced on");
+      break;
+    case LIGHT_ENTRANCE_TOGGLED:
+      LogEvent(EVENTCATEGORIES::EntranceLight, 1, "Entrancelight", entranceLightState ? "on" : "off");
+      break;
+    case LIGHT_ENTRANCE_SCHEDULED:
+      LogEvent(EVENTCATEGORIES::EntranceLight, entranceLightState ? 2 : 3, "Lights", entranceLightState ? "on" : "off");
+      break;
+  }
 }
 
 void ScanI2C(){
@@ -1197,51 +1172,45 @@ void mqtt_callback(char* topic, byte* payload, unsigned int length) {
     Serial.println();
     #endif
 
-    String sKey;
-    char c[1];
-    String sCommand;
+    char key[8];
 
-    for (size_t i = 0; i < 8; i++){
-         sKey = "POWER";
-        itoa(i, c, DEC);
-        sKey+=c;
+    for (size_t i = 0; i < RELAY_COUNT; i++){
+        sprintf(key, "POWER%u", i);
 
-        if (doc.containsKey(sKey)){
-            const char* myKey = doc[sKey];
-            sCommand = myKey;
-            sCommand.toUpperCase();
+        if (doc.containsKey(key)){
+            const char* command = doc[key];
+            if (command == NULL) continue;
 
-            if (sCommand == "ON"){
-                i2c_relays.write(i, 0);     //  Switch on relay
+            if (strcasecmp(command, "ON") == 0){
+                RelayWrite(i, RELAY_ON);
 
                 switch ( i ){
-                case ENTRANCELIGHT_RELAY:  //  if it is the boiler
+                case ENTRANCELIGHT_RELAY:
+                    entranceLightState = true;
+                    entranceLightManual = true;
                     LogEvent(EVENTCATEGORIES::EntranceLight, 1, "Entrancelight", "on");
                     break;
                 case STAIRCASELIGHT_RELAY:
-                    os_timer_arm(&staircaseTimer, appConfig.staircaseLightDelay * 1000, true);
-                    if (PSclient.connected())
-                        PSclient.publish((MQTT_CUSTOMER + String("/") + MQTT_PROJECT + String("/") + appConfig.mqttTopic + "/RESULT/POWER" + (String)i + String("/DURATION")).c_str(), ((String)appConfig.staircaseLightDelay).c_str(), false );
                     LogEvent(EVENTCATEGORIES::StaircaseLight, 1, "Staircaselights", String(appConfig.staircaseLightDelay));
                     break;
                 default:
                     break;
                 }
-                if (PSclient.connected()){
-                    PSclient.publish((MQTT_CUSTOMER + String("/") + MQTT_PROJECT + String("/") + appConfig.mqttTopic + "/RESULT/POWER" + (String)i).c_str(), "on", false );
+
+                if (ZoneTrigger(i)){
+                    char duration[12];
+                    ultoa(ZoneRemaining(i) / 1000, duration, DEC);
+                    MqttPublish(PSclient, TOPIC_RESULT_DURATION(i), duration);
                 }
-            } else if (sCommand == "OFF"){
-                i2c_relays.write(i, 1);     //  Switch off relay
-                if (PSclient.connected())
-                    PSclient.publish((MQTT_CUSTOMER + String("/") + MQTT_PROJECT + String("/") + appConfig.mqttTopic + "/RESULT/POWER" + (String)i).c_str(), "off", false );
+                MqttPublish(PSclient, TOPIC_RESULT_POWER(i), "on");
+            } else if (strcasecmp(command, "OFF") == 0){
+                SwitchZoneOff(i);     //  Switch off relay
 
                 switch ( i ){
-                case 0:
+                case ENTRANCELIGHT_RELAY:
+                    entranceLightManual = true;
                     LogEvent(EVENTCATEGORIES::EntranceLight, 1, "Entrancelight", "off");
                     break;
-                case 1:
-                    stairlightExpired = true;
-                    break;
                 default:
                     break;
                 }
@@ -1257,347 +1226,676 @@ void mqtt_callback(char* topic, byte* payload, unsigned int length) {
     if (doc.containsKey("reset")){
       LogEvent(EVENTCATEGORIES::MqttMsg, 1, "Reset", "");
       defaultSettings();
-      ESP.reset();
+      ResetNode();
     }
 
     //  restart
     if (doc.containsKey("restart")){
       LogEvent(EVENTCATEGORIES::MqttMsg, 2, "Restart", "");
-      ESP.reset();
+      ResetNode();
     }
   }
 
 }
 
-void setup() {
-    delay(1); //  Needed for PlatformIO serial monitor
-    Serial.begin(DEBUG_SPEED);
-    Serial.setDebugOutput(false);
-    Serial.print("\n\n\n\rBooting node:     ");
-    Serial.print(ESP.getChipId());
-    Serial.println("...");
+//  Input edges seen by the input task, see node.h
+void ObserveInputEdge(const inputEdge_t &edge){
+  inputPattern = edge.pattern;
+  if (EventsHaveClients()) SendInputEvent(edge);
+}
 
-    Serial.println("Hardware ID:      " + (String)HARDWARE_ID);
-    Serial.println("Hardware version: " + (String)HARDWARE_VERSION);
-    Serial.println("Software ID:      " + (String)SOFTWARE_ID);
-    Serial.println("Software version: " + (String)FIRMWARE_VERSION);
-    Serial.println();
+void EventsTaskCallback(){
+  SendLiveEvents();
+  EventsKeepAlive();
 
-    //  File system
-    if (!LittleFS.begin()){
-        Serial.println("Error: Failed to initialize the filesystem!");
-    }
+  if (EventsHaveClients()) SendStateEvents();
+}
 
-    if (!loadSettings(appConfig)) {
-        Serial.println("Failed to load config, creating default settings...");
-        defaultSettings();
-    } else {
-        Serial.println("Config loaded.");
-    }
+void HttpTaskCallback(){
+  server.handleClient();
 
-    WiFi.hostname(defaultSSID);
-    
-    //  GPIOs
+  if (connectionState == STATE_INTERNET_CONNECTED)
+    ArduinoOTA.handle();
+}
 
-    //  outputs
-    pinMode(CONNECTION_STATUS_LED_GPIO, OUTPUT);
-    digitalWrite(CONNECTION_STATUS_LED_GPIO, HIGH);
+void MqttTaskCallback(){
+  if (isAccessPoint || connectionState != STATE_INTERNET_CONNECTED) return;
 
-    //  I2C
-    Wire.begin(SDA_GPIO, SCL_GPIO);
-    ScanI2C();
+  if (!PSclient.connected()) {
+    if (MqttConnect(PSclient, appConfig)){
+      PSclient.setCallback(mqtt_callback);
 
-    #ifdef __debugSettings
+      PSclient.subscribe(MqttTopic(TOPIC_CMND), 0);
 
-    for (size_t i = 0; i < 5; i++) {
-        i2c_relays.write8(0x00);
-        delay(100);
-        i2c_relays.write8(0xff);
-        delay(100);
+      MqttPublish(PSclient, TOPIC_STATE, "online", true);
+      LogEvent(EVENTCATEGORIES::Conn, 1, "Node online", WiFi.localIP().toString());
+      BootMilestone(BOOT_MQTT);
     }
+  }
 
-  #endif
+  if (PSclient.connected()){
+    PSclient.loop();
+    PublishEventLog();
+  }
+}
 
-    //  OTA
-    ArduinoOTA.onStart([]() {
-        Serial.println("OTA started.");
-    });
+void NetworkTaskCallback(){
+  if (accessPointTimedOut){
+    LogEvent(EVENTCATEGORIES::Reboot, 4, "Access point timeout", "");
+    ResetNode();
+  }
 
-    ArduinoOTA.onEnd([]() {
-        Serial.println("\nOTA finished.");
-    });
+  if (isAccessPoint){
+    if (!isAccessPointCreated){
+      Serial.print("Could not connect to ");
+      Serial.print(appConfig.ssid);
+      Serial.println("\r\nReverting to Access Point mode.");
 
-    ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
-        Serial.printf("Progress: %u%%\r", (progress / (total / 100)));
-        if (progress % OTA_BLINKING_RATE == 0){
-        if (digitalRead(CONNECTION_STATUS_LED_GPIO)==HIGH)
-            digitalWrite(CONNECTION_STATUS_LED_GPIO, LOW);
-            else
-            digitalWrite(CONNECTION_STATUS_LED_GPIO, HIGH);
-        }
-    });
+      WiFi.mode(WiFiMode::WIFI_AP);
+      WiFi.softAP(defaultSSID, DEFAULT_PASSWORD);
 
-    ArduinoOTA.onError([](ota_error_t error) {
-        Serial.printf("Error[%u]: ", error);
-        if (error == OTA_AUTH_ERROR) Serial.println("Authentication failed.");
-        else if (error == OTA_BEGIN_ERROR) Serial.println("Begin failed.");
-        else if (error == OTA_CONNECT_ERROR) Serial.println("Connect failed.");
-        else if (error == OTA_RECEIVE_ERROR) Serial.println("Receive failed.");
-        else if (error == OTA_END_ERROR) Serial.println("End failed.");
-    });
+      IPAddress myIP;
+      myIP = WiFi.softAPIP();
+      isAccessPointCreated = true;
 
-    ArduinoOTA.begin();
+      Serial.println("Access point created. Use the following information to connect to the ESP device, then follow the on-screen instructions to connect to a different wifi network:");
 
-    Serial.println();
+      Serial.print("SSID:\t\t\t");
+      Serial.println(defaultSSID);
 
-    server.on("/", handleStatus);
-    server.on("/status.html", handleStatus);
-    server.on("/generalsettings.html", handleGeneralSettings);
-    server.on("/networksettings.html", handleNetworkSettings);
-    server.on("/staircaselighttimer.html", handleStaircaseLightTimer);
-    server.on("/entrancelight.html", handleEntranceLight);
-    server.on("/tools.html", handleTools);
-    server.on("/login.html", handleLogin);
+      Serial.print("Password:\t\t");
+      Serial.println(DEFAULT_PASSWORD);
 
-    server.onNotFound(handleNotFound);
+      Serial.print("Access point address:\t");
+      Serial.println(myIP);
 
-    //  Web server
-    if (MDNS.begin("esp8266")) {
-        Serial.println("MDNS responder started.");
+      Serial.println();
+      Serial.println("Note: The device will reset in 5 minutes.");
+
+
+      os_timer_setfn(&accessPointTimer, accessPointTimerCallback, NULL);
+      os_timer_arm(&accessPointTimer, ACCESS_POINT_TIMEOUT, true);
+      SchedulerDisableTask(heartbeatTask);
     }
+    return;
+  }
 
-    //  Start HTTP (web) server
-    server.begin();
-    Serial.println("HTTP server started.");
+  switch (connectionState) {
 
-    //  Authenticate HTTP requests
-    const char * headerkeys[] = {"User-Agent","Cookie"} ;
-    size_t headerkeyssize = sizeof(headerkeys)/sizeof(char*);
-    server.collectHeaders(headerkeys, headerkeyssize );
+    // Check the WiFi connection
+    case STATE_CHECK_WIFI_CONNECTION:
+
+      // Are we connected ?
+      if (WiFi.status() != WL_CONNECTED) {
+        // Wifi is NOT connected
+        digitalWrite(CONNECTION_STATUS_LED_GPIO, HIGH);
+        connectionState = STATE_WIFI_CONNECT;
+      } else  {
+        // Wifi is connected so check Internet
+        digitalWrite(CONNECTION_STATUS_LED_GPIO, LOW);
+        connectionState = STATE_CHECK_INTERNET_CONNECTION;
+      }
+      break;
 
-    //  Timers
-    os_timer_setfn(&heartbeatTimer, heartbeatTimerCallback, NULL);
-    os_timer_arm(&heartbeatTimer, appConfig.heartbeatInterval * 1000, true);
+    // No Wifi so attempt WiFi connection. The connection is started here
+    // and then checked on every run, the relays keep working meanwhile.
+    case STATE_WIFI_CONNECT:
+      if (!wifiConnecting){
+        // Indicate NTP no yet initialized
+        ntpInitialized = false;
 
-    os_timer_setfn(&staircaseTimer, StaircaseTimerCallback, NULL);
+        digitalWrite(CONNECTION_STATUS_LED_GPIO, HIGH);
+        Serial.printf("Trying to connect to WIFI network: %s", appConfig.ssid);
 
-    #ifdef _use_local_sun_data
-    os_timer_setfn(&sunDataTimer, sunDataTimerCallback, NULL);
-    os_timer_arm(&sunDataTimer, 60 * 60 * 1000, true);
-    #endif
+        // Set station mode. Modem sleep holds packets back until the next
+        // beacon, which slows the MQTT connect and every publish down.
+        WiFi.mode(WIFI_STA);
+        WiFi.setSleepMode(WIFI_NONE_SLEEP);
 
-    //  Randomizer
-    SetRandomSeed();
+        // Start connection process
+        WiFi.hostname((String)appConfig.mqttTopic);
+        WiFi.begin(appConfig.ssid, appConfig.password);
 
-    // Set the initial connection state
-    connectionState = STATE_CHECK_WIFI_CONNECTION;
+        wifiConnecting = true;
+        wifiConnectStartedAt = millis();
+        break;
+      }
+
+      if (WiFi.status() != WL_CONNECTED){
+        if (millis() - wifiConnectStartedAt < WIFI_CONNECTION_TIMEOUT * 1000UL){
+          digitalWrite(CONNECTION_STATUS_LED_GPIO, !digitalRead(CONNECTION_STATUS_LED_GPIO));
+          Serial.print(".");
+          break;
+        }
+
+        Serial.println();
+        Serial.println("Could not connect to WiFi");
+
+        wifiConnecting = false;
+        isAccessPoint=true;
+
+        break;
+      }
+
+      wifiConnecting = false;
+      BootMilestone(BOOT_WIFI);
+
+      digitalWrite(CONNECTION_STATUS_LED_GPIO, LOW);
+      Serial.println(" Success!");
+      Serial.print("IP address: ");
+      Serial.println(WiFi.localIP());
+
+      //  OTA needs the network, so it is started with the first connection
+      if (!otaStarted){
+        ArduinoOTA.begin();
+        otaStarted = true;
+      }
+
+      if (MDNS.begin(appConfig.mqttTopic)) debugln("MDNS responder started.");
 
+      connectionState = STATE_CHECK_INTERNET_CONNECTION;
+      break;
+
+    case STATE_CHECK_INTERNET_CONNECTION:
+
+      // Do we have a connection to the Internet ? The lookup runs in the
+      // background, the state is kept until it has an answer
+      switch (checkInternetConnection()) {
+        case RESOLVER_RESOLVED:
+          if (!ntpInitialized) {
+            // We are connected to the Internet for the first time so start the NTP client
+            SchedulerEnableTask(ntpTask);
+            Serial.println("Connected to the Internet.");
+          }
+
+          connectionState = STATE_INTERNET_CONNECTED;
+          break;
+
+        case RESOLVER_FAILED:
+          connectionState = STATE_CHECK_WIFI_CONNECTION;
+          break;
+
+        default:
+          break;
+      }
+      break;
+
+    case STATE_INTERNET_CONNECTED:
+
+      //  Only the WiFi link is watched here, the Internet is checked again after a reconnect
+      if (WiFi.status() != WL_CONNECTED) {
+        connectionState = STATE_CHECK_WIFI_CONNECTION;
+      }
+      break;
+  }
 }
 
-void loop(){
+void JournalTaskCallback(){
+  JournalRun();
+}
 
-  if (isAccessPoint){
-    if (!isAccessPointCreated){
-      Serial.print("Could not connect to ");
-      Serial.print(appConfig.ssid);
-      Serial.println("\r\nReverting to Access Point mode.");
+void ConfigTaskCallback(){
+  if (ConfigSaveDue()) saveSettings();
+}
 
-      delay(500);
+//  Runs once after setup(), for the slow parts of the boot the relays and
+//  inputs don't have to wait for
+void BootTaskCallback(){
+  SchedulerDisableTask(bootTask);
 
-      WiFi.mode(WiFiMode::WIFI_AP);
-      WiFi.softAP(defaultSSID, DEFAULT_PASSWORD);
+  #ifdef _use_sun_table
+  if (!SunTableBegin(SUN_DEGREES(LATITUDE), SUN_DEGREES(LONGITUDE))) Serial.println("Sun table built.");
+  #endif
 
-      IPAddress myIP;
-      myIP = WiFi.softAPIP();
-      isAccessPointCreated = true;
+  #ifdef __debugSettings
+  ScanI2C();
+  #endif
+}
 
-      Serial.println("Access point created. Use the following information to connect to the ESP device, then follow the on-screen instructions to connect to a different wifi network:");
+/*
+    Settings change callbacks, see reconfig.h
+*/
 
-      Serial.print("SSID:\t\t\t");
-      Serial.println(defaultSSID);
+void ApplyHeartbeatChanges(const config &previous){
+  SchedulerSetInterval(heartbeatTask, appConfig.heartbeatInterval * 1000);
+}
 
-      Serial.print("Password:\t\t");
-      Serial.println(DEFAULT_PASSWORD);
+//  Local times are derived from UTC whenever they are needed, only the sun
+//  data is kept in local time
+void ApplyTimeZoneChanges(const config &previous){
+  #ifdef _use_local_sun_data
+  RefreshSunData();
+  #endif
+}
 
-      Serial.print("Access point address:\t");
-      Serial.println(myIP);
+//  The topics still have the old names here, the retained state on them
+//  must not say "online" after the node has moved away
+void ApplyMqttChanges(const config &previous){
+  if (PSclient.connected()){
+    MqttPublish(PSclient, TOPIC_STATE, "offline", true);
+    PSclient.disconnect();
+  }
 
-      Serial.println();
-      Serial.println("Note: The device will reset in 5 minutes.");
+  BuildMqttTopics(appConfig.mqttTopic, ESP.getChipId());
 
+  //  The MQTT task connects with the new settings on its next run
+  MqttConnectNow();
+}
 
-      os_timer_setfn(&accessPointTimer, accessPointTimerCallback, NULL);
-      os_timer_arm(&accessPointTimer, ACCESS_POINT_TIMEOUT, true);
-      os_timer_disarm(&heartbeatTimer);
-    }
-    server.handleClient();
+//  The node is reachable by its topic name, the login itself has no settings
+void ApplyWebChanges(const config &previous){
+  WiFi.hostname((String)appConfig.mqttTopic);
+  if (MDNS.isRunning()) MDNS.setHostname(appConfig.mqttTopic);
+}
+
+void HeartbeatTaskCallback(){
+  SendHeartbeat();
+  SendTaskStats();
+  SendMetrics();
+
+  #ifdef __debugSettings
+  SchedulerPrintStats(Serial);
+  #endif
+}
+
+void NtpTaskCallback(){
+  if (connectionState != STATE_INTERNET_CONNECTED) return;
+
+  if (!ntpInitialized){
+    initNTP();
+    ntpInitialized = true;
   }
-  else{
-    switch (connectionState) {
-
-      // Check the WiFi connection
-      case STATE_CHECK_WIFI_CONNECTION:
-
-        // Are we connected ?
-        if (WiFi.status() != WL_CONNECTED) {
-          // Wifi is NOT connected
-          digitalWrite(CONNECTION_STATUS_LED_GPIO, HIGH);
-          connectionState = STATE_WIFI_CONNECT;
-        } else  {
-          // Wifi is connected so check Internet
-          digitalWrite(CONNECTION_STATUS_LED_GPIO, LOW);
-          connectionState = STATE_CHECK_INTERNET_CONNECTION;
-
-          server.handleClient();
-        }
-        break;
 
-      // No Wifi so attempt WiFi connection
-      case STATE_WIFI_CONNECT:
-        {
-          // Indicate NTP no yet initialized
-          ntpInitialized = false;
+  if (NTPRun()){
+    BootMilestone(BOOT_NTP);
 
-          digitalWrite(CONNECTION_STATUS_LED_GPIO, HIGH);
-          Serial.printf("Trying to connect to WIFI network: %s", appConfig.ssid);
+    //  The clock is valid now, so the sun data can be (re)calculated
+    SchedulerEnableTask(sunDataTask);
+    if (!SchedulerIsTaskEnabled(entranceLightTask))
+      SchedulerEnableTask(entranceLightTask, ENTRANCE_LIGHT_TASK_INTERVAL);
+  }
+}
 
-          // Set station mode
-          WiFi.mode(WIFI_STA);
+#ifdef _use_local_sun_data
+void SunDataTaskCallback(){
+  RefreshSunData();
+}
 
-          // Start connection process
-          WiFi.hostname((String)appConfig.mqttTopic);
-          WiFi.begin(appConfig.ssid, appConfig.password);
+//  Only the edges of the schedule switch the light, so a change by hand
+//  holds until the next one (see staircase.h)
+void EntranceLightTaskCallback(){
+  bool needed = NeedsEntranceLight();
+  if (entranceLightScheduled == needed) return;
 
-          // Initialize iteration counter
-          uint8_t attempt = 0;
+  bool first = entranceLightScheduled < 0;
+  entranceLightScheduled = needed;
 
-          while ((WiFi.status() != WL_CONNECTED) && (attempt++ < WIFI_CONNECTION_TIMEOUT)) {
-            digitalWrite(CONNECTION_STATUS_LED_GPIO, LOW);
-            Serial.print(".");
-            delay(50);
-            digitalWrite(CONNECTION_STATUS_LED_GPIO, HIGH);
-            delay(950);
-          }
-          if (attempt >= WIFI_CONNECTION_TIMEOUT) {
-            Serial.println();
-            Serial.println("Could not connect to WiFi");
-            delay(100);
+  //  The light was switched by hand before the schedule was known
+  if (first && entranceLightManual) return;
 
-            isAccessPoint=true;
+  entranceLightManual = false;
+  if (needed != entranceLightState) SetEntranceLight(needed, LIGHT_ENTRANCE_SCHEDULED);
+}
+#endif
 
-            break;
-          }
-          digitalWrite(CONNECTION_STATUS_LED_GPIO, LOW);
-          Serial.println(" Success!");
-          Serial.print("IP address: ");
-          Serial.println(WiFi.localIP());
-          if (MDNS.begin(appConfig.mqttTopic)) debugln("MDNS responder started.");
+#ifdef _use_benchmarks
+//  Device side of benchmark.h, send 'b' on the serial console to run them
+volatile unsigned long benchSink;
+const time_t benchTime = 1624269600;    //  2021-06-21 10:00:00
+uint8_t benchPage;
+NullPrint benchOut;
 
-          connectionState = STATE_CHECK_INTERNET_CONNECTION;
-        }
-        break;
+void BenchCalculateSunData(){
+  benchSink = CalculateSunData(benchTime, SUN_DEGREES(LATITUDE), SUN_DEGREES(LONGITUDE), Sunrise);
+}
 
-      case STATE_CHECK_INTERNET_CONNECTION:
+//  Volatile, or the compiler may fold the kernels into constants
+volatile int benchDay = 21;
 
-        // Do we have a connection to the Internet ?
-        if (checkInternetConnection()) {
-          // We have an Internet connection
+//  The double version, for comparison
+void BenchSunEventUT(){
+  benchSink = SunEventUT(2021, 6, benchDay, LATITUDE, LONGITUDE, Sunrise);
+}
 
-          if (!ntpInitialized) {
-            // We are connected to the Internet for the first time so set NTP provider
-            initNTP();
+void BenchSunEventSeconds(){
+  benchSink = SunEventSeconds(2021, 6, benchDay, SUN_DEGREES(LATITUDE), SUN_DEGREES(LONGITUDE), Sunrise);
+}
 
-            ntpInitialized = true;
-            needsSunData = true;
-            Serial.println("Connected to the Internet.");
-          }
+#ifdef _use_sun_table
+void BenchSunTableLookup(){
+  benchSink = SunTableLookup(2021, 6, 21, Sunrise);
+}
+#endif
 
-          connectionState = STATE_INTERNET_CONNECTED;
-        } else  {
-          connectionState = STATE_CHECK_WIFI_CONNECTION;
-        }
-        break;
+//  The String versions timeformat.h replaced, for comparison. Their
+//  itoa() buffers are large enough here.
+String LegacyDateTimeToString(time_t time){
 
-      case STATE_INTERNET_CONNECTED:
+  String myTime = "";
+  char s[12];
 
-        ArduinoOTA.handle();
+  //  years
+  itoa(year(time), s, DEC);
+  myTime+= s;
+  myTime+="-";
 
-        if (!PSclient.connected()) {
-          PSclient.setServer(appConfig.mqttServer, appConfig.mqttPort);
-          if (PSclient.connect(appConfig.mqttTopic, (MQTT_CUSTOMER + String("/") + MQTT_PROJECT + String("/") + appConfig.mqttTopic + "/STATE").c_str(), 0, true, "offline" )){
-            PSclient.setCallback(mqtt_callback);
 
-            PSclient.subscribe((MQTT_CUSTOMER + String("/") + MQTT_PROJECT + String("/") + appConfig.mqttTopic + "/cmnd").c_str(), 0);
+  //  months
+  itoa(month(time), s, DEC);
+  myTime+= s;
+  myTime+="-";
 
-            PSclient.publish((MQTT_CUSTOMER + String("/") + MQTT_PROJECT + String("/") + appConfig.mqttTopic + "/STATE").c_str(), "online", true);
-            LogEvent(EVENTCATEGORIES::Conn, 1, "Node online", WiFi.localIP().toString());
-          }
-        }
+  //  days
+  itoa(day(time), s, DEC);
+  myTime+= s;
 
+  myTime+=" ";
 
-#ifdef _use_local_sun_data
-        if (needsSunData){
-          RefreshSunData();
-          needsSunData = false;
-        }
+  //  hours
+  itoa(hour(time), s, DEC);
+  myTime+= s;
+  myTime+=":";
 
-        //  External ligths
-        if (NeedsEntranceLight()) {
-          if (!entranceLightState){
-            LogEvent(EVENTCATEGORIES::EntranceLight, 2, "Lights", "on");
-            if (PSclient.connected()){
-              PSclient.publish(MQTT::Publish(MQTT_CUSTOMER + String("/") + MQTT_PROJECT + String("/") + String(ESP.getChipId()) + "/POWER0", "on" ).set_qos(0));
-            }
-          i2c_relays.write(ENTRANCELIGHT_RELAY, 1);
-          entranceLightState = true;
-          }
-        }
-        else{
-          if (entranceLightState){
-            LogEvent(EVENTCATEGORIES::EntranceLight, 3, "Lights", "off");
-            if (PSclient.connected()){
-              PSclient.publish(MQTT::Publish(MQTT_CUSTOMER + String("/") + MQTT_PROJECT + String("/") + String(ESP.getChipId()) + "/POWER0", "off" ).set_qos(0));
-            }
-          }
-          i2c_relays.write(ENTRANCELIGHT_RELAY, 0);
-          entranceLightState = false;
-        }
+  //  minutes
+  if(minute(time) <10)
+    myTime+="0";
+
+  itoa(minute(time), s, DEC);
+  myTime+= s;
+  myTime+=":";
+
+  //  seconds
+  if(second(time) <10)
+    myTime+="0";
+
+  itoa(second(time), s, DEC);
+  myTime+= s;
+
+  return myTime;
+}
+
+String LegacyTimeIntervalToString(time_t time){
+
+  String myTime = "";
+  char s[12];
+
+  //  hours
+  itoa((time/3600), s, DEC);
+  myTime+= s;
+  myTime+=":";
+
+  //  minutes
+  if(minute(time) <10)
+    myTime+="0";
+
+  itoa(minute(time), s, DEC);
+  myTime+= s;
+  myTime+=":";
+
+  //  seconds
+  if(second(time) <10)
+    myTime+="0";
+
+  itoa(second(time), s, DEC);
+  myTime+= s;
+  return myTime;
+}
+
+void BenchLegacyDateTimeToString(){
+  benchSink = LegacyDateTimeToString(benchTime).length();
+}
+
+void BenchLegacyTimeIntervalToString(){
+  benchSink = LegacyTimeIntervalToString(123456).length();
+}
+
+void BenchFormatDateTime(){
+  char buffer[DATETIME_LENGTH];
+  benchSink = FormatDateTime(buffer, sizeof(buffer), benchTime);
+}
+
+void BenchFormatInterval(){
+  char buffer[INTERVAL_LENGTH];
+  benchSink = FormatInterval(buffer, sizeof(buffer), 123456);
+}
+
+void BenchLogEvent(){
+  LogEvent(EVENTCATEGORIES::StaircaseLight, 1, "Staircaselights", "60");
+}
+
+void BenchEventRecordMessage(){
+  char msg[EVENT_MESSAGE_LENGTH];
+  benchSink = EventRecordMessage(eventLog[0], msg, sizeof(msg));
+}
+
+void BenchMqttCallback(){
+  //  Parsed in place, so it needs a fresh copy every time
+  char topic[] = "bench";
+  char payload[] = "{\"bench\":1}";
+  mqtt_callback(topic, (byte*)payload, strlen(payload));
+}
+
+void BenchLoadSettings(){
+  loadSettings(appConfig);
+}
+
+void BenchSaveSettings(){
+  saveSettings();
+}
+
+void BenchRenderPage(){
+  RenderTemplate(pageTemplates[benchPage], benchOut, WritePageField);
+}
+
+void RunBenchmarks(){
+  BenchPrintHeader(Serial);
+  BenchRun(Serial, "CalculateSunData", BenchCalculateSunData, 1000);
+  BenchCompare(Serial, "SunEventSeconds", BenchSunEventSeconds, "SunEventUT", BenchSunEventUT, 1000);
+  #ifdef _use_sun_table
+  BenchRun(Serial, "SunTableLookup", BenchSunTableLookup, 1000);
+  #endif
+  BenchRun(Serial, "DateTimeToString (String)", BenchLegacyDateTimeToString, 1000);
+  BenchRun(Serial, "FormatDateTime", BenchFormatDateTime, 1000);
+  BenchRun(Serial, "TimeIntervalToString (String)", BenchLegacyTimeIntervalToString, 1000);
+  BenchRun(Serial, "FormatInterval", BenchFormatInterval, 1000);
+  BenchRun(Serial, "LogEvent", BenchLogEvent, 1000);
+  BenchRun(Serial, "Event record message", BenchEventRecordMessage, 1000);
+  BenchRun(Serial, "mqtt_callback", BenchMqttCallback, 20);
+
+  //  Few runs, these write the flash
+  BenchRun(Serial, "loadSettings", BenchLoadSettings, 5);
+  BenchRun(Serial, "saveSettings", BenchSaveSettings, 5);
+
+  pageLocalTime = benchTime;
+  for (benchPage = 0; benchPage < PAGE_COUNT; benchPage++) {
+    BenchRun(Serial, pageTemplates[benchPage].path, BenchRenderPage, 10);
+  }
+}
+
+void BenchmarkTaskCallback(){
+  if (Serial.available() && Serial.read() == 'b') RunBenchmarks();
+}
 #endif
 
-        inputPattern = i2c_relays.read8();
+//  Staged boot: the settings are loaded and the relays and inputs are taken
+//  over first, everything that needs the network is started after that and
+//  comes up in the background, see NetworkTaskCallback() and BootTaskCallback()
+void setup() {
+    BootPhase("Sdk");
 
-        //  Staircase lights
+    delay(1); //  Needed for PlatformIO serial monitor
+    Serial.begin(DEBUG_SPEED);
+    Serial.setDebugOutput(false);
+    Serial.print("\n\n\n\rBooting node:     ");
+    Serial.print(ESP.getChipId());
+    Serial.println("...");
 
-        if ( (inputPattern & INPUT_MASK_1) == 0 ){
-          if (millis() - buttonPressedTime > BUTTON_DEBOUNCE_DELAY){
-            StartStaircaseLight();
-          }
-        }
+    Serial.println("Hardware ID:      " + (String)HARDWARE_ID);
+    Serial.println("Hardware version: " + (String)HARDWARE_VERSION);
+    Serial.println("Software ID:      " + (String)SOFTWARE_ID);
+    Serial.println("Software version: " + (String)FIRMWARE_VERSION);
+    Serial.println();
 
-        if ( stairlightExpired ){
-            i2c_relays.write(STAIRCASELIGHT_RELAY, 1);
-            os_timer_disarm(&staircaseTimer);
-            if (PSclient.connected())
-                PSclient.publish((MQTT_CUSTOMER + String("/") + MQTT_PROJECT + String("/") + appConfig.mqttTopic + "/RESULT/POWER1").c_str(), "off", false );
+    BootPhase("Serial");
 
-            LogEvent(EVENTCATEGORIES::StaircaseLight, 1, "Staircaselights", "off");
-            stairlightExpired = false;
-        }
+    //  File system
+    if (!LittleFS.begin()){
+        Serial.println("Error: Failed to initialize the filesystem!");
+    }
 
+    JournalBegin();
+    LogEvent(EVENTCATEGORIES::Reboot, 3, "Boot", ESP.getResetReason());
 
-        if (PSclient.connected()){
-          PSclient.loop();
-        }
+    BootPhase("FileSystem");
 
-        if (needsHeartbeat){
-          SendHeartbeat();
-          needsHeartbeat = false;
+    if (!loadSettings(appConfig)) {
+        Serial.println("Failed to load config, creating default settings...");
+        defaultSettings();
+    } else {
+        Serial.println("Config loaded.");
+    }
+
+    BootPhase("Settings");
+
+    //  I2C
+    Wire.begin(SDA_GPIO, SCL_GPIO);
+
+    #ifdef _use_relay_self_test
+    for (size_t i = 0; i < 5; i++) {
+        i2c_relays.write8(0x00);
+        delay(100);
+        i2c_relays.write8(0xff);
+        delay(100);
+    }
+    #endif
+
+    //  Relays, inputs and their tasks
+    NodeBegin(i2c_relays, PSclient, appConfig, ReportLightEvent, ObserveInputEdge);
+
+    BootPhase("IO");
+    BootMilestone(BOOT_IO_READY);
+
+    BuildMqttTopics(appConfig.mqttTopic, ESP.getChipId());
+
+    WiFi.hostname(defaultSSID);
+    
+    //  GPIOs
+
+    //  outputs
+    pinMode(CONNECTION_STATUS_LED_GPIO, OUTPUT);
+    digitalWrite(CONNECTION_STATUS_LED_GPIO, HIGH);
+
+    //  Web pages
+    TemplatesBegin(templateFields, FIELD_COUNT);
+
+    //  OTA, started once the WiFi is connected
+    ArduinoOTA.onStart([]() {
+        Serial.println("OTA started.");
+    });
+
+    ArduinoOTA.onEnd([]() {
+        Serial.println("\nOTA finished.");
+        //  The updater restarts the node
+        flushSettings();
+    });
+
+    ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
+        Serial.printf("Progress: %u%%\r", (progress / (total / 100)));
+        if (progress % OTA_BLINKING_RATE == 0){
+        if (digitalRead(CONNECTION_STATUS_LED_GPIO)==HIGH)
+            digitalWrite(CONNECTION_STATUS_LED_GPIO, LOW);
+            else
+            digitalWrite(CONNECTION_STATUS_LED_GPIO, HIGH);
         }
+    });
 
-        // Set next connection state
-        connectionState = STATE_CHECK_WIFI_CONNECTION;
-        break;
-      }
+    ArduinoOTA.onError([](ota_error_t error) {
+        Serial.printf("Error[%u]: ", error);
+        if (error == OTA_AUTH_ERROR) Serial.println("Authentication failed.");
+        else if (error == OTA_BEGIN_ERROR) Serial.println("Begin failed.");
+        else if (error == OTA_CONNECT_ERROR) Serial.println("Connect failed.");
+        else if (error == OTA_RECEIVE_ERROR) Serial.println("Receive failed.");
+        else if (error == OTA_END_ERROR) Serial.println("End failed.");
+    });
 
-  }
+    Serial.println();
+
+    OnTimed("/", handleStatus);
+    OnTimed("/status.html", handleStatus);
+    OnTimed("/generalsettings.html", handleGeneralSettings);
+    OnTimed("/networksettings.html", handleNetworkSettings);
+    OnTimed("/staircaselighttimer.html", handleStaircaseLightTimer);
+    OnTimed("/entrancelight.html", handleEntranceLight);
+    OnTimed("/tools.html", handleTools);
+    OnTimed("/login.html", handleLogin);
+
+    OnTimed("/api/status", HTTP_GET, handleApiStatus);
+    OnTimed("/api/relays", HTTP_GET, handleApiRelays);
+    OnTimed("/api/config", HTTP_GET, handleApiConfig);
+    OnTimed("/api/settings", HTTP_ANY, handleApiSettings);
+    OnTimed("/api/log", HTTP_GET, handleApiLog);
+    OnTimed("/events", HTTP_GET, handleEvents);
+    OnTimed("/metrics", HTTP_GET, handleMetrics);
+
+    //  Static files and 404s
+    int8_t notFoundRoute = MetricsAddRoute("*");
+    server.onNotFound([notFoundRoute](){
+        unsigned long start = micros();
+        handleNotFound();
+        MetricsRouteServed(notFoundRoute, micros() - start);
+    });
+
+    //  Start HTTP (web) server, mDNS is started by the network task
+    server.begin();
+    Serial.println("HTTP server started.");
+
+    //  Authenticate HTTP requests
+    const char * headerkeys[] = {"User-Agent","Cookie","If-None-Match"} ;
+    size_t headerkeyssize = sizeof(headerkeys)/sizeof(char*);
+    server.collectHeaders(headerkeys, headerkeyssize );
+
+    //  MQTT
+    MqttConnectionBegin(wclient, PSclient, NodeService);
+    PSclient.setBufferSize(MQTT_BUFFER_SIZE);
+
+    //  Live reconfiguration
+    ReconfigRegister("heartbeat", RECONFIG_HEARTBEAT, ApplyHeartbeatChanges);
+    ReconfigRegister("timezone", RECONFIG_TIMEZONE, ApplyTimeZoneChanges);
+    ReconfigRegister("mqtt", RECONFIG_MQTT_SERVER | RECONFIG_MQTT_TOPIC, ApplyMqttChanges);
+    ReconfigRegister("web", RECONFIG_MQTT_TOPIC, ApplyWebChanges);
+
+    //  Scheduler
+    httpTask = SchedulerAddTask("http", HttpTaskCallback, HTTP_TASK_INTERVAL, DEFAULT_TASK_BUDGET);
+    mqttTask = SchedulerAddTask("mqtt", MqttTaskCallback, MQTT_TASK_INTERVAL, DEFAULT_TASK_BUDGET);
+    eventsTask = SchedulerAddTask("events", EventsTaskCallback, EVENTS_TASK_INTERVAL, DEFAULT_TASK_BUDGET);
+    networkTask = SchedulerAddTask("network", NetworkTaskCallback, NETWORK_TASK_INTERVAL, DEFAULT_TASK_BUDGET);
+    SchedulerEnableTask(networkTask);     //  Starts the WiFi connection on the first pass
+    heartbeatTask = SchedulerAddTask("heartbeat", HeartbeatTaskCallback, appConfig.heartbeatInterval * 1000, DEFAULT_TASK_BUDGET);
+    ntpTask = SchedulerAddTask("ntp", NtpTaskCallback, NTP_TASK_INTERVAL, DEFAULT_TASK_BUDGET, false);
+
+    #ifdef _use_local_sun_data
+    sunDataTask = SchedulerAddTask("sundata", SunDataTaskCallback, SUN_DATA_TASK_INTERVAL, DEFAULT_TASK_BUDGET, false);
+    entranceLightTask = SchedulerAddTask("entrance", EntranceLightTaskCallback, ENTRANCE_LIGHT_TASK_INTERVAL, DEFAULT_TASK_BUDGET, false);
+    #endif
+
+    journalTask = SchedulerAddTask("journal", JournalTaskCallback, JOURNAL_TASK_INTERVAL, DEFAULT_TASK_BUDGET);
+    configTask = SchedulerAddTask("config", ConfigTaskCallback, CONFIG_TASK_INTERVAL, DEFAULT_TASK_BUDGET);
+    bootTask = SchedulerAddTask("boot", BootTaskCallback, BOOT_TASK_INTERVAL, DEFAULT_TASK_BUDGET);
+
+    #ifdef _use_benchmarks
+    benchmarkTask = SchedulerAddTask("benchmark", BenchmarkTaskCallback, BENCHMARK_TASK_INTERVAL, 0);
+    #endif
+
+    //  Randomizer
+    SetRandomSeed();
+
+    // Set the initial connection state
+    connectionState = STATE_CHECK_WIFI_CONNECTION;
+
+    BootPhase("Services");
+}
+
+void loop(){
+  BootMilestone(BOOT_LOOP);
+  NodeLoop();
 }
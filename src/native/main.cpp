@@ -0,0 +1,959 @@
+/*
+    main.cpp - Entry point of the native (host) build
+
+    Runs the hardware independent part of the firmware on the fakes in
+    native/: the settings are loaded from the data directory, the inputs,
+    buttons, zones and relays are wired up by NodeBegin() (see node.h) and
+    driven by the scheduler on the virtual clock.
+
+    Usage: program [-d <data directory>] [-v] [sim <trace> [-l <max latency ms>] [-o] | bench | sun | format | ntp | json]
+
+    Without a command a short demo runs, "sim" replays a trace (see
+    native/simulation.h) and fails if the staircase timer misbehaves or a
+    press takes longer than the latency limit to switch the light or the
+    relays and MQTT messages differ from the ones the trace expects. With -o
+    the broker is unreachable while the node keeps trying to connect, every
+    attempt blocks for MQTT_CONNECT_TIMEOUT and the latency limit and the
+    timer checks must hold all the same. "bench" runs the host side of the
+    benchmarks (see benchmark.h), "sun" checks the fixed-point kernel and
+    the sun table file against SunEventUT() for every day of several years,
+    "format" checks timeformat.h on edge dates and against gmtime(), "ntp"
+    runs the NTP client against a fake server and "json" publishes the task
+    statistics and the metrics with every task and route slot in use,
+    checks nothing is cut off and that the settings export imports again.
+*/
+
+#define _use_input_interrupt
+
+#include "includes.h"
+#include <simulation.h>
+
+#define SIM_DEFAULT_MAX_LATENCY (2 * INPUT_TASK_INTERVAL)
+#define SIM_DNS_DELAY 20                  //  ms
+
+//  The fake hardware
+PCF857x i2c_relays(I2C_LED_PANEL0_ADDRESS, &Wire);
+WiFiClient wclient;
+PubSubClient PSclient(wclient);
+ESP8266WebServer server(80);
+
+config appConfig;
+
+bool verbose = false;
+bool simulating = false;
+
+const char * const lightEvents[] = {"zone off", "staircase started", "staircase extended", "staircase forced on", "entrance toggled", "entrance scheduled"};
+
+void ReportLightEvent(LIGHT_EVENT event, uint8_t channel){
+  if (simulating) SimLightEvent(event, channel);
+
+  if (verbose || !simulating)
+    Serial.printf("%10lu  light: %s (relay %u, %lu ms left)\r\n", millis(), lightEvents[event], channel, ZoneRemaining(channel));
+}
+
+void NativeSetup(const char *dataDirectory){
+  LittleFS.HalSetRoot(dataDirectory);
+  TemplatesBegin(templateFields, FIELD_COUNT);
+
+  uint8_t error = ReadConfig(CONFIG_FILE, appConfig);
+  if (error != SETTINGS_OK) error = ReadSettings(SETTINGS_FILE, appConfig, "ESP", 0);
+  if (error != SETTINGS_OK){
+    Serial.printf("%s Using the defaults.\r\n", settingsErrors[error]);
+
+    StaticJsonDocument<16> empty;
+    SettingsFromJson(appConfig, empty, "ESP", 0);
+  }
+
+  BuildMqttTopics(appConfig.mqttTopic, 0);
+  MqttConnectionBegin(wclient, PSclient, NodeService);
+  PSclient.connect("native");
+
+  i2c_relays.HalSetInterruptPin(PCF8574_INT_GPIO);
+
+  NodeBegin(i2c_relays, PSclient, appConfig, ReportLightEvent, NULL);
+}
+
+void RunFor(unsigned long ms){
+  uint8_t outputs = i2c_relays.HalOutputs();
+  unsigned long end = millis() + ms;
+
+  while ((long)(millis() - end) < 0){
+    NodeLoop();
+    HalAdvance(1);
+
+    if (i2c_relays.HalOutputs() != outputs){
+      outputs = i2c_relays.HalOutputs();
+      Serial.printf("%10lu  relays: 0x%02X\r\n", millis(), outputs);
+    }
+  }
+}
+
+//  Presses input 1 (staircase) and lets the light time out
+void RunStaircaseDemo(){
+  Serial.printf("Staircase delay: %lu s\r\n", appConfig.staircaseLightDelay);
+
+  i2c_relays.HalSetInputs(INPUT_MASK_ALL & ~INPUT_MASK_1);
+  RunFor(200);
+  i2c_relays.HalSetInputs(INPUT_MASK_ALL);
+  RunFor(appConfig.staircaseLightDelay * 1000 + 1000);
+
+  Serial.printf("MQTT publishes: %lu\r\n", PSclient.publishes);
+}
+
+void PrintSunData(){
+  double sunrise = SunEventUT(year(), month(), day(), LATITUDE, LONGITUDE, Sunrise);
+  double sunset = SunEventUT(year(), month(), day(), LATITUDE, LONGITUDE, Sunset);
+
+  Serial.printf("%04d-%02d-%02d  sunrise %.3f h UT, sunset %.3f h UT\r\n", year(), month(), day(), sunrise, sunset);
+}
+
+void WriteFieldName(Print &out, uint8_t field){
+  out.print("[");
+  out.print(templateFieldNames[field]);
+  out.print("]");
+}
+
+void RenderIndexPage(){
+  ChunkedResponse response(server);
+
+  response.begin(200, "text/html");
+  bool rendered = RenderTemplate(pageTemplates[PAGE_INDEX], response, WriteFieldName);
+  response.end();
+
+  Serial.printf("index.html: %s, %u segments, %u bytes in %u chunks\r\n", rendered ? "rendered" : "failed", pageTemplates[PAGE_INDEX].segmentCount, (unsigned int)server.body.size(), server.chunks);
+}
+
+//  Benchmarks, the host side of benchmark.h
+volatile double benchSink;
+template_t *benchPage = NULL;
+NullPrint benchOut;
+
+const char benchCommand[] = "{\"POWER1\":\"ON\",\"POWER2\":\"OFF\"}";
+
+void BenchWriteSettings(){
+  WriteSettings(SETTINGS_FILE, appConfig);
+}
+
+void BenchReadSettings(){
+  ReadSettings(SETTINGS_FILE, appConfig, "ESP", 0);
+}
+
+void BenchWriteConfig(){
+  WriteConfig(CONFIG_FILE, CONFIG_TEMP_FILE, appConfig);
+}
+
+void BenchReadConfig(){
+  ReadConfig(CONFIG_FILE, appConfig);
+}
+
+void BenchParseCommand(){
+  StaticJsonDocument<JSON_MQTT_COMMAND_SIZE> doc;
+  benchSink = (bool)deserializeJson(doc, benchCommand);
+}
+
+void BenchEventLogPush(){
+  EventLogPush(EVENTCATEGORIES::StaircaseLight, 1, "Staircaselights", "60");
+}
+
+//  Volatile, or the compiler folds the whole kernel into a constant
+volatile int benchDay = 21;
+
+//  With a constant day the compiler may evaluate the double version at compile time too
+void BenchSunEvent(){
+  benchSink = SunEventUT(2021, 6, benchDay, LATITUDE, LONGITUDE, Sunrise);
+}
+
+void BenchSunEventSeconds(){
+  benchSink = SunEventSeconds(2021, 6, benchDay, SUN_DEGREES(LATITUDE), SUN_DEGREES(LONGITUDE), Sunrise);
+}
+
+void BenchSunTableLookup(){
+  benchSink = SunTableLookup(2021, 6, benchDay, Sunrise);
+}
+
+const time_t benchTime = 1624269600;
+
+void BenchFormatDateTime(){
+  char buffer[DATETIME_LENGTH];
+  benchSink = FormatDateTime(buffer, sizeof(buffer), benchTime + benchDay);
+}
+
+void BenchFormatInterval(){
+  char buffer[INTERVAL_LENGTH];
+  benchSink = FormatInterval(buffer, sizeof(buffer), 123456 + benchDay);
+}
+
+//  The C library for comparison
+void BenchStrftime(){
+  char buffer[DATETIME_LENGTH];
+  time_t time = benchTime + benchDay;
+  struct tm tm;
+  gmtime_r(&time, &tm);
+  benchSink = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm);
+}
+
+//  The header is rendered in place like on the device, so both renderers
+//  below produce the same page
+void WriteBenchField(Print &out, uint8_t field){
+  if (field == FIELD_PAGEHEADER) RenderTemplate(headerTemplate, out, WriteBenchField);
+  else WriteFieldName(out, field);
+}
+
+void BenchRenderPage(){
+  RenderTemplate(*benchPage, benchOut, WriteBenchField);
+}
+
+//  The renderer the handlers used before templates.h, as the baseline: the
+//  page is read line by line into a String and every line is searched for
+//  each placeholder the page may contain. Like the old code it drops the
+//  line breaks of the page, not those of the header.
+char legacyTokens[FIELD_COUNT][TEMPLATE_MAX_FIELD_NAME + 3];
+bool legacyFields[FIELD_COUNT];
+
+void LegacyFindFields(const template_t &t){
+  for (uint8_t i = 0; i < t.segmentCount; i++) {
+    if (t.segments[i].field != TEMPLATE_LITERAL) legacyFields[t.segments[i].field] = true;
+  }
+}
+
+//  Once the templates are parsed, the fields of the page and its header
+void LegacyBegin(const template_t &page){
+  memset(legacyFields, 0, sizeof(legacyFields));
+  LegacyFindFields(page);
+  if (legacyFields[FIELD_PAGEHEADER]) LegacyFindFields(headerTemplate);
+
+  for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+    snprintf(legacyTokens[i], sizeof(legacyTokens[i]), "%%%s%%", templateFields[i]);
+  }
+}
+
+void LegacyRenderPage(const template_t &page, Print &out){
+  File f = LittleFS.open(headerTemplate.path, "r");
+  String headerString;
+  if (f.available()) headerString = f.readString();
+  f.close();
+
+  f = LittleFS.open(page.path, "r");
+  String s, htmlString;
+
+  while (f.available()){
+    s = f.readStringUntil('\n');
+
+    for (uint8_t i = 0; i < FIELD_COUNT; i++) {
+      if (!legacyFields[i] || s.indexOf(legacyTokens[i]) < 0) continue;
+
+      if (i == FIELD_PAGEHEADER) s.replace(legacyTokens[i], headerString);
+      else {
+        String value = "[";
+        value += templateFields[i];
+        value += "]";
+        s.replace(legacyTokens[i], value);
+      }
+    }
+    htmlString += s;
+  }
+  f.close();
+
+  out.write((const uint8_t*)htmlString.c_str(), htmlString.length());
+}
+
+void BenchLegacyRenderPage(){
+  LegacyRenderPage(*benchPage, benchOut);
+}
+
+class StringPrint : public Print {
+  public:
+    size_t write(uint8_t c) override { text += (char)c; return 1; }
+    using Print::write;
+
+    String text;
+};
+
+String WithoutLineBreaks(const String &text){
+  String s;
+  for (const char *c = text.c_str(); *c; c++) {
+    if (*c != '\n') s += *c;
+  }
+  return s;
+}
+
+//  Both renderers must agree, apart from the line breaks
+bool LegacyOutputMatches(template_t &page){
+  StringPrint rendered, legacy;
+
+  RenderTemplate(page, rendered, WriteBenchField);
+  LegacyRenderPage(page, legacy);
+
+  return WithoutLineBreaks(rendered.text) == WithoutLineBreaks(legacy.text).c_str();
+}
+
+void RunBenchmarks(const char *dataDirectory){
+  BenchPrintHeader(Serial);
+  BenchCompare(Serial, "SunEventSeconds", BenchSunEventSeconds, "SunEventUT", BenchSunEvent, 100000);
+
+  //  The sun table and the settings go to a scratch directory, not to data/
+  char scratch[] = "/tmp/stairlight-XXXXXX";
+  if (mkdtemp(scratch) != NULL){
+    LittleFS.HalSetRoot(scratch);
+    SunTableBegin(SUN_DEGREES(LATITUDE), SUN_DEGREES(LONGITUDE));
+    BenchRun(Serial, "SunTableLookup", BenchSunTableLookup, 100000);
+
+    BenchRun(Serial, "WriteSettings", BenchWriteSettings, 1000);
+    BenchRun(Serial, "ReadSettings", BenchReadSettings, 1000);
+    BenchRun(Serial, "WriteConfig", BenchWriteConfig, 1000);
+    BenchRun(Serial, "ReadConfig", BenchReadConfig, 1000);
+
+    //  A scripted reconfiguration, one change every 100 ms
+    unsigned long writes = configStats.writes;
+    for (uint8_t i = 0; i < 50; i++) {
+      ConfigChanged();
+      HalAdvance(100);
+      if (ConfigSaveDue()) SaveConfig(appConfig);
+    }
+    HalAdvance(CONFIG_SAVE_QUIET_TIME);
+    if (ConfigSaveDue()) SaveConfig(appConfig);
+    Serial.printf("50 settings changes, %lu flash writes\r\n", configStats.writes - writes);
+
+    LittleFS.remove(SUN_TABLE_FILE);
+    LittleFS.remove(SETTINGS_FILE);
+    LittleFS.remove(CONFIG_FILE);
+    rmdir(scratch);
+    LittleFS.HalSetRoot(dataDirectory);
+  }
+
+  BenchRun(Serial, "Parse MQTT command", BenchParseCommand, 100000);
+  BenchRun(Serial, "EventLogPush", BenchEventLogPush, 100000);
+  BenchRun(Serial, "FormatDateTime", BenchFormatDateTime, 100000);
+  BenchRun(Serial, "gmtime_r + strftime", BenchStrftime, 100000);
+  BenchRun(Serial, "FormatInterval", BenchFormatInterval, 100000);
+
+  char names[PAGE_COUNT][2][40];
+  uint8_t matching = 0;
+
+  for (uint8_t i = 0; i < PAGE_COUNT; i++) {
+    benchPage = &pageTemplates[i];
+    snprintf(names[i][0], sizeof(names[i][0]), "Render %s", pageTemplates[i].path + 1);
+    BenchRun(Serial, names[i][0], BenchRenderPage, 1000);
+
+    LegacyBegin(*benchPage);
+    if (LegacyOutputMatches(*benchPage)) matching++;
+
+    snprintf(names[i][1], sizeof(names[i][1]), "Legacy %s", pageTemplates[i].path + 1);
+    BenchRun(Serial, names[i][1], BenchLegacyRenderPage, 1000);
+  }
+  Serial.printf("Legacy renderer output matches on %u of %u pages\r\n", matching, PAGE_COUNT);
+}
+
+//  Sun checks, SunEventSeconds() and the sun table against SunEventUT()
+#define SUN_CHECK_FIRST_YEAR 2020
+#define SUN_CHECK_LAST_YEAR 2027
+#define SUN_CHECK_KERNEL_MAX_ERROR 1      //  s, the kernel rounds to seconds
+#define SUN_CHECK_TABLE_MAX_ERROR 31      //  s, the table rounds that to minutes
+
+//  UT seconds of the event or SUN_NO_EVENT
+typedef int32_t (*sunCandidate_t)(int year, int month, int day, double latitude, sunRiseSunset event);
+
+struct sunCheck_t{
+  unsigned long days;
+  unsigned long mismatches;       //  Event on one side only
+  double maxError;                //  s
+  double worstLatitude;
+};
+
+uint8_t DaysInMonth(int year, int month){
+  static const uint8_t days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+  return month == 2 && leap ? 29 : days[month - 1];
+}
+
+int32_t SunKernelCandidate(int year, int month, int day, double latitude, sunRiseSunset event){
+  return SunEventSeconds(year, month, day, SUN_DEGREES(latitude), SUN_DEGREES(LONGITUDE), event);
+}
+
+int32_t SunTableCandidate(int year, int month, int day, double latitude, sunRiseSunset event){
+  int16_t minutes = SunTableLookup(year, month, day, event);
+  return minutes == SUN_TABLE_NO_EVENT ? SUN_NO_EVENT : minutes * 60;
+}
+
+void CheckSunEvents(sunCandidate_t candidate, double latitude, sunCheck_t &check){
+  for (int year = SUN_CHECK_FIRST_YEAR; year <= SUN_CHECK_LAST_YEAR; year++) {
+    for (int month = 1; month <= 12; month++) {
+      for (int day = 1; day <= DaysInMonth(year, month); day++) {
+        check.days++;
+
+        for (uint8_t event = Sunrise; event <= Sunset; event++) {
+          double expected = SunEventUT(year, month, day, latitude, LONGITUDE, (sunRiseSunset)event);
+          int32_t seconds = candidate(year, month, day, latitude, (sunRiseSunset)event);
+
+          if ((expected < 0) != (seconds == SUN_NO_EVENT)){
+            check.mismatches++;
+            continue;
+          }
+          if (expected < 0) continue;
+
+          //  Around midnight UT one side may have wrapped
+          double error = fabs(seconds - expected * 3600);
+          if (error > 43200) error = 86400 - error;
+
+          if (error > check.maxError){
+            check.maxError = error;
+            check.worstLatitude = latitude;
+          }
+        }
+      }
+    }
+  }
+}
+
+bool ReportSunCheck(const char *name, const sunCheck_t &check, double maxError){
+  Serial.printf("%-16s %-8lu %-11lu %-14.2f %.0f\r\n", name, check.days, check.mismatches, check.maxError, check.worstLatitude);
+
+  if (check.mismatches == 0 && check.maxError <= maxError) return true;
+
+  Serial.printf("FAIL: %s is more than %.0f s off\r\n", name, maxError);
+  return false;
+}
+
+//  Every whole latitude between the polar circles
+int RunSunCheck(){
+  sunCheck_t kernel = {0, 0, 0, 0};
+  sunCheck_t table = {0, 0, 0, 0};
+
+  //  The table file is rebuilt for every latitude in a scratch directory
+  char scratch[] = "/tmp/stairlight-XXXXXX";
+  if (mkdtemp(scratch) == NULL) return 1;
+  LittleFS.HalSetRoot(scratch);
+
+  bool cached = true;
+
+  for (int latitude = -66; latitude <= 66; latitude++) {
+    CheckSunEvents(SunKernelCandidate, latitude, kernel);
+
+    SunTableBegin(SUN_DEGREES(latitude), SUN_DEGREES(LONGITUDE));
+    cached = cached && sunTableCached;
+    CheckSunEvents(SunTableCandidate, latitude, table);
+  }
+
+  cached = cached && SunTableBegin(SUN_DEGREES(66), SUN_DEGREES(LONGITUDE));
+
+  LittleFS.remove(SUN_TABLE_FILE);
+  rmdir(scratch);
+
+  Serial.printf("%-16s %-8s %-11s %-14s %s\r\n", "Check", "Days", "Mismatches", "Max error (s)", "At latitude");
+
+  bool passed = ReportSunCheck("SunEventSeconds", kernel, SUN_CHECK_KERNEL_MAX_ERROR);
+  passed = ReportSunCheck("Sun table", table, SUN_CHECK_TABLE_MAX_ERROR) && passed;
+
+  //  Otherwise the lookups above calculated the entries instead of reading them
+  if (!cached){
+    Serial.println("FAIL: the sun table file was not written or not reused");
+    passed = false;
+  }
+
+  return passed ? 0 : 1;
+}
+
+//  timeformat.h checks
+struct formatCase_t{
+  long long time;
+  const char *expected;
+};
+
+const formatCase_t dateTimeCases[] = {
+  {0, "1970-01-01T00:00:00"},
+  {-1, "1969-12-31T23:59:59"},
+  {951782400, "2000-02-29T00:00:00"},
+  {1624269600, "2021-06-21T10:00:00"},
+  {2147483647, "2038-01-19T03:14:07"},
+  {2147483648LL, "2038-01-19T03:14:08"},
+  {4102444800LL, "2100-01-01T00:00:00"},
+  {4107542400LL, "2100-03-01T00:00:00"},
+  {4294967295LL, "2106-02-07T06:28:15"},
+  {253402300799LL, "9999-12-31T23:59:59"},
+  {253402300800LL, "10000-01-01T00:00:00"}
+};
+
+const formatCase_t intervalCases[] = {
+  {0, "0:00:00"},
+  {59, "0:00:59"},
+  {3600, "1:00:00"},
+  {123456, "34:17:36"},
+  {4294967295LL, "1193046:28:15"}
+};
+
+const formatCase_t durationCases[] = {
+  {0, "PT0S"},
+  {59, "PT59S"},
+  {60, "PT1M0S"},
+  {3661, "PT1H1M1S"},
+  {86400, "P1DT0H0M0S"},
+  {90061, "P1DT1H1M1S"},
+  {4294967295LL, "P49710DT6H28M15S"}
+};
+
+bool CheckFormat(const char *name, long long input, const char *result, const char *expected){
+  if (strcmp(result, expected) == 0) return true;
+
+  Serial.printf("FAIL: %s(%lld) = \"%s\", expected \"%s\"\r\n", name, input, result, expected);
+  return false;
+}
+
+int RunFormatCheck(){
+  char buffer[32];
+  unsigned long checks = 0;
+  bool passed = true;
+
+  for (const formatCase_t &c : dateTimeCases) {
+    FormatDateTime(buffer, sizeof(buffer), c.time);
+    passed = CheckFormat("FormatDateTime", c.time, buffer, c.expected) && passed;
+    checks++;
+  }
+  for (const formatCase_t &c : intervalCases) {
+    FormatInterval(buffer, sizeof(buffer), c.time);
+    passed = CheckFormat("FormatInterval", c.time, buffer, c.expected) && passed;
+    checks++;
+  }
+  for (const formatCase_t &c : durationCases) {
+    FormatDuration(buffer, sizeof(buffer), c.time);
+    passed = CheckFormat("FormatDuration", c.time, buffer, c.expected) && passed;
+    checks++;
+  }
+
+  FormatTime(buffer, sizeof(buffer), 1624269659);
+  passed = CheckFormat("FormatTime", 1624269659, buffer, "10:00:59") && passed;
+
+  //  Too small buffers are left empty
+  passed = (FormatDateTime(buffer, DATETIME_LENGTH - 1, 0) == 0 && buffer[0] == 0) && passed;
+  passed = (FormatInterval(buffer, 7, 0) == 0 && buffer[0] == 0) && passed;
+  checks += 3;
+
+  //  Every 86399 s from 1900 to 2200 against the C library, hits every time of day in the end
+  char expected[32];
+  for (long long t = -2208988800LL; t < 7258118400LL; t += 86399) {
+    time_t time = t;
+    struct tm tm;
+    gmtime_r(&time, &tm);
+    strftime(expected, sizeof(expected), "%Y-%m-%dT%H:%M:%S", &tm);
+
+    FormatDateTime(buffer, sizeof(buffer), time);
+    if (!CheckFormat("FormatDateTime", t, buffer, expected)){
+      passed = false;
+      break;
+    }
+    checks++;
+  }
+
+  Serial.printf("%lu checks, %s\r\n", checks, passed ? "passed" : "failed");
+
+  return passed ? 0 : 1;
+}
+
+//  NTP checks, NTP.h against a fake server behind the fake UDP socket
+//  The answer arrives on a pass of the ntp task, so T4 is exact
+#define NTP_CHECK_PATH_DELAY  45        //  ms each way
+#define NTP_CHECK_PROCESSING  10        //  ms the server holds the request
+#define NTP_CHECK_DNS_DELAY   20        //  ms
+#define NTP_CHECK_ATTEMPTS    11
+
+enum NTP_PEER_MODE {
+  NTP_PEER_ANSWER,
+  NTP_PEER_KISS_OF_DEATH,
+  NTP_PEER_SILENT
+};
+
+NTP_PEER_MODE ntpPeerMode = NTP_PEER_ANSWER;
+int64_t ntpPeerOffset = 0;                  //  ms, server clock minus local clock
+unsigned long ntpPeerRequestAt = 0;         //  millis() of the last request
+
+size_t NtpCheckPeer(const uint8_t *request, size_t length, uint8_t *answer, unsigned long &delay){
+  ntpPeerRequestAt = millis();
+  if (ntpPeerMode == NTP_PEER_SILENT || length < NTP_PACKET_SIZE) return 0;
+
+  uint64_t t2 = NTPLocalTime() + ntpPeerOffset + NTP_CHECK_PATH_DELAY;
+
+  memset(answer, 0, NTP_PACKET_SIZE);
+  answer[0] = 0b00100100;                   //  LI 0, version 4, server
+  answer[1] = 2;                            //  Stratum
+  memcpy(answer + 24, request + 40, 8);     //  Originate is our transmit timestamp
+  NTPMsToTimestamp(t2, answer + 32);
+  NTPMsToTimestamp(t2 + NTP_CHECK_PROCESSING, answer + 40);
+
+  if (ntpPeerMode == NTP_PEER_KISS_OF_DEATH){
+    answer[1] = 0;
+    memcpy(answer + 12, "RATE", 4);
+  }
+
+  delay = 2 * NTP_CHECK_PATH_DELAY + NTP_CHECK_PROCESSING;
+  return NTP_PACKET_SIZE;
+}
+
+void NtpCheckBegin(bool dns){
+  ntp = ntpState_t();
+  for (resolverEntry_t &entry : resolverEntries) {
+    entry.host[0] = 0;
+    entry.status = RESOLVER_IDLE;
+  }
+
+  HalDnsReset();
+  if (dns){
+    for (uint8_t i = 0; i < NTP_SERVER_COUNT; i++) HalDnsSetHost(ntpServerNames[i], "10.0.0.123", NTP_CHECK_DNS_DELAY);
+  }
+
+  udp.HalReset();
+  udp.HalSetPeer(NtpCheckPeer);
+  ntpPeerMode = NTP_PEER_ANSWER;
+  ntpPeerOffset = 0;
+
+  initNTP();
+}
+
+//  Steps NTPRun() the way the ntp task does until an attempt succeeds or
+//  fails, false if none ended within ms
+bool NtpCheckAttempt(unsigned long ms){
+  unsigned long successes = ntp.successes;
+  unsigned long failures = ntp.failures;
+  unsigned long end = millis() + ms;
+
+  while ((long)(millis() - end) < 0){
+    NTPRun();
+    if (ntp.successes != successes || ntp.failures != failures) return true;
+    HalAdvance(NTP_TASK_INTERVAL);
+  }
+  return false;
+}
+
+bool CheckNtp(const char *name, bool passed, unsigned long &checks){
+  checks++;
+  if (!passed) Serial.printf("FAIL: %s\r\n", name);
+  return passed;
+}
+
+bool CheckNtpRange(const char *name, long value, long expected, long tolerance, unsigned long &checks){
+  checks++;
+  if (labs(value - expected) <= tolerance) return true;
+
+  Serial.printf("FAIL: %s is %ld, expected %ld +- %ld\r\n", name, value, expected, tolerance);
+  return false;
+}
+
+int RunNtpCheck(){
+  unsigned long checks = 0;
+  bool passed = true;
+  ntpResult_t result;
+  byte packet[NTP_PACKET_SIZE];
+  byte originate[8];
+
+  //  The calculation on known timestamps: T1 1000.000, T2 1000.600, T3 1000.610, T4 1000.100 s
+  NTPMsToTimestamp(1000000, originate);
+  memset(packet, 0, sizeof(packet));
+  packet[0] = 0b00100100;
+  packet[1] = 2;
+  memcpy(packet + 24, originate, 8);
+  NTPMsToTimestamp(1000600, packet + 32);
+  NTPMsToTimestamp(1000610, packet + 40);
+
+  passed = CheckNtp("answer accepted", NTPProcessResponse(packet, originate, 1000000, 1000100, result) == NTP_RESPONSE_OK, checks) && passed;
+  passed = CheckNtpRange("offset", result.offset, 555, 0, checks) && passed;
+  passed = CheckNtpRange("delay", result.delay, 90, 0, checks) && passed;
+
+  packet[1] = 0;
+  passed = CheckNtp("Kiss-o'-Death rejected", NTPProcessResponse(packet, originate, 1000000, 1000100, result) == NTP_RESPONSE_REJECT, checks) && passed;
+  packet[1] = 2;
+  packet[0] = 0b11100100;
+  passed = CheckNtp("unsynchronized server rejected", NTPProcessResponse(packet, originate, 1000000, 1000100, result) == NTP_RESPONSE_REJECT, checks) && passed;
+  packet[0] = 0b00100100;
+  packet[31] ^= 1;
+  passed = CheckNtp("answer to another request ignored", NTPProcessResponse(packet, originate, 1000000, 1000100, result) == NTP_RESPONSE_IGNORE, checks) && passed;
+
+  //  Sync through the state machine, the name is looked up first
+  setTime(12, 0, 0, 21, 6, 2021);
+  NtpCheckBegin(true);
+  ntpPeerOffset = 12345;
+
+  NTPRun();
+  passed = CheckNtp("waits for the DNS answer", ntp.state == NTP_RESOLVING && udp.sent == 0, checks) && passed;
+  passed = CheckNtp("synced", NtpCheckAttempt(1000) && ntp.synced, checks) && passed;
+
+  //  Once synced the local clock has ms resolution, the second sync measures exactly
+  ntpPeerOffset = 250;
+  ntp.nextAttemptAt = millis();
+  passed = CheckNtp("synced again", NtpCheckAttempt(1000) && ntp.successes == 2, checks) && passed;
+  passed = CheckNtpRange("offset", (long)ntp.lastOffset, 250, 1, checks) && passed;
+  passed = CheckNtpRange("delay", (long)ntp.lastDelay, 2 * NTP_CHECK_PATH_DELAY, 1, checks) && passed;
+  passed = CheckNtp("no more DNS queries", halDnsQueryCount == 1, checks) && passed;
+
+  //  Kiss-o'-Death, the next server is tried after the backoff
+  ntpPeerMode = NTP_PEER_KISS_OF_DEATH;
+  ntp.nextAttemptAt = millis();
+  uint8_t server = ntp.server;
+  unsigned long startedAt = millis();
+
+  passed = CheckNtp("Kiss-o'-Death ends the attempt", NtpCheckAttempt(NTP_RESPONSE_TIMEOUT) && ntp.failures == 1, checks) && passed;
+  passed = CheckNtp("Kiss-o'-Death before the timeout", millis() - startedAt < NTP_RESPONSE_TIMEOUT, checks) && passed;
+  passed = CheckNtp("next server", ntp.server == (server + 1) % NTP_SERVER_COUNT, checks) && passed;
+  passed = CheckNtpRange("retry after", ntp.nextAttemptAt - millis(), NTP_MIN_BACKOFF, 0, checks) && passed;
+
+  //  A silent server times out, the retries back off up to NTP_MAX_BACKOFF
+  NtpCheckBegin(true);
+  ntpPeerMode = NTP_PEER_SILENT;
+
+  unsigned long backoff = NTP_MIN_BACKOFF;
+  unsigned long previousBackoff = 0;
+
+  for (uint8_t i = 0; i < NTP_CHECK_ATTEMPTS; i++) {
+    unsigned long failedAt = millis();
+
+    if (!NtpCheckAttempt(NTP_MAX_BACKOFF + 2 * NTP_RESPONSE_TIMEOUT)){
+      passed = CheckNtp("attempt ends", false, checks) && passed;
+      break;
+    }
+
+    //  The first attempt starts right away, the others after the backoff and the DNS lookup
+    passed = CheckNtpRange("retry after", ntpPeerRequestAt - failedAt, previousBackoff, NTP_CHECK_DNS_DELAY + NTP_TASK_INTERVAL, checks) && passed;
+    passed = CheckNtpRange("timeout", millis() - ntpPeerRequestAt, NTP_RESPONSE_TIMEOUT, NTP_TASK_INTERVAL, checks) && passed;
+    passed = CheckNtpRange("backoff", ntp.nextAttemptAt - millis(), backoff, 0, checks) && passed;
+
+    previousBackoff = backoff;
+    backoff = backoff * 2 > NTP_MAX_BACKOFF ? NTP_MAX_BACKOFF : backoff * 2;
+  }
+
+  //  Without a DNS answer the lookup times out, nothing is sent
+  NtpCheckBegin(false);
+  startedAt = millis();
+
+  passed = CheckNtp("DNS timeout ends the attempt", NtpCheckAttempt(2 * RESOLVER_TIMEOUT) && ntp.failures == 1, checks) && passed;
+  passed = CheckNtpRange("DNS timeout", millis() - startedAt, RESOLVER_TIMEOUT, NTP_TASK_INTERVAL, checks) && passed;
+  passed = CheckNtp("nothing sent", udp.sent == 0, checks) && passed;
+
+  Serial.printf("%lu checks, %s\r\n", checks, passed ? "passed" : "failed");
+
+  return passed ? 0 : 1;
+}
+
+//  The connecting part of the firmware's mqtt task
+void MqttTaskCallback(){
+  if (!PSclient.connected()) MqttConnect(PSclient, appConfig);
+}
+
+int RunSimulation(const char *trace, unsigned long maxLatency, bool brokerDown){
+  if (!SimLoadTrace(trace)) return 2;
+
+  simulating = true;
+  simVerbose = verbose;
+
+  SimulationBegin(i2c_relays, PSclient);
+
+  if (brokerDown){
+    PSclient.HalSetBrokerAvailable(false);
+    HalDnsSetHost(appConfig.mqttServer, "10.0.0.1", SIM_DNS_DELAY);
+    SchedulerAddTask("mqtt", MqttTaskCallback, MQTT_TASK_INTERVAL, DEFAULT_TASK_BUDGET);
+
+    //  Nothing reaches the broker
+    simExpectations.erase(std::remove_if(simExpectations.begin(), simExpectations.end(), [](const simExpectation_t &e){ return e.mqtt; }), simExpectations.end());
+  }
+
+  //  Give the last timer time to run out, extended once
+  SimulationRun(NodeLoop, 2 * appConfig.staircaseLightDelay * 1000 + 1000);
+  SimulationPrintResult(Serial);
+
+  bool failed = false;
+
+  if (brokerDown){
+    Serial.printf("MQTT connects:    %lu attempts, broker unreachable\r\n", PSclient.connectAttempts);
+    Serial.println();
+    SchedulerPrintStats(Serial);
+  }
+
+  if (simResult.timerEarly || simResult.timerLate){
+    Serial.println("FAIL: the staircase light did not switch off at its deadline");
+    failed = true;
+  }
+  if (simResult.latencyMax > maxLatency){
+    Serial.printf("FAIL: press to relay latency %lu ms is over the %lu ms limit\r\n", simResult.latencyMax, maxLatency);
+    failed = true;
+  }
+  if (simResult.missing || simResult.unexpected){
+    Serial.println("FAIL: the relays or the MQTT messages did not follow the trace");
+    failed = true;
+  }
+
+  return failed ? 1 : 0;
+}
+
+//  JSON reports. The task and route tables are filled up with the longest
+//  names and the widest counters of the device, serialized into documents
+//  of the capacity the firmware uses, published and parsed back.
+
+#define JSON_CHECK_MAX_COUNTER 4294967295UL   //  unsigned long on the device
+
+char jsonCheckPayload[4096];
+size_t jsonCheckLength = 0;
+
+void JsonCheckReceive(const char *topic, const char *payload, bool retained){
+  jsonCheckLength = strlcpy(jsonCheckPayload, payload, sizeof(jsonCheckPayload));
+}
+
+bool CheckJson(const char *name, bool passed, unsigned long &checks){
+  checks++;
+  if (!passed) Serial.printf("FAIL: %s\r\n", name);
+  return passed;
+}
+
+void JsonCheckFillTasks(){
+  static char names[SCHEDULER_MAX_TASKS][16];
+
+  for (uint8_t i = taskCount; i < SCHEDULER_MAX_TASKS; i++) {
+    snprintf(names[i], sizeof(names[i]), "staircase%02u", i);
+    SchedulerAddTask(names[i], NULL, 1000, 1000, false);
+  }
+
+  for (uint8_t i = 0; i < taskCount; i++) {
+    tasks[i].runs = tasks[i].overruns = JSON_CHECK_MAX_COUNTER;
+    tasks[i].totalRunTime = tasks[i].maxRunTime = tasks[i].maxJitter = JSON_CHECK_MAX_COUNTER;
+  }
+}
+
+void JsonCheckFillMetrics(){
+  static char uris[METRICS_MAX_ROUTES][32];
+
+  //  As long as the longest page, /staircaselighttimer.html
+  for (uint8_t i = routeCount; i < METRICS_MAX_ROUTES; i++) {
+    snprintf(uris[i], sizeof(uris[i]), "/staircaselighttim%02u.html", i);
+    MetricsAddRoute(uris[i]);
+  }
+
+  for (uint8_t i = 0; i < routeCount; i++) {
+    routeMetrics[i].requests = routeMetrics[i].totalTime = routeMetrics[i].maxTime = JSON_CHECK_MAX_COUNTER;
+  }
+
+  loopMetrics.passes = loopMetrics.maxPass = loopMetrics.maxStall = JSON_CHECK_MAX_COUNTER;
+  loopMetrics.totalTime = JSON_CHECK_MAX_COUNTER;
+  for (uint8_t i = 0; i < METRICS_LOOP_BUCKETS; i++) loopMetrics.histogram[i] = JSON_CHECK_MAX_COUNTER;
+
+  inputStats.reads = relayStats.writes = JSON_CHECK_MAX_COUNTER;
+  mqttStats.publishes = mqttStats.failures = mqttStats.skipped = JSON_CHECK_MAX_COUNTER;
+  configStats.changes = configStats.writes = configStats.failures = JSON_CHECK_MAX_COUNTER;
+  ESP.HalSetHeap(81920, 81920, 100);
+}
+
+int RunJsonCheck(){
+  unsigned long checks = 0;
+  bool passed = true;
+
+  PSclient.HalSetBrokerHook(JsonCheckReceive);
+
+  //  The task table
+  JsonCheckFillTasks();
+
+  StaticJsonDocument<SCHEDULER_STATS_JSON_SIZE> taskDoc;
+  SchedulerStatsToJson(taskDoc.to<JsonArray>());
+
+  passed = CheckJson("task table fits the document", !taskDoc.overflowed(), checks) && passed;
+  passed = CheckJson("task table published", MqttPublishJson(PSclient, TOPIC_TASKS, taskDoc), checks) && passed;
+  passed = CheckJson("task table payload complete", jsonCheckLength == measureJson(taskDoc), checks) && passed;
+  Serial.printf("Task table:  %u tasks, %u bytes\r\n", taskCount, jsonCheckLength);
+
+  StaticJsonDocument<SCHEDULER_STATS_JSON_SIZE> taskParsed;
+  passed = CheckJson("task table parses", !deserializeJson(taskParsed, jsonCheckPayload), checks) && passed;
+  passed = CheckJson("every task reported", taskParsed.as<JsonArray>().size() == SCHEDULER_MAX_TASKS, checks) && passed;
+  passed = CheckJson("last task complete", taskParsed[SCHEDULER_MAX_TASKS - 1]["Overruns"].as<unsigned long>() == JSON_CHECK_MAX_COUNTER, checks) && passed;
+
+  //  A document too small for the report is dropped, not published cut short
+  StaticJsonDocument<SCHEDULER_STATS_JSON_SIZE / 2> smallDoc;
+  SchedulerStatsToJson(smallDoc.to<JsonArray>());
+  unsigned long publishes = PSclient.publishes;
+
+  passed = CheckJson("overflow dropped", !MqttPublishJson(PSclient, TOPIC_TASKS, smallDoc) && PSclient.publishes == publishes, checks) && passed;
+  passed = CheckJson("overflow counted", mqttStats.overflows == 1, checks) && passed;
+
+  //  The metrics with every route in use
+  JsonCheckFillMetrics();
+
+  StaticJsonDocument<METRICS_JSON_SIZE> metricsDoc;
+  MetricsToJson(metricsDoc);
+
+  passed = CheckJson("metrics fit the document", !metricsDoc.overflowed(), checks) && passed;
+  passed = CheckJson("metrics published", MqttPublishJson(PSclient, TOPIC_METRICS, metricsDoc), checks) && passed;
+  passed = CheckJson("metrics payload complete", jsonCheckLength == measureJson(metricsDoc), checks) && passed;
+  Serial.printf("Metrics:     %u routes, %u bytes\r\n", routeCount, jsonCheckLength);
+
+  StaticJsonDocument<METRICS_JSON_SIZE> metricsParsed;
+  passed = CheckJson("metrics parse", !deserializeJson(metricsParsed, jsonCheckPayload), checks) && passed;
+  passed = CheckJson("every route reported", metricsParsed["Http"].as<JsonObject>().size() == METRICS_MAX_ROUTES, checks) && passed;
+  passed = CheckJson("config counters reported", metricsParsed["Config"]["Failures"].as<unsigned long>() == JSON_CHECK_MAX_COUNTER, checks) && passed;
+
+  //  The settings export imports again unchanged, without the password
+  StaticJsonDocument<JSON_SETTINGS_SIZE> settingsDoc;
+  char settingsJson[SETTINGS_MAX_FILE_SIZE];
+
+  SettingsToJson(appConfig, settingsDoc);
+  settingsDoc.remove("password");
+  serializeJson(settingsDoc, settingsJson, sizeof(settingsJson));
+
+  config imported = appConfig;
+  passed = CheckJson("settings export parses", !deserializeJson(settingsDoc, settingsJson), checks) && passed;
+  SettingsFromJson(imported, settingsDoc, appConfig);
+  passed = CheckJson("settings round trip", ReconfigDiff(imported, appConfig) == 0, checks) && passed;
+
+  //  A partial import only changes what it has, invalid values are ignored
+  char partialJson[] = "{\"zoneDelays\":[0,30],\"zoneRetrigger\":[9,1]}";
+  passed = CheckJson("partial settings parse", !deserializeJson(settingsDoc, partialJson), checks) && passed;
+  SettingsFromJson(imported, settingsDoc, appConfig);
+  passed = CheckJson("partial import changes the zones only", ReconfigDiff(imported, appConfig) == RECONFIG_ZONES, checks) && passed;
+  passed = CheckJson("zone delay imported", imported.zoneDelays[1] == 30 && imported.zoneRetrigger[1] == RETRIGGER_EXTEND, checks) && passed;
+  passed = CheckJson("invalid retrigger ignored", imported.zoneRetrigger[0] == appConfig.zoneRetrigger[0], checks) && passed;
+
+  Serial.printf("%lu checks, %s\r\n", checks, passed ? "passed" : "failed");
+
+  return passed ? 0 : 1;
+}
+
+int main(int argc, char *argv[]){
+  const char *dataDirectory = "data";
+  const char *trace = NULL;
+  bool bench = false;
+  bool sun = false;
+  bool format = false;
+  bool ntpCheck = false;
+  bool jsonCheck = false;
+  unsigned long maxLatency = SIM_DEFAULT_MAX_LATENCY;
+  bool brokerDown = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) dataDirectory = argv[++i];
+    else if (strcmp(argv[i], "-v") == 0) verbose = true;
+    else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) maxLatency = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "-o") == 0) brokerDown = true;
+    else if (strcmp(argv[i], "sim") == 0 && i + 1 < argc) trace = argv[++i];
+    else if (strcmp(argv[i], "bench") == 0) bench = true;
+    else if (strcmp(argv[i], "sun") == 0) sun = true;
+    else if (strcmp(argv[i], "format") == 0) format = true;
+    else if (strcmp(argv[i], "ntp") == 0) ntpCheck = true;
+    else if (strcmp(argv[i], "json") == 0) jsonCheck = true;
+    else {
+      Serial.printf("Usage: %s [-d <data directory>] [-v] [sim <trace> [-l <max latency ms>] [-o] | bench | sun | format | ntp | json]\r\n", argv[0]);
+      return 2;
+    }
+  }
+
+  NativeSetup(dataDirectory);
+
+  if (trace != NULL) return RunSimulation(trace, maxLatency, brokerDown);
+
+  if (bench){
+    RunBenchmarks(dataDirectory);
+    return 0;
+  }
+
+  if (sun) return RunSunCheck();
+  if (format) return RunFormatCheck();
+  if (ntpCheck) return RunNtpCheck();
+  if (jsonCheck) return RunJsonCheck();
+
+  setTime(12, 0, 0, 21, 6, 2021);
+  PrintSunData();
+  RenderIndexPage();
+  RunStaircaseDemo();
+
+  return 0;
+}
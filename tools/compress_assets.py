@@ -0,0 +1,35 @@
+# Makes gzipped copies of the static web assets in the data directory before
+# the file system image is built. The web server sends the .gz copy when
+# there is one (see include/staticfiles.h).
+
+Import("env")
+
+import gzip
+import os
+import shutil
+
+STATIC_EXTENSIONS = (".ico", ".css", ".js", ".svg", ".png")
+
+
+def compress_assets():
+    data_dir = env.subst("$PROJECT_DATA_DIR")
+
+    for name in sorted(os.listdir(data_dir)):
+        if not name.endswith(STATIC_EXTENSIONS):
+            continue
+
+        source = os.path.join(data_dir, name)
+        target = source + ".gz"
+
+        if os.path.exists(target) and os.path.getmtime(target) >= os.path.getmtime(source):
+            continue
+
+        # mtime=0 keeps the output identical between builds
+        with open(source, "rb") as src, open(target, "wb") as raw:
+            with gzip.GzipFile(fileobj=raw, mode="wb", compresslevel=9, mtime=0) as dst:
+                shutil.copyfileobj(src, dst)
+
+        print("Compressed %s (%d -> %d bytes)" % (name, os.path.getsize(source), os.path.getsize(target)))
+
+
+compress_assets()